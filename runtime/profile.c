@@ -0,0 +1,45 @@
+/*
+ * Writes the block counters of code compiled with `zips --instrument` when
+ * the program exits. Link this file into the instrumented program, run it on
+ * representative inputs, then compile again with `--profile-use=file`.
+ *
+ * The profile is appended to the file named by ZIPS_PROFILE, or zips.profile,
+ * so several runs add up.
+ */
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* The linker defines these around the zips_profile section. Each record is a
+ * pointer to the function name, the block count and a counter per block. */
+extern uint64_t __start_zips_profile[] __attribute__((weak));
+extern uint64_t __stop_zips_profile[] __attribute__((weak));
+
+static void writeProfile(void) {
+  const char *fileName = getenv("ZIPS_PROFILE");
+  if (!fileName) {
+    fileName = "zips.profile";
+  }
+  FILE *file = fopen(fileName, "a");
+  if (!file) {
+    perror(fileName);
+    return;
+  }
+  uint64_t *record = __start_zips_profile;
+  while (record < __stop_zips_profile) {
+    const char *functionName = (const char *)(uintptr_t)record[0];
+    uint64_t blockCount = record[1];
+    fputs(functionName, file);
+    for (uint64_t block = 0; block < blockCount; block++) {
+      fprintf(file, " %" PRIu64, record[2 + block]);
+    }
+    fputc('\n', file);
+    record += 2 + blockCount;
+  }
+  fclose(file);
+}
+
+__attribute__((constructor)) static void registerProfileWriter(void) {
+  atexit(writeProfile);
+}
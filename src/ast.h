@@ -3,6 +3,7 @@
 
 #include "location.hh"
 #include "type.h"
+#include <cstdint>
 #include <memory>
 #include <optional>
 #include <vector>
@@ -10,13 +11,22 @@
 #include <map>
 
 namespace zips {
-enum class AstNodeType {
+enum class AstNodeType : uint8_t {
   COMPILATION_UNIT,
   FUNCTION,
   BINARY_EXPRESSION,
   VARIABLE_REFERENCE,
-  RETURN_STATEMENT
+  RETURN_STATEMENT,
+  IF_STATEMENT,
+  WHILE_STATEMENT,
+  VARIABLE_DEFINITION,
+  ASSIGNMENT,
+  CALL_EXPRESSION,
+  ERROR
 };
+// Must be kept in sync with the last AstNodeType.
+static constexpr size_t AST_NODE_TYPE_COUNT =
+    static_cast<size_t>(AstNodeType::ERROR) + 1;
 
 struct Location {
   size_t line;
@@ -25,6 +35,8 @@ struct Location {
 
   Location(const zips::location &location)
       : line(location.begin.line), column(location.begin.column), file(location.begin.filename ? *location.begin.filename : "<Unknown>") {}
+  Location(size_t line, size_t column, std::string file)
+      : line(line), column(column), file(std::move(file)) {}
 };
 
 class AstNode {
@@ -40,6 +52,10 @@ public:
 
   std::optional<std::unique_ptr<Type>> type;
 
+  // Children in evaluation order, for the generic traversal in visitor.h.
+  virtual size_t getChildCount() const { return 0; }
+  virtual AstNode *getChild(size_t index) const { return nullptr; }
+
   std::string toString() {
     if (type) {
       return type->get()->toString() + ": " + toStringInternal();
@@ -51,16 +67,44 @@ public:
   private:
    virtual std::string toStringInternal() const = 0;
 };
+
+// The primitive type of a type checked node.
+static inline PrimitiveTypeType getPrimitiveType(AstNode *node) {
+  return static_cast<PrimitiveTypeNode *>(node->type->get())
+      ->getPrimitiveType();
+}
+
+// An import of another module, whose functions the unit can then call.
+struct Import {
+  Location location;
+  std::string moduleName;
+};
+
 class CompilationUnitNode : public AstNode {
+  std::vector<Import> imports;
   std::vector<std::unique_ptr<AstNode>> nodes;
 
 public:
-  CompilationUnitNode(Location location, std::vector<std::unique_ptr<AstNode>> nodes)
-      : AstNode(AstNodeType::COMPILATION_UNIT, location), nodes(std::move(nodes)) {}
+  static constexpr AstNodeType NODE_TYPE = AstNodeType::COMPILATION_UNIT;
+
+  CompilationUnitNode(Location location, std::vector<std::unique_ptr<AstNode>> nodes,
+                      std::vector<Import> imports = {})
+      : AstNode(AstNodeType::COMPILATION_UNIT, location),
+        imports(std::move(imports)), nodes(std::move(nodes)) {}
+  const std::vector<Import> &getImports() { return imports; }
   const std::vector<std::unique_ptr<AstNode>> &getNodes() { return nodes; }
+  // Drops the definitions for which remove returns true.
+  template <typename Predicate> void removeNodes(Predicate remove) {
+    std::erase_if(nodes, [&](auto &node) { return remove(node.get()); });
+  }
+  size_t getChildCount() const override { return nodes.size(); }
+  AstNode *getChild(size_t index) const override { return nodes[index].get(); }
 
   std::string toStringInternal() const override {
     std::string result = "CompilationUnitNode {\n";
+    for (auto &import : imports) {
+      result += "import " + import.moduleName + "\n";
+    }
     for (auto &node : nodes) {
       result += node->toString() + "\n";
     }
@@ -71,16 +115,27 @@ public:
 class FunctionNode : public AstNode {
   std::string name;
   std::vector<NamedType> parameters;
+  std::optional<std::unique_ptr<Type>> declaredReturnType;
   std::vector<std::unique_ptr<AstNode>> body;
 
 public:
+  static constexpr AstNodeType NODE_TYPE = AstNodeType::FUNCTION;
+
   FunctionNode(Location location, std::string name, std::vector<NamedType> parameters,
-               std::vector<std::unique_ptr<AstNode>> body)
+               std::vector<std::unique_ptr<AstNode>> body,
+               std::optional<std::unique_ptr<Type>> declaredReturnType = std::nullopt)
       : AstNode(AstNodeType::FUNCTION, location), name(std::move(name)),
-        parameters(std::move(parameters)), body(std::move(body)) {}
+        parameters(std::move(parameters)),
+        declaredReturnType(std::move(declaredReturnType)), body(std::move(body)) {}
   const std::string &getName() { return name; }
   const std::vector<NamedType> &getParameters() { return parameters; }
+  // Without one, the return type is inferred from the first return.
+  const std::optional<std::unique_ptr<Type>> &getDeclaredReturnType() {
+    return declaredReturnType;
+  }
   const std::vector<std::unique_ptr<AstNode>> &getBody() { return body; }
+  size_t getChildCount() const override { return body.size(); }
+  AstNode *getChild(size_t index) const override { return body[index].get(); }
 
   std::string toStringInternal() const override {
     std::string result = "FunctionNode {\n";
@@ -90,6 +145,9 @@ public:
       result += parameter.name + ": " + parameter.type->toString() + "\n";
     }
     result += "]\n";
+    if (declaredReturnType) {
+      result += "returnType: " + declaredReturnType->get()->toString() + "\n";
+    }
     result += "body: [\n";
     for (auto &node : body) {
       result += node->toString() + "\n";
@@ -99,29 +157,90 @@ public:
     return result;
   }
 };
-enum class BinaryOperator { ADD, SUBTRACT, MULTIPLY, DIVIDE, MODULO };
+enum class BinaryOperator {
+  ADD,
+  SUBTRACT,
+  MULTIPLY,
+  DIVIDE,
+  MODULO,
+  // Traps if the sum doesn't fit the result type.
+  CHECKED_ADD,
+  // Clamps the sum to the range of the result type.
+  SATURATING_ADD,
+  EQUAL,
+  NOT_EQUAL,
+  LESS,
+  LESS_EQUAL,
+  GREATER,
+  GREATER_EQUAL
+};
+// Must be kept in sync with the last BinaryOperator.
+static constexpr size_t BINARY_OPERATOR_COUNT =
+    static_cast<size_t>(BinaryOperator::GREATER_EQUAL) + 1;
 static std::map<BinaryOperator, std::string> binaryOperatorToString = {
     {BinaryOperator::ADD, "+"},
     {BinaryOperator::SUBTRACT, "-"},
     {BinaryOperator::MULTIPLY, "*"},
     {BinaryOperator::DIVIDE, "/"},
-    {BinaryOperator::MODULO, "%"}
+    {BinaryOperator::MODULO, "%"},
+    {BinaryOperator::CHECKED_ADD, "+?"},
+    {BinaryOperator::SATURATING_ADD, "+|"},
+    {BinaryOperator::EQUAL, "=="},
+    {BinaryOperator::NOT_EQUAL, "!="},
+    {BinaryOperator::LESS, "<"},
+    {BinaryOperator::LESS_EQUAL, "<="},
+    {BinaryOperator::GREATER, ">"},
+    {BinaryOperator::GREATER_EQUAL, ">="}
 };
+static inline bool isComparison(BinaryOperator operatorType) {
+  return operatorType >= BinaryOperator::EQUAL;
+}
 class BinaryExpressionNode : public AstNode {
   BinaryOperator operatorType;
   std::unique_ptr<AstNode> left;
   std::unique_ptr<AstNode> right;
 
 public:
+  static constexpr AstNodeType NODE_TYPE = AstNodeType::BINARY_EXPRESSION;
+
   BinaryExpressionNode(Location location, BinaryOperator operatorType,
                        std::unique_ptr<AstNode> left,
                        std::unique_ptr<AstNode> right)
       : AstNode(AstNodeType::BINARY_EXPRESSION, location), operatorType(operatorType),
         left(std::move(left)), right(std::move(right)) {}
+  ~BinaryExpressionNode() {
+    // Take nested binary expressions apart without recursing, since long
+    // chains (such as generated sums) would otherwise overflow the stack.
+    if (!isBinaryExpression(left) && !isBinaryExpression(right)) {
+      return;
+    }
+    std::vector<std::unique_ptr<AstNode>> pending;
+    pending.push_back(std::move(left));
+    pending.push_back(std::move(right));
+    while (!pending.empty()) {
+      std::unique_ptr<AstNode> node = std::move(pending.back());
+      pending.pop_back();
+      if (isBinaryExpression(node)) {
+        auto binaryExpression = static_cast<BinaryExpressionNode *>(node.get());
+        pending.push_back(std::move(binaryExpression->left));
+        pending.push_back(std::move(binaryExpression->right));
+      }
+    }
+  }
   BinaryOperator getOperator() { return operatorType; }
   AstNode *getLeft() { return left.get(); }
   AstNode *getRight() { return right.get(); }
+  size_t getChildCount() const override { return 2; }
+  AstNode *getChild(size_t index) const override {
+    return index == 0 ? left.get() : right.get();
+  }
+
+private:
+  static bool isBinaryExpression(const std::unique_ptr<AstNode> &node) {
+    return node && node->getNodeType() == AstNodeType::BINARY_EXPRESSION;
+  }
 
+public:
   std::string toStringInternal() const override {
     std::string result = "BinaryExpressionNode {\n";
     result += "operator: " + binaryOperatorToString[operatorType] + "\n";
@@ -135,10 +254,14 @@ class ReturnStatementNode : public AstNode {
   std::unique_ptr<AstNode> expression;
 
 public:
+  static constexpr AstNodeType NODE_TYPE = AstNodeType::RETURN_STATEMENT;
+
   ReturnStatementNode(Location location, std::unique_ptr<AstNode> expression)
       : AstNode(AstNodeType::RETURN_STATEMENT, location),
         expression(std::move(expression)) {}
   AstNode *getExpression() { return expression.get(); }
+  size_t getChildCount() const override { return 1; }
+  AstNode *getChild(size_t index) const override { return expression.get(); }
 
   std::string toStringInternal() const  override {
     std::string result = "ReturnStatementNode {\n";
@@ -151,6 +274,8 @@ class VariableReferenceNode : public AstNode {
   std::string name;
 
 public:
+  static constexpr AstNodeType NODE_TYPE = AstNodeType::VARIABLE_REFERENCE;
+
   VariableReferenceNode(Location location, std::string name)
       : AstNode(AstNodeType::VARIABLE_REFERENCE, location), name(std::move(name)) {}
   const std::string &getName() { return name; }
@@ -162,6 +287,189 @@ public:
     return result;
   }
 };
+static inline std::string
+statementsToString(const std::vector<std::unique_ptr<AstNode>> &statements) {
+  std::string result = "[\n";
+  for (auto &statement : statements) {
+    result += statement->toString() + "\n";
+  }
+  result += "]";
+  return result;
+}
+class IfStatementNode : public AstNode {
+  std::unique_ptr<AstNode> condition;
+  std::vector<std::unique_ptr<AstNode>> thenBody;
+  std::vector<std::unique_ptr<AstNode>> elseBody;
+
+public:
+  static constexpr AstNodeType NODE_TYPE = AstNodeType::IF_STATEMENT;
+
+  IfStatementNode(Location location, std::unique_ptr<AstNode> condition,
+                  std::vector<std::unique_ptr<AstNode>> thenBody,
+                  std::vector<std::unique_ptr<AstNode>> elseBody)
+      : AstNode(AstNodeType::IF_STATEMENT, location),
+        condition(std::move(condition)), thenBody(std::move(thenBody)),
+        elseBody(std::move(elseBody)) {}
+  AstNode *getCondition() { return condition.get(); }
+  const std::vector<std::unique_ptr<AstNode>> &getThenBody() {
+    return thenBody;
+  }
+  const std::vector<std::unique_ptr<AstNode>> &getElseBody() {
+    return elseBody;
+  }
+
+  // The condition, then the then body followed by the else body.
+  size_t getChildCount() const override {
+    return 1 + thenBody.size() + elseBody.size();
+  }
+  AstNode *getChild(size_t index) const override {
+    if (index == 0) {
+      return condition.get();
+    } else if (index <= thenBody.size()) {
+      return thenBody[index - 1].get();
+    } else {
+      return elseBody[index - 1 - thenBody.size()].get();
+    }
+  }
+
+  std::string toStringInternal() const override {
+    std::string result = "IfStatementNode {\n";
+    result += "condition: " + condition->toString() + "\n";
+    result += "then: " + statementsToString(thenBody) + "\n";
+    result += "else: " + statementsToString(elseBody) + "\n";
+    result += "}";
+    return result;
+  }
+};
+class WhileStatementNode : public AstNode {
+  std::unique_ptr<AstNode> condition;
+  std::vector<std::unique_ptr<AstNode>> body;
+
+public:
+  static constexpr AstNodeType NODE_TYPE = AstNodeType::WHILE_STATEMENT;
+
+  WhileStatementNode(Location location, std::unique_ptr<AstNode> condition,
+                     std::vector<std::unique_ptr<AstNode>> body)
+      : AstNode(AstNodeType::WHILE_STATEMENT, location),
+        condition(std::move(condition)), body(std::move(body)) {}
+  AstNode *getCondition() { return condition.get(); }
+  const std::vector<std::unique_ptr<AstNode>> &getBody() { return body; }
+
+  // The condition followed by the body.
+  size_t getChildCount() const override { return 1 + body.size(); }
+  AstNode *getChild(size_t index) const override {
+    return index == 0 ? condition.get() : body[index - 1].get();
+  }
+
+  std::string toStringInternal() const override {
+    std::string result = "WhileStatementNode {\n";
+    result += "condition: " + condition->toString() + "\n";
+    result += "body: " + statementsToString(body) + "\n";
+    result += "}";
+    return result;
+  }
+};
+class VariableDefinitionNode : public AstNode {
+  std::string name;
+  std::optional<std::unique_ptr<Type>> declaredType;
+  std::unique_ptr<AstNode> value;
+
+public:
+  static constexpr AstNodeType NODE_TYPE = AstNodeType::VARIABLE_DEFINITION;
+
+  VariableDefinitionNode(Location location, std::string name,
+                         std::optional<std::unique_ptr<Type>> declaredType,
+                         std::unique_ptr<AstNode> value)
+      : AstNode(AstNodeType::VARIABLE_DEFINITION, location),
+        name(std::move(name)), declaredType(std::move(declaredType)),
+        value(std::move(value)) {}
+  const std::string &getName() { return name; }
+  const std::optional<std::unique_ptr<Type>> &getDeclaredType() {
+    return declaredType;
+  }
+  AstNode *getValue() { return value.get(); }
+
+  size_t getChildCount() const override { return 1; }
+  AstNode *getChild(size_t index) const override { return value.get(); }
+
+  std::string toStringInternal() const override {
+    std::string result = "VariableDefinitionNode {\n";
+    result += "name: " + name + "\n";
+    if (declaredType) {
+      result += "declaredType: " + declaredType->get()->toString() + "\n";
+    }
+    result += "value: " + value->toString() + "\n";
+    result += "}";
+    return result;
+  }
+};
+class AssignmentNode : public AstNode {
+  std::string name;
+  std::unique_ptr<AstNode> value;
+
+public:
+  static constexpr AstNodeType NODE_TYPE = AstNodeType::ASSIGNMENT;
+
+  AssignmentNode(Location location, std::string name,
+                 std::unique_ptr<AstNode> value)
+      : AstNode(AstNodeType::ASSIGNMENT, location), name(std::move(name)),
+        value(std::move(value)) {}
+  const std::string &getName() { return name; }
+  AstNode *getValue() { return value.get(); }
+
+  size_t getChildCount() const override { return 1; }
+  AstNode *getChild(size_t index) const override { return value.get(); }
+
+  std::string toStringInternal() const override {
+    std::string result = "AssignmentNode {\n";
+    result += "name: " + name + "\n";
+    result += "value: " + value->toString() + "\n";
+    result += "}";
+    return result;
+  }
+};
+class CallExpressionNode : public AstNode {
+  std::string name;
+  std::vector<std::unique_ptr<AstNode>> arguments;
+
+public:
+  static constexpr AstNodeType NODE_TYPE = AstNodeType::CALL_EXPRESSION;
+
+  CallExpressionNode(Location location, std::string name,
+                     std::vector<std::unique_ptr<AstNode>> arguments)
+      : AstNode(AstNodeType::CALL_EXPRESSION, location), name(std::move(name)),
+        arguments(std::move(arguments)) {}
+  const std::string &getName() { return name; }
+  const std::vector<std::unique_ptr<AstNode>> &getArguments() {
+    return arguments;
+  }
+
+  // The called function's type, set by the type checker. The arguments are
+  // converted to its parameter types.
+  std::unique_ptr<FunctionTypeNode> functionType;
+
+  size_t getChildCount() const override { return arguments.size(); }
+  AstNode *getChild(size_t index) const override {
+    return arguments[index].get();
+  }
+
+  std::string toStringInternal() const override {
+    std::string result = "CallExpressionNode {\n";
+    result += "name: " + name + "\n";
+    result += "arguments: " + statementsToString(arguments) + "\n";
+    result += "}";
+    return result;
+  }
+};
+// Stands in for a statement which couldn't be parsed.
+class ErrorNode : public AstNode {
+public:
+  static constexpr AstNodeType NODE_TYPE = AstNodeType::ERROR;
+
+  ErrorNode(Location location) : AstNode(AstNodeType::ERROR, location) {}
+
+  std::string toStringInternal() const override { return "ErrorNode {}"; }
+};
 } // namespace zips
 
 #endif
\ No newline at end of file
@@ -0,0 +1,167 @@
+#include "astCache.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <type_traits>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace zips {
+namespace {
+constexpr char magic[8] = {'Z', 'P', 'S', 'A', 'S', 'T', 0, 0};
+constexpr size_t arrayCount = 14;
+// Arrays start at multiples of this, so they can be used where they are
+// mapped.
+constexpr size_t arrayAlignment = 8;
+
+struct AstCacheArray {
+  uint64_t offset;
+  uint64_t count;
+};
+
+// Native byte order; a cache written with the other one fails the version
+// check.
+struct AstCacheHeader {
+  char magic[8];
+  uint32_t version;
+  FlatStringId file;
+  AstCacheArray arrays[arrayCount];
+};
+static_assert(std::is_trivially_copyable_v<AstCacheHeader>);
+
+// Calls visit with each array of the view, in file order.
+template <typename Visitor> void visitArrays(FlatAstView &view, Visitor visit) {
+  visit(view.nodeTypes);
+  visit(view.nodeData);
+  visit(view.nodeChildren);
+  visit(view.nodeTypeIds);
+  visit(view.nodeLocations);
+  visit(view.children);
+  visit(view.functions);
+  visit(view.parameters);
+  visit(view.calls);
+  visit(view.imports);
+  visit(view.types);
+  visit(view.typeParameters);
+  visit(view.stringData);
+  visit(view.stringOffsets);
+}
+
+uint64_t alignOffset(uint64_t offset) {
+  return (offset + arrayAlignment - 1) / arrayAlignment * arrayAlignment;
+}
+} // namespace
+
+void writeAstCache(const FlatAst &flatAst, std::ostream &output) {
+  FlatAstView view = flatAst.view();
+  AstCacheHeader header{};
+  std::memcpy(header.magic, magic, sizeof(magic));
+  header.version = AST_CACHE_VERSION;
+  header.file = view.file;
+  uint64_t offset = alignOffset(sizeof(AstCacheHeader));
+  size_t index = 0;
+  visitArrays(view, [&](auto &array) {
+    header.arrays[index++] = AstCacheArray{offset, array.size()};
+    offset = alignOffset(offset + array.size() * sizeof(array[0]));
+  });
+  output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  uint64_t written = sizeof(header);
+  index = 0;
+  visitArrays(view, [&](auto &array) {
+    static constexpr char padding[arrayAlignment] = {};
+    output.write(padding, header.arrays[index].offset - written);
+    output.write(reinterpret_cast<const char *>(array.data()),
+                 array.size() * sizeof(array[0]));
+    written = header.arrays[index].offset + array.size() * sizeof(array[0]);
+    index++;
+  });
+}
+
+std::string getAstCachePath(std::string_view sourcePath) {
+  return std::filesystem::path(sourcePath).replace_extension(".zpsast").string();
+}
+
+AstCacheFile::~AstCacheFile() {
+#ifdef _WIN32
+  std::free(data);
+#else
+  if (data) {
+    munmap(data, size);
+  }
+#endif
+}
+
+std::unique_ptr<AstCacheFile> AstCacheFile::open(const std::string &fileName) {
+  std::unique_ptr<AstCacheFile> file(new AstCacheFile());
+#ifdef _WIN32
+  // Without mmap, the file is read into one buffer, still without allocating
+  // per node.
+  FILE *input = std::fopen(fileName.c_str(), "rb");
+  if (!input) {
+    return nullptr;
+  }
+  std::error_code error;
+  file->size = std::filesystem::file_size(fileName, error);
+  file->data = error ? nullptr : std::malloc(std::max<size_t>(file->size, 1));
+  bool read = file->data &&
+              std::fread(file->data, 1, file->size, input) == file->size;
+  std::fclose(input);
+  if (!read) {
+    return nullptr;
+  }
+#else
+  int descriptor = ::open(fileName.c_str(), O_RDONLY);
+  if (descriptor < 0) {
+    return nullptr;
+  }
+  struct stat status;
+  if (fstat(descriptor, &status) != 0 ||
+      static_cast<size_t>(status.st_size) < sizeof(AstCacheHeader)) {
+    close(descriptor);
+    return nullptr;
+  }
+  file->size = static_cast<size_t>(status.st_size);
+  void *mapping =
+      mmap(nullptr, file->size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+  close(descriptor);
+  if (mapping == MAP_FAILED) {
+    return nullptr;
+  }
+  file->data = mapping;
+#endif
+  if (file->size < sizeof(AstCacheHeader)) {
+    return nullptr;
+  }
+  AstCacheHeader header;
+  std::memcpy(&header, file->data, sizeof(header));
+  if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+      header.version != AST_CACHE_VERSION) {
+    return nullptr;
+  }
+  const char *bytes = static_cast<const char *>(file->data);
+  bool valid = true;
+  size_t index = 0;
+  visitArrays(file->view, [&](auto &array) {
+    using Element = std::remove_cvref_t<decltype(array[0])>;
+    AstCacheArray entry = header.arrays[index++];
+    if (entry.offset % arrayAlignment != 0 || entry.offset > file->size ||
+        entry.count > (file->size - entry.offset) / sizeof(Element)) {
+      valid = false;
+      return;
+    }
+    array = std::remove_reference_t<decltype(array)>(
+        reinterpret_cast<const Element *>(bytes + entry.offset), entry.count);
+  });
+  if (!valid) {
+    return nullptr;
+  }
+  file->view.file = header.file;
+  return file;
+}
+} // namespace zips
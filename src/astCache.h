@@ -0,0 +1,51 @@
+#ifndef ZIPS_AST_CACHE_H
+#define ZIPS_AST_CACHE_H
+
+#include "flatAst.h"
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace zips {
+// Must be increased whenever the layout of the flat arrays, or the numbering
+// of the enums stored in them, changes.
+static constexpr uint32_t AST_CACHE_VERSION = 3;
+
+// Writes a type checked FlatAst in the .zpsast format: a header with the
+// version and the offset and size of each array, followed by the arrays as
+// they are laid out in memory.
+void writeAstCache(const FlatAst &flatAst, std::ostream &output);
+
+// The .zpsast file next to a source file.
+std::string getAstCachePath(std::string_view sourcePath);
+
+/**
+ * @brief a .zpsast file mapped into memory.
+ *
+ * The view's arrays point into the mapping, so loading doesn't allocate per
+ * node or copy the arrays. Only the header and array bounds are checked when
+ * opening; unflatten checks the contents.
+ */
+class AstCacheFile {
+  void *data = nullptr;
+  size_t size = 0;
+  FlatAstView view;
+
+  AstCacheFile() = default;
+
+public:
+  ~AstCacheFile();
+  AstCacheFile(const AstCacheFile &) = delete;
+  AstCacheFile &operator=(const AstCacheFile &) = delete;
+
+  // Returns null if the file can't be mapped, or isn't a cache written by
+  // this version.
+  static std::unique_ptr<AstCacheFile> open(const std::string &fileName);
+
+  const FlatAstView &getAst() const { return view; }
+};
+} // namespace zips
+
+#endif
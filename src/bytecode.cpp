@@ -0,0 +1,883 @@
+#include "bytecode.h"
+#include "error.h"
+#include "interpreter.h"
+#include "visitor.h"
+#include <algorithm>
+#include <stdexcept>
+
+// Labels as values let every handler jump straight to the next one, which
+// predicts better than returning to a shared switch.
+#if defined(__GNUC__)
+#define ZIPS_COMPUTED_GOTO 1
+#else
+#define ZIPS_COMPUTED_GOTO 0
+#endif
+
+namespace zips {
+static const char *opcodeNames[] = {
+    "move",       "wrap.i8",   "wrap.i16",  "wrap.i32",  "wrap.u8",
+    "wrap.u16",   "wrap.u32",  "add",       "sub",       "mul",
+    "div.s",      "div.u",     "mod.s",     "mod.u",     "add.check.s",
+    "add.check.u", "add.sat.s", "add.sat.u", "check",    "saturate",
+    "eq",
+    "ne",         "lt.s",      "lt.u",      "le.s",      "le.u",
+    "jump",       "jump.true", "jump.false", "call",      "return"};
+static_assert(std::size(opcodeNames) == BYTECODE_OPCODE_COUNT);
+
+std::string BytecodeFunction::toString() const {
+  std::string result = name + ":\n";
+  for (size_t i = 0; i < code.size(); i++) {
+    const BytecodeInstruction &instruction = code[i];
+    result += "  " + std::to_string(i) + ": ";
+    result += opcodeNames[static_cast<size_t>(instruction.opcode)];
+    switch (instruction.opcode) {
+    case BytecodeOpcode::JUMP:
+      result += " @" + std::to_string(instruction.destination);
+      break;
+    case BytecodeOpcode::JUMP_IF_TRUE:
+    case BytecodeOpcode::JUMP_IF_FALSE:
+      result += " @" + std::to_string(instruction.destination) + ", r" +
+                std::to_string(instruction.a);
+      break;
+    case BytecodeOpcode::CALL:
+      result += " r" + std::to_string(instruction.destination) + ", f" +
+                std::to_string(instruction.a) + ", r" +
+                std::to_string(instruction.b);
+      break;
+    case BytecodeOpcode::RETURN:
+      result += " r" + std::to_string(instruction.a);
+      break;
+    case BytecodeOpcode::MOVE:
+    case BytecodeOpcode::WRAP_I8:
+    case BytecodeOpcode::WRAP_I16:
+    case BytecodeOpcode::WRAP_I32:
+    case BytecodeOpcode::WRAP_U8:
+    case BytecodeOpcode::WRAP_U16:
+    case BytecodeOpcode::WRAP_U32:
+      result += " r" + std::to_string(instruction.destination) + ", r" +
+                std::to_string(instruction.a);
+      break;
+    case BytecodeOpcode::CHECK:
+    case BytecodeOpcode::SATURATE:
+      result += " r" + std::to_string(instruction.destination) + ", r" +
+                std::to_string(instruction.a) + ", " +
+                primitiveTypeTypeToString[static_cast<PrimitiveTypeType>(
+                    instruction.b)];
+      break;
+    default:
+      result += " r" + std::to_string(instruction.destination) + ", r" +
+                std::to_string(instruction.a) + ", r" +
+                std::to_string(instruction.b);
+      break;
+    }
+    result += "\n";
+  }
+  return result;
+}
+
+namespace {
+// Lowers functions as an AstPass, so that deeply nested expressions don't
+// recurse. Registers are allocated like a stack: variables live below the
+// temporaries of the expression being evaluated, and a scope's registers are
+// reused once it ends. Each expression leaves the register holding its value
+// on a stack, which is a new temporary unless the expression is a variable.
+class FunctionLowering : public AstPass {
+  const std::unordered_map<std::string_view, size_t> &functionIndices;
+  Traversal traversal;
+  BytecodeFunction *function = nullptr;
+  FunctionNode *functionNode = nullptr;
+  struct Variable {
+    std::string_view name;
+    uint16_t reg;
+    PrimitiveTypeType type;
+  };
+  // Variables in scope, innermost last.
+  std::vector<Variable> variables;
+  size_t registerTop = 0;
+  std::vector<uint16_t> values;
+  // Where the temporaries of each statement and expression being lowered
+  // begin, innermost last.
+  std::vector<size_t> temporaries;
+  struct Scope {
+    size_t variablesBegin;
+    size_t registersBegin;
+  };
+  std::vector<Scope> scopes;
+  struct IfJumps {
+    size_t jumpToElse;
+    size_t jumpToEnd = 0;
+  };
+  std::vector<IfJumps> ifJumps;
+  // The condition is at the bottom, so each iteration takes one jump. It is
+  // reached before the body, so its code is set aside in conditionCode until
+  // the body is done; conditions have no jumps, so it can be moved.
+  struct Loop {
+    size_t jumpToCondition;
+    size_t conditionBegin;
+    size_t savedConditionBegin = 0;
+    uint16_t condition = 0;
+    uint16_t bodyBegin = 0;
+  };
+  std::vector<Loop> loops;
+  std::vector<BytecodeInstruction> conditionCode;
+
+  uint16_t allocateRegister() {
+    if (registerTop > UINT16_MAX) {
+      throw ZipsError(functionNode->getLocation(),
+                      "Function " + function->name +
+                          " needs more registers than bytecode has (" +
+                          std::to_string(UINT16_MAX + 1) + ")");
+    }
+    uint16_t reg = static_cast<uint16_t>(registerTop++);
+    function->registerCount = std::max(function->registerCount, registerTop);
+    return reg;
+  }
+
+  uint16_t getPosition() const {
+    if (function->code.size() > UINT16_MAX) {
+      throw ZipsError(functionNode->getLocation(),
+                      "Function " + function->name +
+                          " is too large for bytecode jumps, which reach " +
+                          std::to_string(UINT16_MAX + 1) + " instructions");
+    }
+    return static_cast<uint16_t>(function->code.size());
+  }
+
+  size_t emit(BytecodeOpcode opcode, uint16_t destination, uint16_t a = 0,
+              uint16_t b = 0) {
+    function->code.push_back(BytecodeInstruction{opcode, destination, a, b});
+    return function->code.size() - 1;
+  }
+
+  void patchJump(size_t jump) {
+    function->code[jump].destination = getPosition();
+  }
+
+  const Variable &findVariable(std::string_view name) const {
+    for (auto variable = variables.rbegin(); variable != variables.rend();
+         variable++) {
+      if (variable->name == name) {
+        return *variable;
+      }
+    }
+    throw std::runtime_error("Variable not found");
+  }
+
+  uint16_t takeValue() {
+    uint16_t value = values.back();
+    values.pop_back();
+    return value;
+  }
+
+  // Frees the temporaries of the innermost statement or expression.
+  void endTemporaries() {
+    registerTop = temporaries.back();
+    temporaries.pop_back();
+  }
+
+  void pushScope() { scopes.push_back(Scope{variables.size(), registerTop}); }
+  void popScope() {
+    variables.resize(scopes.back().variablesBegin);
+    registerTop = scopes.back().registersBegin;
+    scopes.pop_back();
+  }
+
+  // Expression statements are kept for their errors, but nobody uses their
+  // value. A temporary holding it was allocated where the statement began.
+  void discardStatementValue(AstNode *statement) {
+    switch (statement->getNodeType()) {
+    case AstNodeType::BINARY_EXPRESSION:
+    case AstNodeType::CALL_EXPRESSION:
+      registerTop = takeValue();
+      break;
+    case AstNodeType::VARIABLE_REFERENCE:
+      values.pop_back();
+      break;
+    default:
+      break;
+    }
+  }
+
+  // Moves source to destination, wrapping it around to type if it has a
+  // different type, which may be narrower.
+  void convert(PrimitiveTypeType type, PrimitiveTypeType sourceType,
+               uint16_t destination, uint16_t source) {
+    if (type != sourceType && getBits(type) < 64) {
+      emitWrap(type, destination, source);
+    } else if (destination != source) {
+      emit(BytecodeOpcode::MOVE, destination, source);
+    }
+  }
+
+  void emitWrap(PrimitiveTypeType type, uint16_t destination, uint16_t source) {
+    BytecodeOpcode opcode;
+    switch (getBits(type)) {
+    case 8:
+      opcode =
+          isSigned(type) ? BytecodeOpcode::WRAP_I8 : BytecodeOpcode::WRAP_U8;
+      break;
+    case 16:
+      opcode =
+          isSigned(type) ? BytecodeOpcode::WRAP_I16 : BytecodeOpcode::WRAP_U16;
+      break;
+    case 32:
+      opcode =
+          isSigned(type) ? BytecodeOpcode::WRAP_I32 : BytecodeOpcode::WRAP_U32;
+      break;
+    default:
+      if (destination != source) {
+        emit(BytecodeOpcode::MOVE, destination, source);
+      }
+      return;
+    }
+    emit(opcode, destination, source);
+  }
+
+  static bool isOverflowingAdd(BinaryExpressionNode *binaryExpression) {
+    return binaryExpression->getOperator() == BinaryOperator::CHECKED_ADD ||
+           binaryExpression->getOperator() == BinaryOperator::SATURATING_ADD;
+  }
+
+  void lowerOverflowingAdd(BinaryExpressionNode *binaryExpression,
+                           uint16_t left, uint16_t right, uint16_t result) {
+    PrimitiveTypeType type = getPrimitiveType(binaryExpression);
+    bool isChecked =
+        binaryExpression->getOperator() == BinaryOperator::CHECKED_ADD;
+    if (getBits(type) < 64) {
+      emit(BytecodeOpcode::ADD, result, left, right);
+      emit(isChecked ? BytecodeOpcode::CHECK : BytecodeOpcode::SATURATE,
+           result, result, static_cast<uint16_t>(type));
+    } else if (isChecked) {
+      emit(isSigned(type) ? BytecodeOpcode::ADD_CHECKED_SIGNED
+                          : BytecodeOpcode::ADD_CHECKED_UNSIGNED,
+           result, left, right);
+    } else {
+      emit(isSigned(type) ? BytecodeOpcode::ADD_SATURATING_SIGNED
+                          : BytecodeOpcode::ADD_SATURATING_UNSIGNED,
+           result, left, right);
+    }
+  }
+
+public:
+  explicit FunctionLowering(
+      const std::unordered_map<std::string_view, size_t> &functionIndices)
+      : functionIndices(functionIndices) {
+    onAfterChild<&FunctionLowering::afterFunctionChild>();
+    onLeave<&FunctionLowering::leaveVariableReference>();
+    onEnter<&FunctionLowering::enterBinaryExpression>();
+    onAfterChild<&FunctionLowering::afterBinaryExpressionChild>();
+    onLeave<&FunctionLowering::leaveBinaryExpression>();
+    onEnter<&FunctionLowering::enterCallExpression>();
+    onAfterChild<&FunctionLowering::afterCallExpressionChild>();
+    onLeave<&FunctionLowering::leaveCallExpression>();
+    onEnter<&FunctionLowering::enterReturnStatement>();
+    onLeave<&FunctionLowering::leaveReturnStatement>();
+    onEnter<&FunctionLowering::enterVariableDefinition>();
+    onLeave<&FunctionLowering::leaveVariableDefinition>();
+    onEnter<&FunctionLowering::enterAssignment>();
+    onLeave<&FunctionLowering::leaveAssignment>();
+    onEnter<&FunctionLowering::enterIfStatement>();
+    onAfterChild<&FunctionLowering::afterIfStatementChild>();
+    onLeave<&FunctionLowering::leaveIfStatement>();
+    onEnter<&FunctionLowering::enterWhileStatement>();
+    onAfterChild<&FunctionLowering::afterWhileStatementChild>();
+    onLeave<&FunctionLowering::leaveWhileStatement>();
+  }
+
+  void lower(FunctionNode *node, BytecodeFunction &function) {
+    this->function = &function;
+    functionNode = node;
+    variables.clear();
+    registerTop = 0;
+    values.clear();
+    temporaries.clear();
+    scopes.clear();
+    ifJumps.clear();
+    loops.clear();
+    conditionCode.clear();
+    for (size_t i = 0; i < node->getParameters().size(); i++) {
+      variables.push_back(Variable{node->getParameters()[i].name,
+                                   allocateRegister(),
+                                   function.parameterTypes[i]});
+    }
+    traversal.run(node, {this});
+  }
+
+  void afterFunctionChild(FunctionNode *node, size_t childIndex) {
+    discardStatementValue(node->getChild(childIndex));
+  }
+
+  void leaveVariableReference(VariableReferenceNode *variableReference) {
+    values.push_back(findVariable(variableReference->getName()).reg);
+  }
+
+  void enterBinaryExpression(BinaryExpressionNode *) {
+    temporaries.push_back(registerTop);
+  }
+
+  // The operands of overflowing additions are converted to the result type,
+  // so that additions of narrower types are exact and only the result needs
+  // checking.
+  void afterBinaryExpressionChild(BinaryExpressionNode *binaryExpression,
+                                  size_t childIndex) {
+    if (!isOverflowingAdd(binaryExpression)) {
+      return;
+    }
+    PrimitiveTypeType type = getPrimitiveType(binaryExpression);
+    PrimitiveTypeType operandType =
+        getPrimitiveType(binaryExpression->getChild(childIndex));
+    if (operandType != type) {
+      uint16_t converted = allocateRegister();
+      convert(type, operandType, converted, values.back());
+      values.back() = converted;
+    }
+  }
+
+  void leaveBinaryExpression(BinaryExpressionNode *binaryExpression) {
+    uint16_t right = takeValue();
+    uint16_t left = takeValue();
+    endTemporaries();
+    uint16_t result = allocateRegister();
+    values.push_back(result);
+    if (isOverflowingAdd(binaryExpression)) {
+      lowerOverflowingAdd(binaryExpression, left, right, result);
+      return;
+    }
+    // Like AstInterpreter, the left operand decides the signedness.
+    bool isSignedOperand =
+        isSigned(getPrimitiveType(binaryExpression->getLeft()));
+    auto choose = [&](BytecodeOpcode signedOpcode,
+                      BytecodeOpcode unsignedOpcode) {
+      return isSignedOperand ? signedOpcode : unsignedOpcode;
+    };
+    bool isArithmetic = true;
+    switch (binaryExpression->getOperator()) {
+    case BinaryOperator::ADD:
+      emit(BytecodeOpcode::ADD, result, left, right);
+      break;
+    case BinaryOperator::SUBTRACT:
+      emit(BytecodeOpcode::SUBTRACT, result, left, right);
+      break;
+    case BinaryOperator::MULTIPLY:
+      emit(BytecodeOpcode::MULTIPLY, result, left, right);
+      break;
+    case BinaryOperator::DIVIDE:
+      emit(choose(BytecodeOpcode::DIVIDE_SIGNED,
+                  BytecodeOpcode::DIVIDE_UNSIGNED),
+           result, left, right);
+      break;
+    case BinaryOperator::MODULO:
+      emit(choose(BytecodeOpcode::MODULO_SIGNED,
+                  BytecodeOpcode::MODULO_UNSIGNED),
+           result, left, right);
+      break;
+    case BinaryOperator::CHECKED_ADD:
+    case BinaryOperator::SATURATING_ADD:
+      throw std::runtime_error("Overflowing additions are lowered separately");
+    case BinaryOperator::EQUAL:
+      isArithmetic = false;
+      emit(BytecodeOpcode::EQUAL, result, left, right);
+      break;
+    case BinaryOperator::NOT_EQUAL:
+      isArithmetic = false;
+      emit(BytecodeOpcode::NOT_EQUAL, result, left, right);
+      break;
+    case BinaryOperator::LESS:
+      isArithmetic = false;
+      emit(choose(BytecodeOpcode::LESS_SIGNED, BytecodeOpcode::LESS_UNSIGNED),
+           result, left, right);
+      break;
+    case BinaryOperator::LESS_EQUAL:
+      isArithmetic = false;
+      emit(choose(BytecodeOpcode::LESS_EQUAL_SIGNED,
+                  BytecodeOpcode::LESS_EQUAL_UNSIGNED),
+           result, left, right);
+      break;
+    case BinaryOperator::GREATER:
+      isArithmetic = false;
+      emit(choose(BytecodeOpcode::LESS_SIGNED, BytecodeOpcode::LESS_UNSIGNED),
+           result, right, left);
+      break;
+    case BinaryOperator::GREATER_EQUAL:
+      isArithmetic = false;
+      emit(choose(BytecodeOpcode::LESS_EQUAL_SIGNED,
+                  BytecodeOpcode::LESS_EQUAL_UNSIGNED),
+           result, right, left);
+      break;
+    }
+    if (isArithmetic) {
+      emitWrap(getPrimitiveType(binaryExpression), result, result);
+    }
+  }
+
+  // Each argument is computed above the registers of the ones before it,
+  // and then converted into its place.
+  void enterCallExpression(CallExpressionNode *callExpression) {
+    temporaries.push_back(registerTop);
+    if (!callExpression->getArguments().empty()) {
+      allocateRegister();
+    }
+  }
+
+  void afterCallExpressionChild(CallExpressionNode *callExpression,
+                                size_t childIndex) {
+    auto &parameterTypes = callExpression->functionType->getParameterTypes();
+    uint16_t argumentRegister =
+        static_cast<uint16_t>(temporaries.back() + childIndex);
+    convert(static_cast<PrimitiveTypeNode *>(parameterTypes[childIndex].get())
+                ->getPrimitiveType(),
+            getPrimitiveType(callExpression->getChild(childIndex)),
+            argumentRegister, takeValue());
+    registerTop = argumentRegister + 1;
+    if (childIndex + 1 < callExpression->getArguments().size()) {
+      allocateRegister();
+    }
+  }
+
+  void leaveCallExpression(CallExpressionNode *callExpression) {
+    auto index = functionIndices.find(callExpression->getName());
+    if (index == functionIndices.end()) {
+      throw std::runtime_error("Can't call " + callExpression->getName() +
+                               " from another module");
+    }
+    if (index->second > UINT16_MAX) {
+      throw ZipsError(functionNode->getLocation(),
+                      "Too many functions for bytecode");
+    }
+    uint16_t argumentsBegin = static_cast<uint16_t>(temporaries.back());
+    endTemporaries();
+    uint16_t result = allocateRegister();
+    emit(BytecodeOpcode::CALL, result, static_cast<uint16_t>(index->second),
+         argumentsBegin);
+    values.push_back(result);
+  }
+
+  void enterReturnStatement(ReturnStatementNode *) {
+    temporaries.push_back(registerTop);
+  }
+
+  void leaveReturnStatement(ReturnStatementNode *returnStatement) {
+    AstNode *expression = returnStatement->getExpression();
+    uint16_t value = takeValue();
+    if (function->returnType != getPrimitiveType(expression)) {
+      uint16_t converted = allocateRegister();
+      convert(function->returnType, getPrimitiveType(expression), converted,
+              value);
+      value = converted;
+    }
+    emit(BytecodeOpcode::RETURN, 0, value);
+    endTemporaries();
+  }
+
+  void enterVariableDefinition(VariableDefinitionNode *) {
+    temporaries.push_back(registerTop);
+  }
+
+  void leaveVariableDefinition(VariableDefinitionNode *variableDefinition) {
+    uint16_t value = takeValue();
+    endTemporaries();
+    // Adopts the temporary holding the value, if there is one.
+    uint16_t variable = allocateRegister();
+    PrimitiveTypeType type = getPrimitiveType(variableDefinition);
+    convert(type, getPrimitiveType(variableDefinition->getValue()), variable,
+            value);
+    variables.push_back(
+        Variable{variableDefinition->getName(), variable, type});
+  }
+
+  void enterAssignment(AssignmentNode *) { temporaries.push_back(registerTop); }
+
+  void leaveAssignment(AssignmentNode *assignment) {
+    uint16_t value = takeValue();
+    const Variable &variable = findVariable(assignment->getName());
+    PrimitiveTypeType valueType = getPrimitiveType(assignment->getValue());
+    if (value == temporaries.back() && variable.type == valueType) {
+      // The value was just computed, so compute it into the variable.
+      function->code.back().destination = variable.reg;
+    } else {
+      convert(variable.type, valueType, variable.reg, value);
+    }
+    endTemporaries();
+  }
+
+  void enterIfStatement(IfStatementNode *) {
+    temporaries.push_back(registerTop);
+  }
+
+  void afterIfStatementChild(IfStatementNode *ifStatement, size_t childIndex) {
+    if (childIndex == 0) {
+      uint16_t condition = takeValue();
+      registerTop = temporaries.back();
+      ifJumps.push_back(
+          IfJumps{emit(BytecodeOpcode::JUMP_IF_FALSE, 0, condition)});
+      pushScope();
+    } else {
+      discardStatementValue(ifStatement->getChild(childIndex));
+    }
+    if (!ifStatement->getElseBody().empty() &&
+        childIndex == ifStatement->getThenBody().size()) {
+      popScope();
+      ifJumps.back().jumpToEnd = emit(BytecodeOpcode::JUMP, 0);
+      patchJump(ifJumps.back().jumpToElse);
+      pushScope();
+    }
+  }
+
+  void leaveIfStatement(IfStatementNode *ifStatement) {
+    popScope();
+    IfJumps &jumps = ifJumps.back();
+    patchJump(ifStatement->getElseBody().empty() ? jumps.jumpToElse
+                                                 : jumps.jumpToEnd);
+    ifJumps.pop_back();
+    endTemporaries();
+  }
+
+  void enterWhileStatement(WhileStatementNode *) {
+    temporaries.push_back(registerTop);
+    size_t jumpToCondition = emit(BytecodeOpcode::JUMP, 0);
+    loops.push_back(Loop{jumpToCondition, function->code.size()});
+  }
+
+  void afterWhileStatementChild(WhileStatementNode *whileStatement,
+                                size_t childIndex) {
+    if (childIndex > 0) {
+      discardStatementValue(whileStatement->getChild(childIndex));
+      return;
+    }
+    Loop &loop = loops.back();
+    loop.condition = takeValue();
+    registerTop = temporaries.back();
+    auto &code = function->code;
+    loop.savedConditionBegin = conditionCode.size();
+    conditionCode.insert(conditionCode.end(),
+                         code.begin() +
+                             static_cast<ptrdiff_t>(loop.conditionBegin),
+                         code.end());
+    code.resize(loop.conditionBegin);
+    loop.bodyBegin = getPosition();
+    pushScope();
+  }
+
+  void leaveWhileStatement(WhileStatementNode *) {
+    popScope();
+    Loop &loop = loops.back();
+    patchJump(loop.jumpToCondition);
+    function->code.insert(
+        function->code.end(),
+        conditionCode.begin() +
+            static_cast<ptrdiff_t>(loop.savedConditionBegin),
+        conditionCode.end());
+    conditionCode.resize(loop.savedConditionBegin);
+    emit(BytecodeOpcode::JUMP_IF_TRUE, loop.bodyBegin, loop.condition);
+    loops.pop_back();
+    endTemporaries();
+  }
+};
+} // namespace
+
+BytecodeInterpreter::BytecodeInterpreter(CompilationUnitNode *unit) {
+  // Every signature is known before lowering, so calls can refer to
+  // functions defined later.
+  functions.reserve(unit->getNodes().size());
+  for (auto &node : unit->getNodes()) {
+    auto functionNode = static_cast<FunctionNode *>(node.get());
+    auto functionType =
+        static_cast<FunctionTypeNode *>(functionNode->type->get());
+    BytecodeFunction &function = functions.emplace_back();
+    function.name = functionNode->getName();
+    for (auto &parameterType : functionType->getParameterTypes()) {
+      function.parameterTypes.push_back(
+          static_cast<PrimitiveTypeNode *>(parameterType.get())
+              ->getPrimitiveType());
+    }
+    function.returnType =
+        static_cast<PrimitiveTypeNode *>(functionType->getReturnType().get())
+            ->getPrimitiveType();
+  }
+  for (size_t i = 0; i < functions.size(); i++) {
+    functionIndices[functions[i].name] = i;
+  }
+  FunctionLowering lowering(functionIndices);
+  for (size_t i = 0; i < functions.size(); i++) {
+    lowering.lower(static_cast<FunctionNode *>(unit->getNodes()[i].get()),
+                   functions[i]);
+  }
+}
+
+const BytecodeFunction *
+BytecodeInterpreter::getFunction(std::string_view name) const {
+  auto index = functionIndices.find(name);
+  if (index == functionIndices.end()) {
+    return nullptr;
+  }
+  return &functions[index->second];
+}
+
+uint64_t BytecodeInterpreter::call(std::string_view functionName,
+                                   std::span<const uint64_t> arguments) {
+  const BytecodeFunction *function = getFunction(functionName);
+  if (!function) {
+    throw std::runtime_error("Function not found");
+  }
+  return call(*function, arguments);
+}
+
+uint64_t BytecodeInterpreter::call(const BytecodeFunction &function,
+                                   std::span<const uint64_t> arguments) {
+  if (arguments.size() != function.parameterTypes.size()) {
+    throw std::runtime_error("Wrong number of arguments");
+  }
+  registers.assign(function.registerCount, 0);
+  for (size_t i = 0; i < arguments.size(); i++) {
+    registers[i] = wrapToType(function.parameterTypes[i], arguments[i]);
+  }
+  callDepth = 0;
+  return run(function, 0);
+}
+
+uint64_t BytecodeInterpreter::run(const BytecodeFunction &function,
+                                  size_t frame) {
+  uint64_t *r = registers.data() + frame;
+  const BytecodeInstruction *code = function.code.data();
+  const BytecodeInstruction *instruction = code;
+
+#if ZIPS_COMPUTED_GOTO
+  // Must be kept in the order of BytecodeOpcode.
+  static void *const handlers[] = {
+      &&handleMOVE,          &&handleWRAP_I8,
+      &&handleWRAP_I16,      &&handleWRAP_I32,
+      &&handleWRAP_U8,       &&handleWRAP_U16,
+      &&handleWRAP_U32,      &&handleADD,
+      &&handleSUBTRACT,      &&handleMULTIPLY,
+      &&handleDIVIDE_SIGNED, &&handleDIVIDE_UNSIGNED,
+      &&handleMODULO_SIGNED, &&handleMODULO_UNSIGNED,
+      &&handleADD_CHECKED_SIGNED, &&handleADD_CHECKED_UNSIGNED,
+      &&handleADD_SATURATING_SIGNED, &&handleADD_SATURATING_UNSIGNED,
+      &&handleCHECK,         &&handleSATURATE,
+      &&handleEQUAL,         &&handleNOT_EQUAL,
+      &&handleLESS_SIGNED,   &&handleLESS_UNSIGNED,
+      &&handleLESS_EQUAL_SIGNED, &&handleLESS_EQUAL_UNSIGNED,
+      &&handleJUMP,          &&handleJUMP_IF_TRUE,
+      &&handleJUMP_IF_FALSE, &&handleCALL,
+      &&handleRETURN};
+  static_assert(std::size(handlers) == BYTECODE_OPCODE_COUNT);
+#define HANDLER(opcode) handle##opcode:
+#define DISPATCH()                                                             \
+  goto *handlers[static_cast<size_t>(instruction->opcode)]
+#else
+#define HANDLER(opcode) case BytecodeOpcode::opcode:
+#define DISPATCH() goto dispatch
+#endif
+#define NEXT()                                                                 \
+  instruction++;                                                               \
+  DISPATCH()
+#define D r[instruction->destination]
+#define A r[instruction->a]
+#define B r[instruction->b]
+#define SIGNED(value) static_cast<int64_t>(value)
+
+#if ZIPS_COMPUTED_GOTO
+  DISPATCH();
+#else
+dispatch:
+  switch (instruction->opcode) {
+#endif
+  HANDLER(MOVE) {
+    D = A;
+    NEXT();
+  }
+  HANDLER(WRAP_I8) {
+    D = static_cast<uint64_t>(static_cast<int64_t>(static_cast<int8_t>(A)));
+    NEXT();
+  }
+  HANDLER(WRAP_I16) {
+    D = static_cast<uint64_t>(static_cast<int64_t>(static_cast<int16_t>(A)));
+    NEXT();
+  }
+  HANDLER(WRAP_I32) {
+    D = static_cast<uint64_t>(static_cast<int64_t>(static_cast<int32_t>(A)));
+    NEXT();
+  }
+  HANDLER(WRAP_U8) {
+    D = static_cast<uint8_t>(A);
+    NEXT();
+  }
+  HANDLER(WRAP_U16) {
+    D = static_cast<uint16_t>(A);
+    NEXT();
+  }
+  HANDLER(WRAP_U32) {
+    D = static_cast<uint32_t>(A);
+    NEXT();
+  }
+  HANDLER(ADD) {
+    D = A + B;
+    NEXT();
+  }
+  HANDLER(SUBTRACT) {
+    D = A - B;
+    NEXT();
+  }
+  HANDLER(MULTIPLY) {
+    D = A * B;
+    NEXT();
+  }
+  HANDLER(DIVIDE_SIGNED) {
+    if (B == 0) {
+      throw std::runtime_error("Division by zero");
+    }
+    // The only signed overflow, which wraps around.
+    D = SIGNED(B) == -1 ? 0 - A : static_cast<uint64_t>(SIGNED(A) / SIGNED(B));
+    NEXT();
+  }
+  HANDLER(DIVIDE_UNSIGNED) {
+    if (B == 0) {
+      throw std::runtime_error("Division by zero");
+    }
+    D = A / B;
+    NEXT();
+  }
+  HANDLER(MODULO_SIGNED) {
+    if (B == 0) {
+      throw std::runtime_error("Division by zero");
+    }
+    D = SIGNED(B) == -1 ? 0 : static_cast<uint64_t>(SIGNED(A) % SIGNED(B));
+    NEXT();
+  }
+  HANDLER(MODULO_UNSIGNED) {
+    if (B == 0) {
+      throw std::runtime_error("Division by zero");
+    }
+    D = A % B;
+    NEXT();
+  }
+  HANDLER(ADD_CHECKED_SIGNED) {
+    uint64_t sum;
+    if (addOverflows(PrimitiveTypeType::I64, A, B, sum)) {
+      throw std::runtime_error("Arithmetic overflow");
+    }
+    D = sum;
+    NEXT();
+  }
+  HANDLER(ADD_CHECKED_UNSIGNED) {
+    uint64_t sum;
+    if (addOverflows(PrimitiveTypeType::U64, A, B, sum)) {
+      throw std::runtime_error("Arithmetic overflow");
+    }
+    D = sum;
+    NEXT();
+  }
+  HANDLER(ADD_SATURATING_SIGNED) {
+    uint64_t sum;
+    D = addOverflows(PrimitiveTypeType::I64, A, B, sum)
+            ? getSaturatedSum(PrimitiveTypeType::I64, B)
+            : sum;
+    NEXT();
+  }
+  HANDLER(ADD_SATURATING_UNSIGNED) {
+    uint64_t sum;
+    D = addOverflows(PrimitiveTypeType::U64, A, B, sum)
+            ? getSaturatedSum(PrimitiveTypeType::U64, B)
+            : sum;
+    NEXT();
+  }
+  HANDLER(CHECK) {
+    if (wrapToType(static_cast<PrimitiveTypeType>(instruction->b), A) != A) {
+      throw std::runtime_error("Arithmetic overflow");
+    }
+    D = A;
+    NEXT();
+  }
+  HANDLER(SATURATE) {
+    auto type = static_cast<PrimitiveTypeType>(instruction->b);
+    uint64_t maximum = getMaximum(type);
+    if (!isSigned(type)) {
+      D = std::min(A, maximum);
+    } else if (SIGNED(A) > SIGNED(maximum)) {
+      D = maximum;
+    } else if (SIGNED(A) < SIGNED(~maximum)) {
+      D = ~maximum;
+    } else {
+      D = A;
+    }
+    NEXT();
+  }
+  HANDLER(EQUAL) {
+    D = A == B;
+    NEXT();
+  }
+  HANDLER(NOT_EQUAL) {
+    D = A != B;
+    NEXT();
+  }
+  HANDLER(LESS_SIGNED) {
+    D = SIGNED(A) < SIGNED(B);
+    NEXT();
+  }
+  HANDLER(LESS_UNSIGNED) {
+    D = A < B;
+    NEXT();
+  }
+  HANDLER(LESS_EQUAL_SIGNED) {
+    D = SIGNED(A) <= SIGNED(B);
+    NEXT();
+  }
+  HANDLER(LESS_EQUAL_UNSIGNED) {
+    D = A <= B;
+    NEXT();
+  }
+  HANDLER(JUMP) {
+    instruction = code + instruction->destination;
+    DISPATCH();
+  }
+  HANDLER(JUMP_IF_TRUE) {
+    if (A != 0) {
+      instruction = code + instruction->destination;
+      DISPATCH();
+    }
+    NEXT();
+  }
+  HANDLER(JUMP_IF_FALSE) {
+    if (A == 0) {
+      instruction = code + instruction->destination;
+      DISPATCH();
+    }
+    NEXT();
+  }
+  HANDLER(CALL) {
+    const BytecodeFunction &callee = functions[instruction->a];
+    if (++callDepth > MAX_CALL_DEPTH) {
+      throw std::runtime_error("Call depth limit exceeded");
+    }
+    size_t calleeFrame = frame + function.registerCount;
+    if (registers.size() < calleeFrame + callee.registerCount) {
+      registers.resize(calleeFrame + callee.registerCount);
+      r = registers.data() + frame;
+    }
+    std::copy(r + instruction->b,
+              r + instruction->b + callee.parameterTypes.size(),
+              registers.data() + calleeFrame);
+    uint64_t result = run(callee, calleeFrame);
+    callDepth--;
+    // The callee may have grown the registers.
+    r = registers.data() + frame;
+    D = result;
+    NEXT();
+  }
+  HANDLER(RETURN) {
+    return A;
+  }
+#if !ZIPS_COMPUTED_GOTO
+  }
+  throw std::runtime_error("Unknown bytecode opcode");
+#endif
+
+#undef HANDLER
+#undef DISPATCH
+#undef NEXT
+#undef D
+#undef A
+#undef B
+#undef SIGNED
+}
+} // namespace zips
@@ -0,0 +1,112 @@
+#ifndef ZIPS_BYTECODE_H
+#define ZIPS_BYTECODE_H
+
+#include "ast.h"
+#include "type.h"
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace zips {
+enum class BytecodeOpcode : uint8_t {
+  MOVE,
+  // Wrap a register around to a type narrower than 64 bits.
+  WRAP_I8,
+  WRAP_I16,
+  WRAP_I32,
+  WRAP_U8,
+  WRAP_U16,
+  WRAP_U32,
+  ADD,
+  SUBTRACT,
+  MULTIPLY,
+  DIVIDE_SIGNED,
+  DIVIDE_UNSIGNED,
+  MODULO_SIGNED,
+  MODULO_UNSIGNED,
+  // Checked and saturating additions of 64-bit types.
+  ADD_CHECKED_SIGNED,
+  ADD_CHECKED_UNSIGNED,
+  ADD_SATURATING_SIGNED,
+  ADD_SATURATING_UNSIGNED,
+  // Check that a is a value of the PrimitiveTypeType in b, or clamp it to
+  // one. Narrower additions are exact, so these follow them.
+  CHECK,
+  SATURATE,
+  EQUAL,
+  NOT_EQUAL,
+  LESS_SIGNED,
+  LESS_UNSIGNED,
+  LESS_EQUAL_SIGNED,
+  LESS_EQUAL_UNSIGNED,
+  JUMP,
+  JUMP_IF_TRUE,
+  JUMP_IF_FALSE,
+  // Calls function a with the arguments in consecutive registers from b,
+  // already converted to the parameter types.
+  CALL,
+  RETURN
+};
+// Must be kept in sync with the last BytecodeOpcode.
+static constexpr size_t BYTECODE_OPCODE_COUNT =
+    static_cast<size_t>(BytecodeOpcode::RETURN) + 1;
+
+// Registers hold values as wrapToType represents them. Jumps keep their
+// target in destination and their condition in a.
+struct BytecodeInstruction {
+  BytecodeOpcode opcode;
+  uint16_t destination;
+  uint16_t a;
+  uint16_t b;
+};
+static_assert(sizeof(BytecodeInstruction) == 8);
+
+struct BytecodeFunction {
+  std::string name;
+  std::vector<PrimitiveTypeType> parameterTypes;
+  PrimitiveTypeType returnType;
+  // Parameters are passed in the first registers.
+  size_t registerCount = 0;
+  std::vector<BytecodeInstruction> code;
+
+  std::string toString() const;
+};
+
+/**
+ * @brief runs type checked functions as register based bytecode.
+ *
+ * Functions are lowered once, when the interpreter is created, and then run
+ * by a threaded dispatch loop. Results are the same as AstInterpreter's,
+ * including where division by zero or checked overflow throws
+ * std::runtime_error, but calls
+ * don't do an AST walk or name lookups. Each call's registers follow its
+ * caller's in one register file. Units calling functions of other modules
+ * can't be lowered.
+ */
+class BytecodeInterpreter {
+  std::vector<BytecodeFunction> functions;
+  std::unordered_map<std::string_view, size_t> functionIndices;
+  std::vector<uint64_t> registers;
+  size_t callDepth = 0;
+
+  // Runs a function whose registers start at frame.
+  uint64_t run(const BytecodeFunction &function, size_t frame);
+
+public:
+  explicit BytecodeInterpreter(CompilationUnitNode *unit);
+
+  // Returns null if there is no such function.
+  const BytecodeFunction *getFunction(std::string_view name) const;
+
+  // Arguments are wrapped to the parameter types.
+  uint64_t call(const BytecodeFunction &function,
+                std::span<const uint64_t> arguments);
+  uint64_t call(std::string_view functionName,
+                std::span<const uint64_t> arguments);
+};
+} // namespace zips
+
+#endif
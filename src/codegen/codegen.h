@@ -2,7 +2,21 @@
 #define ZIPS_CODEGEN_H
 
 #include "ast.h"
+#include "codegen/elf.h"
+#include "codegen/profile.h"
+#include "memoryUsage.h"
+#include "probes.h"
 #include "type.h"
+#include "visitor.h"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <initializer_list>
+#include <limits>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
 #include <variant>
 
 namespace zips {
@@ -35,7 +49,7 @@ class AssemblyInstructionGenerator {};
 template <TargetAbi abi>
 class AssemblyInstructionGenerator<TargetArchitecture::X86_64, abi> {
 public:
-  enum class Register {
+  enum class Register : uint8_t {
     RAX,
     RCX,
     RDX,
@@ -54,37 +68,49 @@ public:
     R15
   };
   static constexpr size_t registerSize = 8;
-  static constexpr std::vector<Register> callerSavedRegisters() {
+  // The register lists are arrays rather than vectors so that they never
+  // allocate.
+  static constexpr auto callerSavedRegisters() {
     if constexpr (abi == TargetAbi::X86_64) {
-      return {Register::RAX, Register::RCX, Register::RDX,
-              Register::RSI, Register::RDI, Register::R8,
-              Register::R9,  Register::R10, Register::R11};
+      return std::array{Register::RAX, Register::RCX, Register::RDX,
+                        Register::RSI, Register::RDI, Register::R8,
+                        Register::R9,  Register::R10, Register::R11};
     } else if constexpr (abi == TargetAbi::MS_X64) {
-      return {Register::RAX, Register::RCX, Register::RDX, Register::R8,
-              Register::R9,  Register::R10, Register::R11};
+      return std::array{Register::RAX, Register::RCX, Register::RDX,
+                        Register::R8,  Register::R9,  Register::R10,
+                        Register::R11};
     }
   }
-  static constexpr std::vector<Register> calleeSavedRegisters() {
+  static constexpr auto calleeSavedRegisters() {
     if constexpr (abi == TargetAbi::X86_64) {
-      return {Register::RBX, Register::R12, Register::R13, Register::R14,
-              Register::R15};
+      return std::array{Register::RBX, Register::R12, Register::R13,
+                        Register::R14, Register::R15};
     } else if constexpr (abi == TargetAbi::MS_X64) {
-      return {Register::RBX, Register::R12, Register::R13, Register::R14,
-              Register::R15};
+      return std::array{Register::RBX, Register::R12, Register::R13,
+                        Register::R14, Register::R15};
     }
   }
-  static constexpr std::vector<Register> parameterPassingRegisters() {
+  static constexpr auto parameterPassingRegisters() {
     if constexpr (abi == TargetAbi::X86_64) {
-      return {Register::RDI, Register::RSI, Register::RDX,
-              Register::RCX, Register::R8,  Register::R9};
+      return std::array{Register::RDI, Register::RSI, Register::RDX,
+                        Register::RCX, Register::R8,  Register::R9};
     } else if constexpr (abi == TargetAbi::MS_X64) {
-      return {Register::RCX, Register::RDX, Register::R8, Register::R9};
+      return std::array{Register::RCX, Register::RDX, Register::R8,
+                        Register::R9};
     }
   }
+  // Caller saved registers which are never allocated, so that values in stack
+  // slots can always be loaded for an instruction.
+  static constexpr auto scratchRegisters() {
+    return std::array{Register::R10, Register::R11};
+  }
   static constexpr size_t stackAlignmentOnCall = 16;
+  // The bytes below RSP which signal handlers leave alone, so that leaf
+  // functions can keep their stack slots there without adjusting RSP.
+  static constexpr size_t redZoneSize = abi == TargetAbi::X86_64 ? 128 : 0;
   static constexpr Register RETURN_VALUE_REGISTER = Register::RAX;
 
-  enum class OperandSize { I8, I16, I32, I64 };
+  enum class OperandSize : uint8_t { I8, I16, I32, I64 };
 
   static constexpr OperandSize operandSizeFromBits(size_t bits) {
     if (bits <= 8) {
@@ -114,320 +140,945 @@ public:
     return 0;
   }
 
-  static constexpr std::string registerToString64(Register reg) {
-    switch (reg) {
-    case Register::RAX:
-      return "rax";
-    case Register::RCX:
-      return "rcx";
-    case Register::RDX:
-      return "rdx";
-    case Register::RBX:
-      return "rbx";
-    case Register::RBP:
-      return "rbp";
-    case Register::RSP:
-      return "rsp";
-    case Register::RSI:
-      return "rsi";
-    case Register::RDI:
-      return "rdi";
-    case Register::R8:
-      return "r8";
-    case Register::R9:
-      return "r9";
-    case Register::R10:
-      return "r10";
-    case Register::R11:
-      return "r11";
-    case Register::R12:
-      return "r12";
-    case Register::R13:
-      return "r13";
-    case Register::R14:
-      return "r14";
-    case Register::R15:
-      return "r15";
-    }
-    return "Unknown";
-  }
-  static constexpr std::string registerToString32(Register reg) {
-    switch (reg) {
-    case Register::RAX:
-      return "eax";
-    case Register::RCX:
-      return "ecx";
-    case Register::RDX:
-      return "edx";
-    case Register::RBX:
-      return "ebx";
-    case Register::RBP:
-      return "ebp";
-    case Register::RSP:
-      return "esp";
-    case Register::RSI:
-      return "esi";
-    case Register::RDI:
-      return "edi";
-    case Register::R8:
-      return "r8d";
-    case Register::R9:
-      return "r9d";
-    case Register::R10:
-      return "r10d";
-    case Register::R11:
-      return "r11d";
-    case Register::R12:
-      return "r12d";
-    case Register::R13:
-      return "r13d";
-    case Register::R14:
-      return "r14d";
-    case Register::R15:
-      return "r15d";
-    }
-    return "Unknown";
-  }
-  static constexpr std::string registerToString16(Register reg) {
-    switch (reg) {
-    case Register::RAX:
-      return "ax";
-    case Register::RCX:
-      return "cx";
-    case Register::RDX:
-      return "dx";
-    case Register::RBX:
-      return "bx";
-    case Register::RBP:
-      return "bp";
-    case Register::RSP:
-      return "sp";
-    case Register::RSI:
-      return "si";
-    case Register::RDI:
-      return "di";
-    case Register::R8:
-      return "r8w";
-    case Register::R9:
-      return "r9w";
-    case Register::R10:
-      return "r10w";
-    case Register::R11:
-      return "r11w";
-    case Register::R12:
-      return "r12w";
-    case Register::R13:
-      return "r13w";
-    case Register::R14:
-      return "r14w";
-    case Register::R15:
-      return "r15w";
-    }
-    return "Unknown";
-  }
-  static constexpr std::string registerToString8(Register reg) {
-    switch (reg) {
-    case Register::RAX:
-      return "al";
-    case Register::RCX:
-      return "cl";
-    case Register::RDX:
-      return "dl";
-    case Register::RBX:
-      return "bl";
-    case Register::RBP:
-      return "bpl";
-    case Register::RSP:
-      return "spl";
-    case Register::RSI:
-      return "sil";
-    case Register::RDI:
-      return "dil";
-    case Register::R8:
-      return "r8b";
-    case Register::R9:
-      return "r9b";
-    case Register::R10:
-      return "r10b";
-    case Register::R11:
-      return "r11b";
-    case Register::R12:
-      return "r12b";
-    case Register::R13:
-      return "r13b";
-    case Register::R14:
-      return "r14b";
-    case Register::R15:
-      return "r15b";
-    }
-    return "Unknown";
-  }
-
-  static constexpr std::string registerToString(OperandSize size,
-                                                Register reg) {
-    switch (size) {
-    case OperandSize::I8:
-      return registerToString8(reg);
-    case OperandSize::I16:
-      return registerToString16(reg);
-    case OperandSize::I32:
-      return registerToString32(reg);
-    case OperandSize::I64:
-      return registerToString64(reg);
-    }
-    return "Unknown";
+  // Indexed by OperandSize and then by Register.
+  static constexpr std::array<std::array<std::string_view, 16>, 4>
+      registerNames = {{
+          {"al", "cl", "dl", "bl", "bpl", "spl", "sil", "dil", "r8b", "r9b",
+           "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"},
+          {"ax", "cx", "dx", "bx", "bp", "sp", "si", "di", "r8w", "r9w",
+           "r10w", "r11w", "r12w", "r13w", "r14w", "r15w"},
+          {"eax", "ecx", "edx", "ebx", "ebp", "esp", "esi", "edi", "r8d",
+           "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"},
+          {"rax", "rcx", "rdx", "rbx", "rbp", "rsp", "rsi", "rdi", "r8", "r9",
+           "r10", "r11", "r12", "r13", "r14", "r15"},
+      }};
+  static constexpr std::string_view registerName(OperandSize size,
+                                                 Register reg) {
+    return registerNames[static_cast<size_t>(size)][static_cast<size_t>(reg)];
   }
 
-  static constexpr std::string operandSizeSuffix(OperandSize size) {
-    switch (size) {
-    case OperandSize::I8:
-      return "b";
-    case OperandSize::I16:
-      return "w";
-    case OperandSize::I32:
-      return "l";
-    case OperandSize::I64:
-      return "q";
+  static constexpr std::array<char, 4> operandSizeSuffixes = {'b', 'w', 'l',
+                                                              'q'};
+
+  enum class Condition : uint8_t {
+    EQUAL,
+    NOT_EQUAL,
+    LESS,
+    LESS_EQUAL,
+    GREATER,
+    GREATER_EQUAL,
+    BELOW,
+    BELOW_EQUAL,
+    ABOVE,
+    ABOVE_EQUAL,
+    OVERFLOW,
+    NOT_OVERFLOW
+  };
+
+  static constexpr Condition invertCondition(Condition condition) {
+    switch (condition) {
+    case Condition::EQUAL:
+      return Condition::NOT_EQUAL;
+    case Condition::NOT_EQUAL:
+      return Condition::EQUAL;
+    case Condition::LESS:
+      return Condition::GREATER_EQUAL;
+    case Condition::LESS_EQUAL:
+      return Condition::GREATER;
+    case Condition::GREATER:
+      return Condition::LESS_EQUAL;
+    case Condition::GREATER_EQUAL:
+      return Condition::LESS;
+    case Condition::BELOW:
+      return Condition::ABOVE_EQUAL;
+    case Condition::BELOW_EQUAL:
+      return Condition::ABOVE;
+    case Condition::ABOVE:
+      return Condition::BELOW_EQUAL;
+    case Condition::ABOVE_EQUAL:
+      return Condition::BELOW;
+    case Condition::OVERFLOW:
+      return Condition::NOT_OVERFLOW;
+    case Condition::NOT_OVERFLOW:
+      return Condition::OVERFLOW;
     }
-    return "Unknown";
+    return condition;
   }
 
+  // Indexed by Condition.
+  static constexpr std::array<std::string_view, 12> conditionSuffixes = {
+      "e", "ne", "l", "le", "g", "ge", "b", "be", "a", "ae", "o", "no"};
+
+  // Labels are numbered per function and printed after its label prefix,
+  // which is derived from the function's name, so that a function's assembly
+  // doesn't depend on where it is in the unit.
+  using Label = uint32_t;
+  static constexpr Label END_LABEL = std::numeric_limits<Label>::max();
+
   struct Operand {
-    struct MemoryOperand {
-      Register base;
-      ptrdiff_t offset;
+    enum class Kind : uint8_t {
+      REGISTER,
+      IMMEDIATE,
+      LABEL,
+      MEMORY,
+      // A stack slot of the function, whose offset is only known once the
+      // frame has been laid out.
+      STACK_SLOT,
+      // The execution counter of a block, see generateProfileRecord.
+      BLOCK_COUNTER,
+      // A function, by its index in the unit's symbols.
+      SYMBOL
     };
-    std::variant<Register, size_t, std::string, MemoryOperand> value;
+    Kind kind;
+    Register base; // The register, or the base of a memory operand.
+    // The immediate, label, offset, stack slot, block or symbol.
+    int64_t value;
+
+    static constexpr Operand ofRegister(Register reg) {
+      return {Kind::REGISTER, reg, 0};
+    }
+    static constexpr Operand immediate(int64_t value) {
+      return {Kind::IMMEDIATE, Register::RAX, value};
+    }
+    static constexpr Operand label(Label label) {
+      return {Kind::LABEL, Register::RAX, label};
+    }
+    static constexpr Operand memory(Register base, ptrdiff_t offset) {
+      return {Kind::MEMORY, base, offset};
+    }
+    static constexpr Operand stackSlot(size_t slot) {
+      return {Kind::STACK_SLOT, Register::RBP, static_cast<int64_t>(slot)};
+    }
+    static constexpr Operand blockCounter(size_t block) {
+      return {Kind::BLOCK_COUNTER, Register::RAX, static_cast<int64_t>(block)};
+    }
+    static constexpr Operand symbol(size_t symbol) {
+      return {Kind::SYMBOL, Register::RAX, static_cast<int64_t>(symbol)};
+    }
+
+    bool operator==(const Operand &) const = default;
+  };
+
+  enum class Opcode : uint8_t {
+    LABEL,
+    MOV,
+    ADD,
+    SUB,
+    CMP,
+    TEST,
+    INC,
+    PUSH,
+    POP,
+    RET,
+    JMP,
+    JCC,
+    SETCC,
+    CMOVCC,
+    // Sign and zero extending moves, from sourceSize to size.
+    MOVSX,
+    MOVZX,
+    CALL,
+    NOT,
+    SAR,
+    BTC,
+    UD2,
+    NEG,
+    IMUL,
+    SYSCALL
+  };
+  struct OpcodeInfo {
+    std::string_view mnemonic;
+    bool hasSizeSuffix;
+    bool hasConditionSuffix;
+    bool hasSourceSizeSuffix = false;
   };
+  // Indexed by Opcode.
+  static constexpr std::array<OpcodeInfo, 24> opcodeTable = {{
+      {"", false, false},
+      {"mov", true, false},
+      {"add", true, false},
+      {"sub", true, false},
+      {"cmp", true, false},
+      {"test", true, false},
+      {"inc", true, false},
+      {"push", true, false},
+      {"pop", true, false},
+      {"ret", true, false},
+      {"jmp", false, false},
+      {"j", false, true},
+      {"set", false, true},
+      // cmov takes its size from its register operands.
+      {"cmov", false, true},
+      {"movs", true, false, true},
+      {"movz", true, false, true},
+      {"call", false, false},
+      {"not", true, false},
+      {"sar", true, false},
+      {"btc", true, false},
+      {"ud2", false, false},
+      {"neg", true, false},
+      {"imul", true, false},
+      {"syscall", false, false},
+  }};
+
   struct Instruction {
-    std::string mnemonic;
+    Opcode opcode;
     OperandSize size;
-    std::vector<Operand> operands;
-    bool needsOperandSizeSuffix = true;
-
-    std::string toString() const {
-      std::string result;
-      result += mnemonic;
-      if (needsOperandSizeSuffix) {
-        result += operandSizeSuffix(size);
-      }
-      result += " ";
-      for (auto &operand : operands) {
-        if (std::holds_alternative<Register>(operand.value)) {
-          result +=
-              "%" + registerToString(size, std::get<Register>(operand.value));
-        } else if (std::holds_alternative<size_t>(operand.value)) {
-          result += "$" + std::to_string(std::get<size_t>(operand.value));
-        } else if (std::holds_alternative<std::string>(operand.value)) {
-          result += std::get<std::string>(operand.value);
-        } else {
-          auto &mem = std::get<typename Operand::MemoryOperand>(operand.value);
-          result += std::to_string(mem.offset) + "(%" +
-                    registerToString64(mem.base) + ")";
-        }
-        result += ", ";
+    Condition condition; // Only used by the conditional opcodes.
+    uint8_t operandCount;
+    OperandSize sourceSize; // Only used by the extending moves.
+    std::array<Operand, 2> operands;
+
+    // Unused fields are always zero or copies, so this is exact.
+    bool operator==(const Instruction &) const = default;
+  };
+  static_assert(std::is_trivially_copyable_v<Instruction>);
+
+  // FNV-1a over the fields, for finding functions with identical bodies.
+  static uint64_t hash(std::span<const Instruction> instructions) {
+    uint64_t result = 0xcbf29ce484222325;
+    auto add = [&](uint64_t value) {
+      result = (result ^ value) * 0x100000001b3;
+    };
+    for (const Instruction &instruction : instructions) {
+      add(static_cast<uint64_t>(instruction.opcode));
+      add(static_cast<uint64_t>(instruction.size));
+      add(static_cast<uint64_t>(instruction.condition));
+      add(static_cast<uint64_t>(instruction.sourceSize));
+      for (size_t i = 0; i < instruction.operandCount; i++) {
+        const Operand &operand = instruction.operands[i];
+        add(static_cast<uint64_t>(operand.kind));
+        add(static_cast<uint64_t>(operand.base));
+        add(static_cast<uint64_t>(operand.value));
       }
-      if (operands.size() > 0) {
-        result = result.substr(0, result.length() - 2);
+    }
+    return result;
+  }
+
+  static constexpr Instruction makeInstruction(
+      Opcode opcode, OperandSize size, std::initializer_list<Operand> operands,
+      Condition condition = Condition::EQUAL) {
+    Instruction result{opcode, size, condition,
+                       static_cast<uint8_t>(operands.size()), size, {}};
+    std::copy(operands.begin(), operands.end(), result.operands.begin());
+    return result;
+  }
+
+  static void appendInteger(std::string &output, int64_t value) {
+    char buffer[24];
+    char *end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+    output.append(buffer, end);
+  }
+  static void appendLabel(std::string &output, std::string_view labelPrefix,
+                          Label label) {
+    output += labelPrefix;
+    if (label == END_LABEL) {
+      output += ".end";
+    } else {
+      output += '.';
+      appendInteger(output, label);
+    }
+  }
+
+  // Appends the instruction as a line of assembly. Labels are printed after
+  // labelPrefix, and symbol operands are names from symbols.
+  static void format(const Instruction &instruction,
+                     std::string_view labelPrefix, std::string &output,
+                     std::span<const std::string_view> symbols = {}) {
+    const OpcodeInfo &info =
+        opcodeTable[static_cast<size_t>(instruction.opcode)];
+    output += '\t';
+    if (instruction.opcode == Opcode::LABEL) {
+      appendLabel(output, labelPrefix, instruction.operands[0].value);
+      output += ": \n";
+      return;
+    }
+    output += info.mnemonic;
+    if (info.hasConditionSuffix) {
+      output +=
+          conditionSuffixes[static_cast<size_t>(instruction.condition)];
+    }
+    if (info.hasSourceSizeSuffix) {
+      output +=
+          operandSizeSuffixes[static_cast<size_t>(instruction.sourceSize)];
+    }
+    if (info.hasSizeSuffix) {
+      output +=
+          operandSizeSuffixes[static_cast<size_t>(instruction.size)];
+    }
+    output += ' ';
+    for (size_t i = 0; i < instruction.operandCount; i++) {
+      if (i > 0) {
+        output += ", ";
+      }
+      const Operand &operand = instruction.operands[i];
+      switch (operand.kind) {
+      case Operand::Kind::REGISTER:
+        output += '%';
+        output += registerName(i == 0 && info.hasSourceSizeSuffix
+                                   ? instruction.sourceSize
+                                   : instruction.size,
+                               operand.base);
+        break;
+      case Operand::Kind::IMMEDIATE:
+        output += '$';
+        appendInteger(output, operand.value);
+        break;
+      case Operand::Kind::LABEL:
+        appendLabel(output, labelPrefix, operand.value);
+        break;
+      case Operand::Kind::MEMORY:
+        appendInteger(output, operand.value);
+        output += "(%";
+        output += registerName(OperandSize::I64, operand.base);
+        output += ')';
+        break;
+      case Operand::Kind::STACK_SLOT:
+        throw std::runtime_error("Unresolved stack slot");
+      case Operand::Kind::BLOCK_COUNTER:
+        output += labelPrefix;
+        output += ".profile+";
+        appendInteger(output, 16 + operand.value * 8);
+        output += "(%rip)";
+        break;
+      case Operand::Kind::SYMBOL:
+        output += symbols[operand.value];
+        break;
       }
-      return result;
     }
+    output += '\n';
+  }
+
+  // A 32-bit displacement to a label or symbol, which encode leaves as zero
+  // until the offsets of the code are known. It is relative to the end of
+  // the displacement, which always ends its instruction.
+  struct Relocation {
+    size_t position;
+    Operand target;
   };
 
-  std::string generateFileHeader(const std::string &fileName) {
-    std::string result;
-    result += ".file \"" + fileName + "\"\n";
-    result += ".text";
-    return result;
+  // Indexed by Condition, the low bits of the jcc, setcc and cmovcc opcodes.
+  static constexpr std::array<uint8_t, 12> conditionCodes = {
+      0x4, 0x5, 0xc, 0xe, 0xf, 0xd, 0x2, 0x6, 0x7, 0x3, 0x0, 0x1};
+
+  // The register's number in instructions, which has RSP before RBP.
+  static constexpr uint8_t getNumber(Register reg) {
+    uint8_t number = static_cast<uint8_t>(reg);
+    return number == 4 || number == 5 ? number ^ 1 : number;
+  }
+  // Without a REX prefix, the byte registers numbered 4 to 7 would be AH to
+  // BH.
+  static constexpr bool needsRexAsByte(uint8_t number) {
+    return number >= 4 && number < 8;
+  }
+  static constexpr bool fitsInByte(int64_t value) {
+    return value >= -128 && value <= 127;
   }
 
-  std::string generateFileFooter() {
-    std::string result;
-    result += ".ident \"Compiled by the Zips compiler\"\n";
-    result += ".section .note.GNU-stack,\"\",@progbits";
-    return result;
+  static void appendBytes(std::string &output, uint64_t value, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      output += static_cast<char>(value >> (i * 8));
+    }
   }
 
-  std::string generateFunctionHeader(const std::string &name) {
-    std::string result;
-    result += ".globl " + name + "\n";
-    result += ".type " + name + ", @function\n";
-    result += name + ":";
-    return result;
+  static void appendPrefixes(std::string &output, OperandSize size,
+                             uint8_t rex) {
+    if (size == OperandSize::I16) {
+      output += '\x66';
+    }
+    if (size == OperandSize::I64) {
+      rex |= 0x48;
+    }
+    if (rex != 0) {
+      output += static_cast<char>(rex | 0x40);
+    }
   }
 
-  std::string generateFunctionFooter(const std::string &functionName) {
-    std::string result;
-    result += ".size " + functionName + ", .-" + functionName;
-    return result;
+  // Appends an instruction addressing rm, a register or memory operand, with
+  // a ModRM byte whose reg field is a register number or an opcode extension.
+  // byteReg and byteRm are set when the registers in them are bytes.
+  static void appendModRm(std::string &output, OperandSize size,
+                          std::initializer_list<uint8_t> opcode, uint8_t reg,
+                          const Operand &rm, bool byteReg = false,
+                          bool byteRm = false) {
+    if (rm.kind != Operand::Kind::REGISTER &&
+        rm.kind != Operand::Kind::MEMORY) {
+      throw std::runtime_error("Not implemented - encoding the operand");
+    }
+    uint8_t rmNumber = getNumber(rm.base);
+    uint8_t rex = (reg & 8 ? 0x4 : 0) | (rmNumber & 8 ? 0x1 : 0);
+    if ((byteReg && needsRexAsByte(reg)) ||
+        (byteRm && rm.kind == Operand::Kind::REGISTER &&
+         needsRexAsByte(rmNumber))) {
+      rex |= 0x40;
+    }
+    appendPrefixes(output, size, rex);
+    for (uint8_t byte : opcode) {
+      output += static_cast<char>(byte);
+    }
+    uint8_t fields = static_cast<uint8_t>((reg & 7) << 3 | (rmNumber & 7));
+    if (rm.kind == Operand::Kind::REGISTER) {
+      output += static_cast<char>(0xc0 | fields);
+      return;
+    }
+    // RBP and R13 can only be bases with a displacement, and RSP and R12
+    // only with a SIB byte.
+    size_t displacementSize = rm.value == 0 && (rmNumber & 7) != 5 ? 0
+                              : fitsInByte(rm.value)               ? 1
+                                                                   : 4;
+    output += static_cast<char>(
+        (displacementSize == 0 ? 0x00 : displacementSize == 1 ? 0x40 : 0x80) |
+        fields);
+    if ((rmNumber & 7) == 4) {
+      output += '\x24';
+    }
+    appendBytes(output, static_cast<uint64_t>(rm.value), displacementSize);
   }
 
-  std::vector<Instruction> generateProlog(size_t stackAllocationSize) {
-    std::vector<Instruction> result;
-    result += Instruction{"push", OperandSize::I64, {Operand{Register::RBP}}};
-    result += Instruction{"mov",
-                          OperandSize::I64,
-                          {Operand{Register::RSP}, Operand{Register::RBP}}};
+  // Appends the instruction as machine code. Labels have none, and jumps and
+  // calls leave a relocation.
+  static void encode(const Instruction &instruction, std::string &output,
+                     std::vector<Relocation> &relocations) {
+    const Operand &source = instruction.operands[0];
+    const Operand &dest = instruction.operands[1];
+    OperandSize size = instruction.size;
+    bool isByte = size == OperandSize::I8;
+    auto relocate = [&](const Operand &target) {
+      relocations.push_back(Relocation{output.size(), target});
+      appendBytes(output, 0, 4);
+    };
+    // mov, add, sub and cmp, which have the forms op r/m, reg and
+    // op reg, r/m. The latter reads memory sources.
+    auto appendRegisterForm = [&](uint8_t opcode) {
+      uint8_t byteOffset = isByte ? 0 : 1;
+      if (source.kind == Operand::Kind::MEMORY) {
+        appendModRm(output, size,
+                    {static_cast<uint8_t>(opcode + 2 + byteOffset)},
+                    getNumber(dest.base), source, isByte, isByte);
+      } else {
+        appendModRm(output, size, {static_cast<uint8_t>(opcode + byteOffset)},
+                    getNumber(source.base), dest, isByte, isByte);
+      }
+    };
+    // add, sub and cmp with an immediate, whose opcode extensions are the
+    // same as their position among the register forms.
+    auto appendArithmetic = [&](uint8_t opcode) {
+      if (source.kind != Operand::Kind::IMMEDIATE) {
+        appendRegisterForm(opcode);
+        return;
+      }
+      uint8_t extension = opcode >> 3;
+      if (isByte || fitsInByte(source.value)) {
+        appendModRm(output, size, {static_cast<uint8_t>(isByte ? 0x80 : 0x83)},
+                    extension, dest, false, isByte);
+        appendBytes(output, static_cast<uint64_t>(source.value), 1);
+      } else {
+        appendModRm(output, size, {0x81}, extension, dest);
+        appendBytes(output, static_cast<uint64_t>(source.value),
+                    size == OperandSize::I16 ? 2 : 4);
+      }
+    };
+    auto conditional = [&](uint8_t opcode) {
+      return static_cast<uint8_t>(
+          opcode |
+          conditionCodes[static_cast<size_t>(instruction.condition)]);
+    };
+    switch (instruction.opcode) {
+    case Opcode::LABEL:
+      break;
+    case Opcode::MOV:
+      if (source.kind != Operand::Kind::IMMEDIATE) {
+        appendRegisterForm(0x88);
+      } else if (dest.kind == Operand::Kind::REGISTER &&
+                 (size != OperandSize::I64 ||
+                  source.value != static_cast<int32_t>(source.value))) {
+        // The register is in the opcode, and the immediate is as wide as it.
+        uint8_t number = getNumber(dest.base);
+        appendPrefixes(output, size,
+                       (number & 8 ? 0x1 : 0) |
+                           (isByte && needsRexAsByte(number) ? 0x40 : 0));
+        output += static_cast<char>((isByte ? 0xb0 : 0xb8) + (number & 7));
+        appendBytes(output, static_cast<uint64_t>(source.value),
+                    getSize(size));
+      } else {
+        appendModRm(output, size, {static_cast<uint8_t>(isByte ? 0xc6 : 0xc7)},
+                    0, dest, false, isByte);
+        appendBytes(output, static_cast<uint64_t>(source.value),
+                    std::min<size_t>(getSize(size), 4));
+      }
+      break;
+    case Opcode::ADD:
+      appendArithmetic(0x00);
+      break;
+    case Opcode::SUB:
+      appendArithmetic(0x28);
+      break;
+    case Opcode::CMP:
+      appendArithmetic(0x38);
+      break;
+    case Opcode::TEST:
+      appendModRm(output, size, {static_cast<uint8_t>(isByte ? 0x84 : 0x85)},
+                  getNumber(source.base), dest, isByte, isByte);
+      break;
+    case Opcode::INC:
+      appendModRm(output, size, {static_cast<uint8_t>(isByte ? 0xfe : 0xff)}, 0,
+                  source, false, isByte);
+      break;
+    case Opcode::NOT:
+    case Opcode::NEG:
+      appendModRm(output, size, {static_cast<uint8_t>(isByte ? 0xf6 : 0xf7)},
+                  instruction.opcode == Opcode::NOT ? 2 : 3, source, false,
+                  isByte);
+      break;
+    case Opcode::PUSH:
+    case Opcode::POP: {
+      uint8_t number = getNumber(source.base);
+      if (number & 8) {
+        output += '\x41';
+      }
+      output += static_cast<char>(
+          (instruction.opcode == Opcode::PUSH ? 0x50 : 0x58) + (number & 7));
+      break;
+    }
+    case Opcode::RET:
+      output += '\xc3';
+      break;
+    case Opcode::JMP:
+      output += '\xe9';
+      relocate(source);
+      break;
+    case Opcode::JCC:
+      output += '\x0f';
+      output += static_cast<char>(conditional(0x80));
+      relocate(source);
+      break;
+    case Opcode::SETCC:
+      appendModRm(output, OperandSize::I8, {0x0f, conditional(0x90)}, 0, source,
+                  false, true);
+      break;
+    case Opcode::CMOVCC:
+      appendModRm(output, size, {0x0f, conditional(0x40)},
+                  getNumber(dest.base), source);
+      break;
+    case Opcode::MOVSX:
+    case Opcode::MOVZX: {
+      bool isSigned = instruction.opcode == Opcode::MOVSX;
+      if (instruction.sourceSize == OperandSize::I32) {
+        appendModRm(output, size, {0x63}, getNumber(dest.base), source);
+        break;
+      }
+      bool isByteSource = instruction.sourceSize == OperandSize::I8;
+      appendModRm(output, size,
+                  {0x0f, static_cast<uint8_t>((isSigned ? 0xbe : 0xb6) +
+                                              (isByteSource ? 0 : 1))},
+                  getNumber(dest.base), source, false, isByteSource);
+      break;
+    }
+    case Opcode::CALL:
+      output += '\xe8';
+      relocate(source);
+      break;
+    case Opcode::SAR:
+    case Opcode::BTC:
+      if (instruction.opcode == Opcode::SAR) {
+        appendModRm(output, size, {static_cast<uint8_t>(isByte ? 0xc0 : 0xc1)},
+                    7, dest, false, isByte);
+      } else {
+        appendModRm(output, size, {0x0f, 0xba}, 7, dest);
+      }
+      appendBytes(output, static_cast<uint64_t>(source.value), 1);
+      break;
+    case Opcode::UD2:
+      output += "\x0f\x0b";
+      break;
+    case Opcode::IMUL:
+      appendModRm(output, size, {0x0f, 0xaf}, getNumber(dest.base), source);
+      break;
+    case Opcode::SYSCALL:
+      output += "\x0f\x05";
+      break;
+    }
+  }
+
+  // The generate functions append to output, so that one buffer can be
+  // reused for a whole unit.
+  void generateFileHeader(std::string_view fileName, std::string &output) {
+    output += ".file \"";
+    output += fileName;
+    output += "\"\n.text\n";
+  }
+
+  void generateFileFooter(std::string &output) {
+    output += ".ident \"Compiled by the Zips compiler\"\n";
+    output += ".section .note.GNU-stack,\"\",@progbits";
+  }
+
+  void generateFunctionHeader(std::string_view name, std::string &output) {
+    output += ".globl ";
+    output += name;
+    output += "\n.type ";
+    output += name;
+    output += ", @function\n";
+    output += name;
+    output += ":\n";
+  }
+
+  void generateFunctionFooter(std::string_view name, std::string &output) {
+    output += ".size ";
+    output += name;
+    output += ", .-";
+    output += name;
+    output += '\n';
+  }
+
+  // Prints alias as another name for target, whose footer must come just
+  // before.
+  void generateFunctionAlias(std::string_view alias, std::string_view target,
+                             std::string &output) {
+    output += ".globl ";
+    output += alias;
+    output += "\n.type ";
+    output += alias;
+    output += ", @function\n.set ";
+    output += alias;
+    output += ", ";
+    output += target;
+    output += "\n.size ";
+    output += alias;
+    output += ", .-";
+    output += target;
+    output += '\n';
+  }
+
+  // The most instructions generateProlog can produce.
+  static constexpr size_t maxPrologSize =
+      3 + calleeSavedRegisters().size();
+
+  // Fills the end of slots with the prolog, so that it directly precedes the
+  // function body, and returns the number of instructions used. Without a
+  // frame pointer only the saved registers are pushed.
+  size_t generateProlog(std::span<Instruction, maxPrologSize> slots,
+                        bool hasFramePointer, size_t stackAllocationSize,
+                        std::span<const Register> savedRegisters) {
+    std::array<Instruction, maxPrologSize> prolog;
+    size_t count = 0;
+    if (hasFramePointer) {
+      prolog[count++] = generateSaveRegister(Register::RBP);
+      prolog[count++] = makeInstruction(Opcode::MOV, OperandSize::I64,
+                                        {Operand::ofRegister(Register::RSP),
+                                         Operand::ofRegister(Register::RBP)});
+    }
     if (stackAllocationSize > 0) {
-      result +=
-          Instruction{"sub",
-                      OperandSize::I64,
-                      {Operand{stackAllocationSize}, Operand{Register::RSP}}};
+      prolog[count++] = makeInstruction(
+          Opcode::SUB, OperandSize::I64,
+          {Operand::immediate(static_cast<int64_t>(stackAllocationSize)),
+           Operand::ofRegister(Register::RSP)});
     }
-    return result;
+    for (Register savedRegister : savedRegisters) {
+      prolog[count++] = generateSaveRegister(savedRegister);
+    }
+    std::copy(prolog.begin(), prolog.begin() + count,
+              slots.end() - static_cast<ptrdiff_t>(count));
+    return count;
   }
-  std::vector<Instruction> generateEpilog(size_t stackAllocationSize) {
-    std::vector<Instruction> result;
+  void generateEpilog(std::vector<Instruction> &output, bool hasFramePointer,
+                      size_t stackAllocationSize,
+                      std::span<const Register> savedRegisters) {
+    for (auto savedRegister = savedRegisters.rbegin();
+         savedRegister != savedRegisters.rend(); savedRegister++) {
+      output += generateRestoreRegister(*savedRegister);
+    }
     if (stackAllocationSize > 0) {
-      result +=
-          Instruction{"add",
-                      OperandSize::I64,
-                      {Operand{stackAllocationSize}, Operand{Register::RSP}}};
+      output += makeInstruction(
+          Opcode::ADD, OperandSize::I64,
+          {Operand::immediate(static_cast<int64_t>(stackAllocationSize)),
+           Operand::ofRegister(Register::RSP)});
     }
-    result += Instruction{"pop", OperandSize::I64, {Operand{Register::RBP}}};
-    result += Instruction{"ret", OperandSize::I64, {}};
-    return result;
+    if (hasFramePointer) {
+      output += generateRestoreRegister(Register::RBP);
+    }
+    output += makeInstruction(Opcode::RET, OperandSize::I64, {});
   }
 
-  Instruction generateLabel(const std::string &name) {
-    return Instruction{name + ":", OperandSize::I64, {}, false};
+  Instruction generateLabel(Label label) {
+    return makeInstruction(Opcode::LABEL, OperandSize::I64,
+                           {Operand::label(label)});
+  }
+
+  // The entry point of a static executable, which starts with argc and the
+  // argv pointers on the stack. Each argument is parsed as a decimal integer,
+  // optionally negative, and pushed; they are popped into the parameter
+  // registers once all are parsed, since parsing uses some of them. The
+  // function's result is the exit status, and a wrong number of arguments or
+  // a malformed one exits with status 2.
+  void generateStart(std::vector<Instruction> &output, size_t parameterCount,
+                     size_t symbol) {
+    constexpr auto parameterRegisters = parameterPassingRegisters();
+    if (parameterCount > parameterRegisters.size()) {
+      throw std::runtime_error("Not implemented - arguments on the stack");
+    }
+    constexpr int64_t exitSystemCall = 60;
+    const Label usageLabel = 0;
+    Label nextLabel = 1;
+    auto reg = Operand::ofRegister;
+    output += makeInstruction(Opcode::MOV, OperandSize::I64,
+                              {reg(Register::RSP), reg(Register::RBP)});
+    output += makeInstruction(
+        Opcode::CMP, OperandSize::I64,
+        {Operand::immediate(static_cast<int64_t>(parameterCount + 1)),
+         Operand::memory(Register::RBP, 0)});
+    output += jumpIf(Condition::NOT_EQUAL, usageLabel);
+    output += moveImmediate(OperandSize::I32, 10, Register::R11);
+    for (size_t i = 0; i < parameterCount; i++) {
+      Label digitsLabel = nextLabel++;
+      Label loopLabel = nextLabel++;
+      Label endLabel = nextLabel++;
+      Label positiveLabel = nextLabel++;
+      // R10 points at the next character, R9 at the first digit, RCX holds
+      // the first character and RDX the current digit.
+      output += makeInstruction(
+          Opcode::MOV, OperandSize::I64,
+          {Operand::memory(Register::RBP, static_cast<ptrdiff_t>(16 + i * 8)),
+           reg(Register::R10)});
+      output += moveImmediate(OperandSize::I32, 0, Register::RAX);
+      output += extend(false, OperandSize::I8, OperandSize::I32,
+                       Operand::memory(Register::R10, 0), Register::RCX);
+      output += makeInstruction(Opcode::CMP, OperandSize::I32,
+                                {Operand::immediate('-'), reg(Register::RCX)});
+      output += jumpIf(Condition::NOT_EQUAL, digitsLabel);
+      output += makeInstruction(Opcode::INC, OperandSize::I64,
+                                {reg(Register::R10)});
+      output += generateLabel(digitsLabel);
+      output += *move(OperandSize::I64, Register::R10, Register::R9);
+      output += generateLabel(loopLabel);
+      output += extend(false, OperandSize::I8, OperandSize::I32,
+                       Operand::memory(Register::R10, 0), Register::RDX);
+      output += makeInstruction(Opcode::SUB, OperandSize::I32,
+                                {Operand::immediate('0'), reg(Register::RDX)});
+      output += makeInstruction(Opcode::CMP, OperandSize::I32,
+                                {Operand::immediate(9), reg(Register::RDX)});
+      output += jumpIf(Condition::ABOVE, endLabel);
+      output += makeInstruction(Opcode::IMUL, OperandSize::I64,
+                                {reg(Register::R11), reg(Register::RAX)});
+      output += makeInstruction(Opcode::ADD, OperandSize::I64,
+                                {reg(Register::RDX), reg(Register::RAX)});
+      output += makeInstruction(Opcode::INC, OperandSize::I64,
+                                {reg(Register::R10)});
+      output += jump(loopLabel);
+      // Only the terminating null may end the digits, and there must be one.
+      output += generateLabel(endLabel);
+      output += makeInstruction(Opcode::CMP, OperandSize::I32,
+                                {Operand::immediate(-'0'), reg(Register::RDX)});
+      output += jumpIf(Condition::NOT_EQUAL, usageLabel);
+      output += compare(OperandSize::I64, Register::R10, Register::R9);
+      output += jumpIf(Condition::EQUAL, usageLabel);
+      output += makeInstruction(Opcode::CMP, OperandSize::I32,
+                                {Operand::immediate('-'), reg(Register::RCX)});
+      output += jumpIf(Condition::NOT_EQUAL, positiveLabel);
+      output += makeInstruction(Opcode::NEG, OperandSize::I64,
+                                {reg(Register::RAX)});
+      output += generateLabel(positiveLabel);
+      output += generateSaveRegister(Register::RAX);
+    }
+    for (size_t i = parameterCount; i-- > 0;) {
+      output += generateRestoreRegister(parameterRegisters[i]);
+    }
+    // RSP is back where the kernel left it, which is aligned for a call.
+    output += call(symbol);
+    output += *move(OperandSize::I64, RETURN_VALUE_REGISTER, Register::RDI);
+    output += moveImmediate(OperandSize::I32, exitSystemCall, Register::RAX);
+    output += makeInstruction(Opcode::SYSCALL, OperandSize::I64, {});
+    output += generateLabel(usageLabel);
+    output += moveImmediate(OperandSize::I32, 2, Register::RDI);
+    output += moveImmediate(OperandSize::I32, exitSystemCall, Register::RAX);
+    output += makeInstruction(Opcode::SYSCALL, OperandSize::I64, {});
+  }
+
+  // Profile records are read by runtime/profile.c: a pointer to the function
+  // name, the block count, and then a counter per block.
+  void generateProfileRecord(std::string_view labelPrefix,
+                             std::string_view functionName, size_t blockCount,
+                             std::string &output) {
+    output += ".section .rodata\n";
+    output += labelPrefix;
+    output += ".profile_name:\n\t.string \"";
+    output += functionName;
+    output += "\"\n.section zips_profile,\"aw\",@progbits\n.balign 8\n";
+    output += labelPrefix;
+    output += ".profile:\n\t.quad ";
+    output += labelPrefix;
+    output += ".profile_name\n\t.quad ";
+    appendInteger(output, static_cast<int64_t>(blockCount));
+    output += "\n\t.zero ";
+    appendInteger(output, static_cast<int64_t>(blockCount * 8));
+    output += "\n.text\n";
+  }
+  Instruction incrementBlockCounter(size_t block) {
+    return makeInstruction(Opcode::INC, OperandSize::I64,
+                           {Operand::blockCounter(block)});
   }
 
   Instruction generateSaveRegister(Register reg) {
-    return Instruction{"push", OperandSize::I64, {Operand{reg}}};
+    return makeInstruction(Opcode::PUSH, OperandSize::I64,
+                           {Operand::ofRegister(reg)});
   }
   Instruction generateRestoreRegister(Register reg) {
-    return Instruction{"pop", OperandSize::I64, {Operand{reg}}};
+    return makeInstruction(Opcode::POP, OperandSize::I64,
+                           {Operand::ofRegister(reg)});
+  }
+
+  // Writing an 8 or 16-bit register merges with the rest of it, so narrow
+  // values are moved and computed as 32-bit values. Only their low bits are
+  // meaningful.
+  static constexpr OperandSize promote(OperandSize size) {
+    return std::max(size, OperandSize::I32);
   }
 
   std::optional<Instruction> move(OperandSize size, Register from,
                                   Register to) {
     if (from != to) {
-      return Instruction{"mov", size, {Operand{from}, Operand{to}}};
+      return makeInstruction(Opcode::MOV, promote(size),
+                             {Operand::ofRegister(from), Operand::ofRegister(to)});
     } else {
       return std::nullopt;
     }
   }
 
-  Instruction jump(const std::string &label) {
-    return Instruction{"jmp", OperandSize::I64, {Operand{label}}, false};
+  // Extends a register or stack slot from size from to size to. The result
+  // is at least 32 bits wide, and zero extended values are zero extended to
+  // 64 bits since 32-bit writes clear the upper half.
+  Instruction extend(bool isSigned, OperandSize from, OperandSize to,
+                     Operand source, Register dest) {
+    if (from == OperandSize::I64 || (from == OperandSize::I32 &&
+                                     (!isSigned || to == OperandSize::I32))) {
+      return makeInstruction(Opcode::MOV, from,
+                             {source, Operand::ofRegister(dest)});
+    }
+    OperandSize size =
+        isSigned && to == OperandSize::I64 ? OperandSize::I64 : OperandSize::I32;
+    Instruction result =
+        makeInstruction(isSigned ? Opcode::MOVSX : Opcode::MOVZX, size,
+                        {source, Operand::ofRegister(dest)});
+    result.sourceSize = from;
+    return result;
+  }
+
+  Instruction jump(Label label) {
+    return makeInstruction(Opcode::JMP, OperandSize::I64,
+                           {Operand::label(label)});
   }
 
-  std::vector<Instruction> add(OperandSize size, Register a, Register b,
-                               Register dest) {
-    std::vector<Instruction> result;
-    result += move(size, a, dest);
-    result += Instruction{"add", size, {Operand{b}, Operand{dest}}};
-    return result;
+  Instruction jumpIf(Condition condition, Label label) {
+    return makeInstruction(Opcode::JCC, OperandSize::I64,
+                           {Operand::label(label)}, condition);
+  }
+
+  // Sets the flags for a comparison of a with b.
+  Instruction compare(OperandSize size, Register a, Register b) {
+    return makeInstruction(Opcode::CMP, size,
+                           {Operand::ofRegister(b), Operand::ofRegister(a)});
+  }
+
+  Instruction test(OperandSize size, Register reg) {
+    return makeInstruction(Opcode::TEST, size,
+                           {Operand::ofRegister(reg), Operand::ofRegister(reg)});
+  }
+
+  Instruction setIf(Condition condition, Register dest) {
+    return makeInstruction(Opcode::SETCC, OperandSize::I8,
+                           {Operand::ofRegister(dest)}, condition);
+  }
+
+  // cmov has no 8-bit form, so narrower values are moved as 32-bit values.
+  Instruction moveIf(Condition condition, OperandSize size, Register from,
+                     Register to) {
+    return moveIf(condition, size, Operand::ofRegister(from), to);
+  }
+  // The source may also be a stack slot.
+  Instruction moveIf(Condition condition, OperandSize size, Operand from,
+                     Register to) {
+    return makeInstruction(Opcode::CMOVCC, std::max(size, OperandSize::I32),
+                           {from, Operand::ofRegister(to)}, condition);
+  }
+
+  Instruction moveImmediate(OperandSize size, int64_t value, Register to) {
+    return makeInstruction(Opcode::MOV, promote(size),
+                           {Operand::immediate(value), Operand::ofRegister(to)});
+  }
+
+  // Adds at exactly the given size, rather than promoting narrow sizes, so
+  // that the overflow and carry flags show whether the sum fits it.
+  void addWithFlags(std::vector<Instruction> &output, OperandSize size,
+                    Register a, Register b, Register dest) {
+    if (dest == b) {
+      std::swap(a, b);
+    }
+    output += move(size, a, dest);
+    output += makeInstruction(Opcode::ADD, size,
+                              {Operand::ofRegister(b), Operand::ofRegister(dest)});
+  }
+
+  // Sets dest to what a signed sum with a overflowing saturates to: the
+  // maximum of the size if a isn't negative, and the minimum if it is. The
+  // sign of ~a is spread over the value, giving -1 or 0, and flipping the
+  // sign bit of that gives the maximum or the minimum. Narrow values are
+  // sign extended first, so the shift is at the promoted size too.
+  void signedSaturation(std::vector<Instruction> &output, OperandSize size,
+                        Register a, Register dest) {
+    OperandSize promotedSize = promote(size);
+    int64_t signBit = static_cast<int64_t>(getSize(size) * 8 - 1);
+    if (promotedSize != size) {
+      output += extend(true, size, promotedSize, Operand::ofRegister(a), dest);
+    } else {
+      output += move(size, a, dest);
+    }
+    output += makeInstruction(Opcode::NOT, promotedSize,
+                              {Operand::ofRegister(dest)});
+    output += makeInstruction(
+        Opcode::SAR, promotedSize,
+        {Operand::immediate(static_cast<int64_t>(getSize(promotedSize) * 8 - 1)),
+         Operand::ofRegister(dest)});
+    output += makeInstruction(Opcode::BTC, promotedSize,
+                              {Operand::immediate(signBit),
+                               Operand::ofRegister(dest)});
+  }
+
+  Instruction trap() {
+    return makeInstruction(Opcode::UD2, OperandSize::I64, {});
+  }
+
+  void add(std::vector<Instruction> &output, OperandSize size, Register a,
+           Register b, Register dest) {
+    if (dest == b) {
+      std::swap(a, b);
+    }
+    output += move(size, a, dest);
+    output += makeInstruction(Opcode::ADD, promote(size),
+                              {Operand::ofRegister(b), Operand::ofRegister(dest)});
+  }
+
+  Instruction call(size_t symbol) {
+    return makeInstruction(Opcode::CALL, OperandSize::I64,
+                           {Operand::symbol(symbol)});
   }
 
-  Instruction stackStore(OperandSize size, Register reg, ptrdiff_t offset) {
-    ptrdiff_t rbpOffset = -offset - 8;
-    return Instruction{"mov",
-                       size,
-                       {Operand{reg}, Operand{typename Operand::MemoryOperand{
-                                          Register::RBP, rbpOffset}}}};
+  Instruction stackStore(OperandSize size, Register reg, size_t slot) {
+    return makeInstruction(Opcode::MOV, size,
+                           {Operand::ofRegister(reg), Operand::stackSlot(slot)});
   }
+  // Narrow values are zero extended as they are loaded.
+  Instruction stackLoad(OperandSize size, size_t slot, Register reg) {
+    return extend(false, size, size, Operand::stackSlot(slot), reg);
+  }
+};
+
+// What identical code folding left out of the last unit generated.
+struct FoldingStatistics {
+  size_t foldedFunctionCount = 0;
+  size_t instructionCount = 0;
+  // The machine code of the bodies which are no longer emitted, as encoded
+  // for executables.
+  size_t codeBytes = 0;
 };
 
 template <TargetArchitecture arch, TargetAbi abi> class CodeGenerator {
@@ -435,220 +1086,1504 @@ template <TargetArchitecture arch, TargetAbi abi> class CodeGenerator {
   using Instruction = InstructionGenerator::Instruction;
   using OperandSize = InstructionGenerator::OperandSize;
   using Register = InstructionGenerator::Register;
+  using Condition = InstructionGenerator::Condition;
+  using Operand = InstructionGenerator::Operand;
+  using Opcode = InstructionGenerator::Opcode;
+  using Label = InstructionGenerator::Label;
+  static constexpr Label END_LABEL = InstructionGenerator::END_LABEL;
 
   InstructionGenerator instructionGenerator;
 
   struct Value {
     OperandSize size;
-    std::variant<Register, size_t> position; // Register or stack offset.
+    std::variant<Register, size_t> position; // Register or stack slot.
     bool variable = false;
+    // Whether the register is known to hold the value zero extended to 64
+    // bits. A variable keeps this for its whole lifetime, so every value
+    // assigned to it is extended if needed.
+    bool zeroExtended = false;
   };
 
+  struct StackSlot {
+    OperandSize size;
+    bool inUse;
+    ptrdiff_t offset = 0; // From RBP or RSP, assigned by layoutStackFrame.
+  };
+
+  // A fixed capacity stack of registers, so that allocating a register never
+  // touches the heap.
+  class RegisterStack {
+    std::array<Register, 16> registers;
+    size_t count = 0;
+
+  public:
+    RegisterStack() = default;
+    RegisterStack(std::initializer_list<Register> initial) {
+      for (Register reg : initial) {
+        push(reg);
+      }
+    }
+    bool empty() const { return count == 0; }
+    void push(Register reg) { registers[count++] = reg; }
+    Register pop() { return registers[--count]; }
+    void erase(Register reg) {
+      auto end = std::remove(registers.begin(), registers.begin() + count, reg);
+      count = static_cast<size_t>(end - registers.begin());
+    }
+    std::span<const Register> get() const { return {registers.data(), count}; }
+  };
+
+  static RegisterStack allocatableRegisters() {
+    RegisterStack result;
+    for (Register reg : InstructionGenerator::callerSavedRegisters()) {
+      result.push(reg);
+    }
+    for (Register scratchRegister : InstructionGenerator::scratchRegisters()) {
+      result.erase(scratchRegister);
+    }
+    return result;
+  }
+  static RegisterStack calleeSavedRegisters() {
+    RegisterStack result;
+    for (Register reg : InstructionGenerator::calleeSavedRegisters()) {
+      result.push(reg);
+    }
+    return result;
+  }
+
+  // The state of the function being generated. One instance is reset for
+  // each function so that its buffers keep their capacity.
   struct Function {
     std::string name;
-    std::vector<std::map<std::string, Value>> variables;
-    std::string labelPrefix;
-    std::vector<Instruction> instructions;
-    std::vector<Register> savedRegisters;
+    OperandSize returnSize = OperandSize::I64;
+    // Variables in scope, innermost last, and where each scope starts.
+    std::vector<std::pair<std::string_view, Value>> variables;
+    std::vector<size_t> scopes;
+    size_t labelCount = 0;
+    // The block checked additions jump to when they overflow, which is put
+    // after the epilog.
+    std::optional<Label> trapLabel;
+    // Where the function and its body start in the instruction buffer. The
+    // prolog is patched into the slots in between once the body is done.
+    size_t begin = 0;
+    size_t bodyBegin = 0;
+    RegisterStack savedRegisters;
+    std::vector<StackSlot> stackSlots;
     size_t stackAllocationSize = 0;
-    std::vector<Register> availableRegisters =
-        InstructionGenerator::callerSavedRegisters();
-    std::vector<Register> remainingCalleeSavedRegisters =
-        InstructionGenerator::calleeSavedRegisters();
+    // Leaf functions whose slots fit in the red zone address them through
+    // RSP, and need neither a frame pointer nor a stack allocation.
+    bool isLeaf = true;
+    bool hasFramePointer = true;
+    RegisterStack availableRegisters;
+    RegisterStack remainingCalleeSavedRegisters;
+
+    void reset(const std::string &name, size_t begin) {
+      this->name = name;
+      variables.clear();
+      scopes.clear();
+      labelCount = 0;
+      trapLabel.reset();
+      this->begin = begin;
+      bodyBegin = begin + InstructionGenerator::maxPrologSize;
+      savedRegisters = {};
+      stackSlots.clear();
+      stackAllocationSize = 0;
+      isLeaf = true;
+      hasFramePointer = true;
+      availableRegisters = allocatableRegisters();
+      remainingCalleeSavedRegisters = CodeGenerator::calleeSavedRegisters();
+    }
 
     Value createValue(OperandSize size, bool isVariable = false) {
-      if (availableRegisters.size() > 0) {
-        Register chosenRegister = availableRegisters.back();
-        availableRegisters.pop_back();
-        return Value{size, chosenRegister, isVariable};
-      } else if (remainingCalleeSavedRegisters.size() > 0) {
-        Register chosenRegister = remainingCalleeSavedRegisters.back();
-        remainingCalleeSavedRegisters.pop_back();
-        savedRegisters += chosenRegister;
+      if (!availableRegisters.empty()) {
+        return Value{size, availableRegisters.pop(), isVariable};
+      } else if (!remainingCalleeSavedRegisters.empty()) {
+        Register chosenRegister = remainingCalleeSavedRegisters.pop();
+        savedRegisters.push(chosenRegister);
         return Value{size, chosenRegister, isVariable};
+      }
+      return Value{size, createSlot(size), isVariable};
+    }
+    // Slots are colored by size: a slot whose value is dead is reused for
+    // the next value of the same size.
+    size_t createSlot(OperandSize size) {
+      getWorkCounters().spillCount++;
+      for (size_t slot = 0; slot < stackSlots.size(); slot++) {
+        if (!stackSlots[slot].inUse && stackSlots[slot].size == size) {
+          stackSlots[slot].inUse = true;
+          return slot;
+        }
+      }
+      stackSlots += StackSlot{size, true};
+      return stackSlots.size() - 1;
+    }
+    bool isAvailable(Register reg) const {
+      std::span<const Register> available = availableRegisters.get();
+      return std::find(available.begin(), available.end(), reg) !=
+             available.end();
+    }
+    void release(const Value &value) {
+      if (std::holds_alternative<Register>(value.position)) {
+        availableRegisters.push(std::get<Register>(value.position));
       } else {
-        size_t sizeBytes = InstructionGenerator::getSize(size);
-        // Naturally aligned.
-        stackAllocationSize =
-            (stackAllocationSize / sizeBytes) * sizeBytes + sizeBytes;
-        return Value{size, stackAllocationSize - sizeBytes, isVariable};
+        stackSlots[std::get<size_t>(value.position)].inUse = false;
       }
     }
     void destroyValue(Value value) {
-      if (!value.variable && std::holds_alternative<Register>(value.position)) {
-        availableRegisters += std::get<Register>(value.position);
+      if (!value.variable) {
+        release(value);
       }
     }
     void destroyVariable(Value value) {
-      if (value.variable && std::holds_alternative<Register>(value.position)) {
-        availableRegisters += std::get<Register>(value.position);
+      if (value.variable) {
+        release(value);
       }
     }
     Value createValue(OperandSize size, bool isVariable, Register position) {
+      availableRegisters.erase(position);
       return Value{size, position, isVariable};
     }
+    Label createLabel() { return static_cast<Label>(labelCount++); }
+    // Block 0 is the entry, and every label created with createLabel starts
+    // the next block.
+    size_t getBlockCount() const { return labelCount + 1; }
+    std::optional<size_t> getBlock(Label label) const {
+      if (label == END_LABEL) {
+        return std::nullopt;
+      }
+      return label + 1;
+    }
+  };
+
+  static constexpr size_t NO_FUNCTION = std::numeric_limits<size_t>::max();
+
+  // A function whose instructions are complete, waiting to be printed.
+  struct GeneratedFunction {
+    std::string_view name;
+    size_t begin;
+    size_t end;
+    size_t blockCount;
+    uint64_t profileCount;
+    // The function whose body this one uses instead of its own, if any.
+    size_t foldedInto = NO_FUNCTION;
+    // The next function folded into the same one, in name order.
+    size_t nextAlias = NO_FUNCTION;
+  };
+
+  bool instrument = false;
+  bool fold = true;
+  FoldingStatistics foldingStatistics;
+  std::optional<Profile> profile;
+  // Functions small enough to inline, by name, see findInlineCandidates.
+  std::unordered_map<std::string_view, FunctionNode *> inlineCandidates;
+  // Walks the expression of an inlined callee while the caller's walk waits.
+  Traversal inlineTraversal;
+
+  // The instructions of every function of the unit, appended in order. The
+  // buffers are cleared rather than freed between functions and units, so
+  // once they have grown, generating code doesn't allocate.
+  std::vector<Instruction> instructions;
+  std::vector<GeneratedFunction> generatedFunctions;
+  // The hash of each generated function's instructions, with its index.
+  std::vector<std::pair<uint64_t, size_t>> functionHashes;
+  // The functions called by the unit, which symbol operands refer to.
+  std::vector<std::string_view> symbols;
+  std::string labelPrefix;
+  Function function;
+  Traversal traversal;
+  // Buffers for encoding executables: the relocations left to resolve, the
+  // offset of each label of the function being encoded, and where each
+  // generated function was encoded.
+  std::vector<typename InstructionGenerator::Relocation> relocations;
+  std::vector<size_t> labelOffsets;
+  std::vector<size_t> functionOffsets;
+  // Machine code which is only measured, see getEncodedSize.
+  std::string measuredCode;
+
+  // Whether the profile says block a ran more often than block b.
+  bool isHotter(Label a, Label b) const {
+    return profile &&
+           profile->getBlockCount(function.name, *function.getBlock(a)) >
+               profile->getBlockCount(function.name, *function.getBlock(b));
+  }
+
+  static constexpr size_t maxInlinedNodes = 16;
+
+  // Counts the nodes of an expression, stopping once there are too many to
+  // inline, and whether it makes calls.
+  class InlineSizePass : public AstPass {
+    void countNode() {
+      if (++nodeCount > maxInlinedNodes) {
+        skipRemainingChildren();
+      }
+    }
+    void enterBinaryExpression(BinaryExpressionNode *) { countNode(); }
+    void enterVariableReference(VariableReferenceNode *) { countNode(); }
+    void enterCallExpression(CallExpressionNode *) {
+      hasCalls = true;
+      skipRemainingChildren();
+    }
+
+  public:
+    size_t nodeCount = 0;
+    bool hasCalls = false;
+
+    InlineSizePass() {
+      onEnter<&InlineSizePass::enterBinaryExpression>();
+      onEnter<&InlineSizePass::enterVariableReference>();
+      onEnter<&InlineSizePass::enterCallExpression>();
+    }
   };
 
-  Register getIntoRegister(Function &function, const Value &value) {
+  // Functions which just return a small expression without calls can be
+  // inlined, which only the profile decides, see findInlinedCallee.
+  void findInlineCandidates(CompilationUnitNode *node) {
+    inlineCandidates.clear();
+    if (!profile || instrument) {
+      return;
+    }
+    for (auto &function : node->getNodes()) {
+      auto functionNode = static_cast<FunctionNode *>(function.get());
+      auto &body = functionNode->getBody();
+      if (body.size() != 1 ||
+          body[0]->getNodeType() != AstNodeType::RETURN_STATEMENT ||
+          functionNode->getParameters().size() >
+              InstructionGenerator::parameterPassingRegisters().size()) {
+        continue;
+      }
+      InlineSizePass size;
+      inlineTraversal.run(
+          static_cast<ReturnStatementNode *>(body[0].get())->getExpression(),
+          {&size});
+      if (!size.hasCalls && size.nodeCount <= maxInlinedNodes) {
+        inlineCandidates.emplace(functionNode->getName(), functionNode);
+      }
+    }
+  }
+
+  // A callee is hot if the profile shows it ran at least as often as the
+  // function being generated, which would then pay for a call on every run.
+  FunctionNode *findInlinedCallee(CallExpressionNode *callExpression) const {
+    auto candidate = inlineCandidates.find(callExpression->getName());
+    if (candidate == inlineCandidates.end()) {
+      return nullptr;
+    }
+    uint64_t calleeCount = profile->getFunctionCount(callExpression->getName());
+    if (calleeCount == 0 ||
+        calleeCount < profile->getFunctionCount(function.name)) {
+      return nullptr;
+    }
+    return candidate->second;
+  }
+
+  size_t getSymbol(std::string_view name) {
+    size_t symbol = std::find(symbols.begin(), symbols.end(), name) -
+                    symbols.begin();
+    if (symbol == symbols.size()) {
+      symbols.push_back(name);
+    }
+    return symbol;
+  }
+
+  static constexpr Register scratchRegister(size_t index) {
+    return InstructionGenerator::scratchRegisters()[index];
+  }
+
+  void emitLabel(Label label) {
+    instructions += instructionGenerator.generateLabel(label);
+    if (instrument) {
+      if (std::optional<size_t> block = function.getBlock(label)) {
+        instructions += instructionGenerator.incrementBlockCounter(*block);
+      }
+    }
+  }
+
+  // Values in stack slots are loaded into the given scratch register.
+  Register getIntoRegister(const Value &value, Register scratch) {
+    if (std::holds_alternative<Register>(value.position)) {
+      return std::get<Register>(value.position);
+    }
+    instructions += instructionGenerator.stackLoad(
+        value.size, std::get<size_t>(value.position), scratch);
+    return scratch;
+  }
+  // The register to compute a new value in, before storing it with
+  // getBackToValue.
+  static Register getResultRegister(const Value &value, Register scratch) {
     if (std::holds_alternative<Register>(value.position)) {
       return std::get<Register>(value.position);
-    } else {
-      throw std::runtime_error("Not implemented - out of registers");
     }
+    return scratch;
   }
-  void getBackToValue(Function &function, Register allocatedRegister,
-                      const Value &value) {
+  void getBackToValue(Register allocatedRegister, const Value &value) {
     if (std::holds_alternative<Register>(value.position)) {
       Register targetRegister = std::get<Register>(value.position);
       if (allocatedRegister != targetRegister) {
-        function.instructions += instructionGenerator.move(
+        instructions += instructionGenerator.move(
             value.size, allocatedRegister, targetRegister);
       }
     } else {
-      function.instructions += instructionGenerator.stackStore(
+      instructions += instructionGenerator.stackStore(
           value.size, allocatedRegister, std::get<size_t>(value.position));
     }
   }
 
-  Value add(Function &function, const Value &a, const Value &b,
-            bool destroyValues) {
-    Register registerA = getIntoRegister(function, a);
-    Register registerB = getIntoRegister(function, b);
-    Value result = function.createValue(a.size);
-    Register registerResult = getIntoRegister(function, result);
-    function.instructions += instructionGenerator.add(
-        result.size, registerA, registerB, registerResult);
-    getBackToValue(function, registerResult, result);
+  // Values in stack slots are zero extended as they are loaded.
+  static bool isZeroExtended(const Value &value) {
+    return value.zeroExtended || value.size == OperandSize::I64 ||
+           std::holds_alternative<size_t>(value.position);
+  }
+
+  // Gets the value into a register with at least the given size, extending
+  // it according to its signedness if it is narrower. Extensions which are
+  // known to be redundant are left out.
+  Register getIntoRegister(const Value &value, bool isSigned, OperandSize size,
+                           Register scratch) {
+    if (value.size >= size || (!isSigned && isZeroExtended(value))) {
+      return getIntoRegister(value, scratch);
+    }
+    Operand source =
+        std::holds_alternative<Register>(value.position)
+            ? Operand::ofRegister(std::get<Register>(value.position))
+            : Operand::stackSlot(std::get<size_t>(value.position));
+    instructions +=
+        instructionGenerator.extend(isSigned, value.size, size, source, scratch);
+    return scratch;
+  }
+
+  // Converts a value to the given size: narrower sizes just use its low bits,
+  // wider ones extend it according to its signedness.
+  Value convert(const Value &value, bool isSigned, OperandSize size) {
+    if (size <= value.size) {
+      Value result = value;
+      result.zeroExtended = size == value.size && isZeroExtended(value);
+      result.size = size;
+      return result;
+    }
+    if (!isSigned && isZeroExtended(value) &&
+        std::holds_alternative<Register>(value.position)) {
+      Value result = value;
+      result.size = size;
+      result.zeroExtended = true;
+      return result;
+    }
+    // A temporary's register is reused, since it is read before the result
+    // is written.
+    function.destroyValue(value);
+    Value result = function.createValue(size);
+    Register registerResult = getResultRegister(result, scratchRegister(0));
+    getIntoRegister(value, isSigned, size, registerResult);
+    getBackToValue(registerResult, result);
+    result.zeroExtended = !isSigned;
+    return result;
+  }
+
+  // Operands narrower than the result are extended first. Narrow additions
+  // are done in 32 bits, whose low bits are the same.
+  Value add(const Value &a, bool isSignedA, const Value &b, bool isSignedB,
+            OperandSize size) {
+    Register registerA =
+        getIntoRegister(a, isSignedA, size, scratchRegister(0));
+    Register registerB =
+        getIntoRegister(b, isSignedB, size, scratchRegister(1));
+    function.destroyValue(a);
+    function.destroyValue(b);
+    Value result = function.createValue(size);
+    Register registerResult = getResultRegister(result, scratchRegister(0));
+    instructionGenerator.add(instructions, result.size, registerA, registerB,
+                             registerResult);
+    getBackToValue(registerResult, result);
+    result.zeroExtended = size >= OperandSize::I32;
     return result;
   }
 
-  void returnValue(Function &function, const Value &value) {
-    Register valueRegister = getIntoRegister(function, value);
-    function.instructions += instructionGenerator.move(
-        value.size, valueRegister, InstructionGenerator::RETURN_VALUE_REGISTER);
-    function.instructions +=
-        instructionGenerator.jump(function.labelPrefix + "_end");
+  // Checked additions branch to the trap block, out of the way at the end of
+  // the function, on signed overflow or unsigned carry.
+  Value checkedAdd(const Value &a, bool isSignedA, const Value &b,
+                   bool isSignedB, OperandSize size, bool isSignedResult) {
+    Register registerA =
+        getIntoRegister(a, isSignedA, size, scratchRegister(0));
+    Register registerB =
+        getIntoRegister(b, isSignedB, size, scratchRegister(1));
+    function.destroyValue(a);
+    function.destroyValue(b);
+    Value result = function.createValue(size);
+    Register registerResult = getResultRegister(result, scratchRegister(0));
+    instructionGenerator.addWithFlags(instructions, size, registerA, registerB,
+                                      registerResult);
+    if (!function.trapLabel) {
+      function.trapLabel = function.createLabel();
+    }
+    instructions += instructionGenerator.jumpIf(
+        isSignedResult ? Condition::OVERFLOW : Condition::BELOW,
+        *function.trapLabel);
+    getBackToValue(registerResult, result);
+    result.zeroExtended = size >= OperandSize::I32;
+    return result;
   }
 
-  Value generateExpression(Function &function, AstNode *node) {
-    switch (node->getNodeType()) {
-    case AstNodeType::VARIABLE_REFERENCE: {
-      std::string variableName =
-          static_cast<VariableReferenceNode *>(node)->getName();
-      for (auto variableScope = function.variables.rbegin();
-           variableScope != function.variables.rend(); variableScope++) {
-        if (variableScope->contains(variableName)) {
-          return (*variableScope)[variableName];
+  // Saturating additions clamp the sum with a conditional move, so they
+  // don't branch. Signed sums saturate towards the sign of a, which is worked
+  // out before the addition.
+  Value saturatingAdd(const Value &a, bool isSignedA, const Value &b,
+                      bool isSignedB, OperandSize size, bool isSignedResult) {
+    OperandSize promotedSize = InstructionGenerator::promote(size);
+    Register registerA =
+        getIntoRegister(a, isSignedA, size, scratchRegister(0));
+    std::optional<Value> saturation;
+    if (isSignedResult) {
+      saturation = function.createValue(promotedSize);
+      Register saturationRegister =
+          getResultRegister(*saturation, scratchRegister(1));
+      instructionGenerator.signedSaturation(instructions, size, registerA,
+                                            saturationRegister);
+      getBackToValue(saturationRegister, *saturation);
+    }
+    Register registerB =
+        getIntoRegister(b, isSignedB, size, scratchRegister(1));
+    function.destroyValue(a);
+    function.destroyValue(b);
+    Value result = function.createValue(size);
+    Register registerResult = getResultRegister(result, scratchRegister(0));
+    instructionGenerator.addWithFlags(instructions, size, registerA, registerB,
+                                      registerResult);
+    if (saturation) {
+      Operand source =
+          std::holds_alternative<Register>(saturation->position)
+              ? Operand::ofRegister(std::get<Register>(saturation->position))
+              : Operand::stackSlot(std::get<size_t>(saturation->position));
+      instructions += instructionGenerator.moveIf(
+          Condition::OVERFLOW, promotedSize, source, registerResult);
+      function.destroyValue(*saturation);
+    } else {
+      // The result is never in the second scratch register, and b is no
+      // longer needed, so it can hold the maximum. mov leaves the flags.
+      instructions += instructionGenerator.moveImmediate(
+          promotedSize, -1, scratchRegister(1));
+      instructions += instructionGenerator.moveIf(
+          Condition::BELOW, promotedSize, scratchRegister(1), registerResult);
+    }
+    getBackToValue(registerResult, result);
+    result.zeroExtended = size >= OperandSize::I32;
+    return result;
+  }
+
+  static Condition comparisonCondition(BinaryOperator operatorType,
+                                       bool isSigned) {
+    switch (operatorType) {
+    case BinaryOperator::EQUAL:
+      return Condition::EQUAL;
+    case BinaryOperator::NOT_EQUAL:
+      return Condition::NOT_EQUAL;
+    case BinaryOperator::LESS:
+      return isSigned ? Condition::LESS : Condition::BELOW;
+    case BinaryOperator::LESS_EQUAL:
+      return isSigned ? Condition::LESS_EQUAL : Condition::BELOW_EQUAL;
+    case BinaryOperator::GREATER:
+      return isSigned ? Condition::GREATER : Condition::ABOVE;
+    case BinaryOperator::GREATER_EQUAL:
+      return isSigned ? Condition::GREATER_EQUAL : Condition::ABOVE_EQUAL;
+    default:
+      throw std::runtime_error("Not a comparison");
+    }
+  }
+
+  // Sets the flags such that the returned condition holds if the comparison
+  // is true.
+  //
+  // Operands of different sizes are extended to the wider one. If their
+  // signedness differs too, both are compared as 64-bit values with the left
+  // operand's signedness, like the interpreters do.
+  Condition compare(BinaryExpressionNode *comparison, const Value &a,
+                    const Value &b) {
+    bool isSignedA = isSigned(getPrimitiveType(comparison->getLeft()));
+    bool isSignedB = isSigned(getPrimitiveType(comparison->getRight()));
+    OperandSize size = isSignedA == isSignedB ? std::max(a.size, b.size)
+                                              : OperandSize::I64;
+    instructions += instructionGenerator.compare(
+        size, getIntoRegister(a, isSignedA, size, scratchRegister(0)),
+        getIntoRegister(b, isSignedB, size, scratchRegister(1)));
+    return comparisonCondition(comparison->getOperator(), isSignedA);
+  }
+
+  // Values in caller saved registers are kept in stack slots across the
+  // call. Arguments are converted to the parameter types, and narrow ones
+  // extended to 32 bits like C compilers expect.
+  Value call(CallExpressionNode *callExpression,
+             std::span<const Value> arguments) {
+    constexpr auto parameterRegisters =
+        InstructionGenerator::parameterPassingRegisters();
+    if constexpr (abi != TargetAbi::X86_64) {
+      throw std::runtime_error("Not implemented - calls");
+    }
+    if (arguments.size() > parameterRegisters.size()) {
+      throw std::runtime_error("Not implemented - arguments on the stack");
+    }
+    function.isLeaf = false;
+    std::array<std::pair<Register, size_t>, 16> savedValues;
+    size_t savedCount = 0;
+    for (Register reg : allocatableRegisters().get()) {
+      if (!function.isAvailable(reg)) {
+        size_t slot = function.createSlot(OperandSize::I64);
+        instructions +=
+            instructionGenerator.stackStore(OperandSize::I64, reg, slot);
+        savedValues[savedCount++] = {reg, slot};
+      }
+    }
+    // Arguments are read from where they were saved, since the parameter
+    // registers are overwritten one by one.
+    auto getOperand = [&](const Value &value) {
+      if (std::holds_alternative<size_t>(value.position)) {
+        return Operand::stackSlot(std::get<size_t>(value.position));
+      }
+      Register reg = std::get<Register>(value.position);
+      for (size_t i = 0; i < savedCount; i++) {
+        if (savedValues[i].first == reg) {
+          return Operand::stackSlot(savedValues[i].second);
         }
       }
-      throw std::runtime_error("Variable not found");
+      return Operand::ofRegister(reg);
+    };
+    auto &parameterTypes = callExpression->functionType->getParameterTypes();
+    for (size_t i = 0; i < arguments.size(); i++) {
+      PrimitiveTypeType argumentType =
+          getPrimitiveType(callExpression->getArguments()[i].get());
+      PrimitiveTypeType parameterType =
+          static_cast<PrimitiveTypeNode *>(parameterTypes[i].get())
+              ->getPrimitiveType();
+      OperandSize parameterSize =
+          InstructionGenerator::operandSizeFromBits(getBits(parameterType));
+      Operand source = getOperand(arguments[i]);
+      Register parameterRegister = parameterRegisters[i];
+      if (arguments[i].size >= parameterSize) {
+        instructions += instructionGenerator.extend(
+            isSigned(parameterType), parameterSize,
+            InstructionGenerator::promote(parameterSize), source,
+            parameterRegister);
+        continue;
+      }
+      instructions +=
+          instructionGenerator.extend(isSigned(argumentType), arguments[i].size,
+                                      parameterSize, source, parameterRegister);
+      if (parameterSize < OperandSize::I32 &&
+          isSigned(argumentType) != isSigned(parameterType)) {
+        instructions += instructionGenerator.extend(
+            isSigned(parameterType), parameterSize, OperandSize::I32,
+            Operand::ofRegister(parameterRegister), parameterRegister);
+      }
+    }
+    instructions +=
+        instructionGenerator.call(getSymbol(callExpression->getName()));
+    for (const Value &argument : arguments) {
+      function.destroyValue(argument);
     }
-    case AstNodeType::BINARY_EXPRESSION: {
-      auto binaryExpression = static_cast<BinaryExpressionNode *>(node);
-      Value left = generateExpression(function, binaryExpression->getLeft());
-      Value right = generateExpression(function, binaryExpression->getRight());
-      // Destroy the left and right operands so they can be used as the result
-      // value.
-      function.destroyValue(left);
-      function.destroyValue(right);
+    // Registers of the arguments are free now, and aren't restored.
+    std::array<bool, 16> restored{};
+    for (size_t i = 0; i < savedCount; i++) {
+      restored[i] = !function.isAvailable(savedValues[i].first);
+    }
+    Value result =
+        function.createValue(InstructionGenerator::operandSizeFromBits(
+            getBits(getPrimitiveType(callExpression))));
+    getBackToValue(InstructionGenerator::RETURN_VALUE_REGISTER, result);
+    for (size_t i = 0; i < savedCount; i++) {
+      auto [reg, slot] = savedValues[i];
+      if (restored[i]) {
+        instructions +=
+            instructionGenerator.stackLoad(OperandSize::I64, slot, reg);
+      }
+      function.stackSlots[slot].inUse = false;
+    }
+    return result;
+  }
+
+  bool endsWithJump() const {
+    return instructions.size() > function.bodyBegin &&
+           instructions.back().opcode == Opcode::JMP;
+  }
+
+  void returnValue(const Value &value, bool isSigned) {
+    constexpr Register result = InstructionGenerator::RETURN_VALUE_REGISTER;
+    Register valueRegister =
+        getIntoRegister(value, isSigned, function.returnSize, result);
+    if (valueRegister != result) {
+      instructions += instructionGenerator.move(
+          std::max(value.size, function.returnSize), valueRegister, result);
+    }
+    instructions += instructionGenerator.jump(END_LABEL);
+  }
+
+  // Generates the statements of a function body. Expression values are kept
+  // on a stack rather than being returned from recursive calls.
+  class FunctionBodyPass : public AstPass {
+    CodeGenerator &codeGenerator;
+    Function &function;
+    std::vector<Instruction> &instructions;
+    std::vector<Value> values;
+    // A comparison which should only set the flags, for the branch of the
+    // enclosing if or while statement.
+    AstNode *fusedCondition = nullptr;
+    std::optional<Condition> flags;
+
+    struct IfLabels {
+      Label thenLabel;
+      Label elseLabel;
+      Label endLabel;
+      // Set when the profile shows the else body is hotter, so it becomes
+      // the fall through path and the then body is rotated after it.
+      bool elseFirst = false;
+      size_t thenBegin = 0;
+      size_t elseBegin = 0;
+    };
+    std::vector<IfLabels> ifLabels;
+
+    // The condition is generated first but rotated after the body once the
+    // loop is complete.
+    struct Loop {
+      Label bodyLabel;
+      Label conditionLabel;
+      size_t conditionBegin;
+      size_t bodyBegin = 0;
+    };
+    std::vector<Loop> loops;
+
+    void rotate(size_t begin, size_t middle) {
+      std::rotate(instructions.begin() + static_cast<ptrdiff_t>(begin),
+                  instructions.begin() + static_cast<ptrdiff_t>(middle),
+                  instructions.end());
+    }
+
+    void pushScope() { function.scopes.push_back(function.variables.size()); }
+    void popScope() {
+      size_t scopeBegin = function.scopes.back();
+      function.scopes.pop_back();
+      for (size_t i = scopeBegin; i < function.variables.size(); i++) {
+        function.destroyVariable(function.variables[i].second);
+      }
+      function.variables.resize(scopeBegin);
+    }
+
+    void discardStatementValue() {
+      // Expression statements leave a value which nobody uses.
+      if (!values.empty()) {
+        function.destroyValue(values.back());
+        values.pop_back();
+      }
+    }
+
+    void fuseCondition(AstNode *condition) {
+      if (condition->getNodeType() == AstNodeType::BINARY_EXPRESSION &&
+          isComparison(
+              static_cast<BinaryExpressionNode *>(condition)->getOperator())) {
+        fusedCondition = condition;
+      }
+    }
+
+    // Returns the condition under which the just generated condition is true.
+    Condition takeCondition() {
+      if (flags) {
+        Condition condition = *flags;
+        flags = std::nullopt;
+        return condition;
+      }
+      Value value = values.back();
+      values.pop_back();
+      instructions += codeGenerator.instructionGenerator.test(
+          value.size,
+          codeGenerator.getIntoRegister(value, scratchRegister(0)));
+      function.destroyValue(value);
+      return Condition::NOT_EQUAL;
+    }
+
+    static VariableReferenceNode *
+    getReturnedVariable(const std::vector<std::unique_ptr<AstNode>> &body) {
+      if (body.size() == 1 &&
+          body[0]->getNodeType() == AstNodeType::RETURN_STATEMENT) {
+        AstNode *expression =
+            static_cast<ReturnStatementNode *>(body[0].get())->getExpression();
+        if (expression->getNodeType() == AstNodeType::VARIABLE_REFERENCE) {
+          return static_cast<VariableReferenceNode *>(expression);
+        }
+      }
+      return nullptr;
+    }
+
+    std::optional<Value> findVariable(std::string_view variableName) {
+      for (auto variable = function.variables.rbegin();
+           variable != function.variables.rend(); variable++) {
+        if (variable->first == variableName) {
+          return variable->second;
+        }
+      }
+      return std::nullopt;
+    }
+
+    // Returns one of two variables with a conditional move rather than
+    // branching, if both are in registers.
+    bool generateSelect(IfStatementNode *ifStatement, Condition condition) {
+      VariableReferenceNode *thenVariable =
+          getReturnedVariable(ifStatement->getThenBody());
+      VariableReferenceNode *elseVariable =
+          getReturnedVariable(ifStatement->getElseBody());
+      if (!thenVariable || !elseVariable) {
+        return false;
+      }
+      std::optional<Value> thenValue = findVariable(thenVariable->getName());
+      std::optional<Value> elseValue = findVariable(elseVariable->getName());
+      // Narrower variables would need to be extended first.
+      if (!thenValue || !elseValue || thenValue->size < function.returnSize ||
+          elseValue->size < function.returnSize ||
+          !std::holds_alternative<Register>(thenValue->position) ||
+          !std::holds_alternative<Register>(elseValue->position)) {
+        return false;
+      }
+      Register thenRegister = std::get<Register>(thenValue->position);
+      Register elseRegister = std::get<Register>(elseValue->position);
+      OperandSize size = std::max(thenValue->size, elseValue->size);
+      auto &instructionGenerator = codeGenerator.instructionGenerator;
+      constexpr Register result = InstructionGenerator::RETURN_VALUE_REGISTER;
+      if (elseRegister == result) {
+        instructions += instructionGenerator.moveIf(condition, size,
+                                                    thenRegister, result);
+      } else {
+        instructions += instructionGenerator.move(
+            std::max(size, OperandSize::I32), thenRegister, result);
+        instructions += instructionGenerator.moveIf(
+            InstructionGenerator::invertCondition(condition), size,
+            elseRegister, result);
+      }
+      instructions += instructionGenerator.jump(END_LABEL);
+      return true;
+    }
+
+  public:
+    FunctionBodyPass(CodeGenerator &codeGenerator)
+        : codeGenerator(codeGenerator), function(codeGenerator.function),
+          instructions(codeGenerator.instructions) {
+      onAfterChild<&FunctionBodyPass::afterStatement>();
+      onLeave<&FunctionBodyPass::leaveReturnStatement>();
+      onLeave<&FunctionBodyPass::leaveBinaryExpression>();
+      onLeave<&FunctionBodyPass::leaveVariableReference>();
+      onEnter<&FunctionBodyPass::enterIfStatement>();
+      onAfterChild<&FunctionBodyPass::afterIfStatementChild>();
+      onLeave<&FunctionBodyPass::leaveIfStatement>();
+      onEnter<&FunctionBodyPass::enterWhileStatement>();
+      onAfterChild<&FunctionBodyPass::afterWhileStatementChild>();
+      onLeave<&FunctionBodyPass::leaveWhileStatement>();
+      onLeave<&FunctionBodyPass::leaveVariableDefinition>();
+      onLeave<&FunctionBodyPass::leaveAssignment>();
+      onLeave<&FunctionBodyPass::leaveCallExpression>();
+    }
+
+    void reset() {
+      values.clear();
+      fusedCondition = nullptr;
+      flags = std::nullopt;
+      ifLabels.clear();
+      loops.clear();
+    }
+
+    void afterStatement(FunctionNode *, size_t) { discardStatementValue(); }
+
+    // The then body falls through from the condition, so it is laid out as
+    // the likely path.
+    void enterIfStatement(IfStatementNode *ifStatement) {
+      Label thenLabel = function.createLabel();
+      Label elseLabel = function.createLabel();
+      ifLabels.push_back(
+          IfLabels{thenLabel, elseLabel, function.createLabel()});
+      fuseCondition(ifStatement->getCondition());
+      pushScope();
+    }
+
+    void afterIfStatementChild(IfStatementNode *ifStatement, size_t childIndex) {
+      IfLabels &labels = ifLabels.back();
+      auto &instructionGenerator = codeGenerator.instructionGenerator;
+      bool hasElse = ifStatement->getElseBody().size() > 0;
+      if (childIndex == 0) {
+        Condition condition = takeCondition();
+        if (generateSelect(ifStatement, condition)) {
+          skipRemainingChildren();
+          return;
+        }
+        labels.elseFirst =
+            hasElse && codeGenerator.isHotter(labels.elseLabel, labels.thenLabel);
+        if (labels.elseFirst) {
+          instructions += instructionGenerator.jumpIf(condition, labels.thenLabel);
+          labels.thenBegin = instructions.size();
+          codeGenerator.emitLabel(labels.thenLabel);
+        } else {
+          instructions += instructionGenerator.jumpIf(
+              InstructionGenerator::invertCondition(condition),
+              hasElse ? labels.elseLabel : labels.endLabel);
+          // Only needed to count the block.
+          if (codeGenerator.instrument) {
+            codeGenerator.emitLabel(labels.thenLabel);
+          }
+        }
+      } else {
+        discardStatementValue();
+      }
+      if (hasElse && childIndex == ifStatement->getThenBody().size()) {
+        // The else body gets its own scope, reusing the then body's slots.
+        popScope();
+        pushScope();
+        if (labels.elseFirst) {
+          labels.elseBegin = instructions.size();
+          if (codeGenerator.instrument) {
+            codeGenerator.emitLabel(labels.elseLabel);
+          }
+          return;
+        }
+        if (!codeGenerator.endsWithJump()) {
+          instructions += instructionGenerator.jump(labels.endLabel);
+        }
+        codeGenerator.emitLabel(labels.elseLabel);
+      }
+    }
+
+    void leaveIfStatement(IfStatementNode *) {
+      popScope();
+      IfLabels &labels = ifLabels.back();
+      if (labels.elseFirst) {
+        if (!codeGenerator.endsWithJump()) {
+          instructions +=
+              codeGenerator.instructionGenerator.jump(labels.endLabel);
+        }
+        rotate(labels.thenBegin, labels.elseBegin);
+      }
+      codeGenerator.emitLabel(labels.endLabel);
+      ifLabels.pop_back();
+    }
+
+    // Loops are rotated so that the condition is tested at the bottom, making
+    // the body the fall through path and leaving one branch per iteration.
+    void enterWhileStatement(WhileStatementNode *whileStatement) {
+      Label bodyLabel = function.createLabel();
+      Label conditionLabel = function.createLabel();
+      instructions += codeGenerator.instructionGenerator.jump(conditionLabel);
+      loops.push_back(Loop{bodyLabel, conditionLabel, instructions.size()});
+      codeGenerator.emitLabel(conditionLabel);
+      fuseCondition(whileStatement->getCondition());
+      pushScope();
+    }
+
+    void afterWhileStatementChild(WhileStatementNode *, size_t childIndex) {
+      if (childIndex > 0) {
+        discardStatementValue();
+        return;
+      }
+      Loop &loop = loops.back();
+      instructions += codeGenerator.instructionGenerator.jumpIf(
+          takeCondition(), loop.bodyLabel);
+      loop.bodyBegin = instructions.size();
+      codeGenerator.emitLabel(loop.bodyLabel);
+    }
+
+    void leaveWhileStatement(WhileStatementNode *) {
+      popScope();
+      Loop &loop = loops.back();
+      rotate(loop.conditionBegin, loop.bodyBegin);
+      loops.pop_back();
+    }
+
+    void leaveReturnStatement(ReturnStatementNode *returnStatement) {
+      Value value = values.back();
+      values.pop_back();
+      codeGenerator.returnValue(
+          value, isSigned(getPrimitiveType(returnStatement->getExpression())));
+    }
+
+    void leaveBinaryExpression(BinaryExpressionNode *binaryExpression) {
+      Value right = values.back();
+      values.pop_back();
+      Value left = values.back();
+      values.pop_back();
+      if (binaryExpression == fusedCondition) {
+        fusedCondition = nullptr;
+        flags = codeGenerator.compare(binaryExpression, left, right);
+        function.destroyValue(left);
+        function.destroyValue(right);
+        return;
+      }
       Value result;
+      if (isComparison(binaryExpression->getOperator())) {
+        Condition condition =
+            codeGenerator.compare(binaryExpression, left, right);
+        // Destroy the operands so they can be used as the result value.
+        function.destroyValue(left);
+        function.destroyValue(right);
+        result = function.createValue(OperandSize::I8);
+        Register resultRegister =
+            getResultRegister(result, scratchRegister(0));
+        instructions += codeGenerator.instructionGenerator.setIf(
+            condition, resultRegister);
+        codeGenerator.getBackToValue(resultRegister, result);
+        values.push_back(result);
+        return;
+      }
       switch (binaryExpression->getOperator()) {
       case BinaryOperator::ADD: {
-        result = add(function, left, right, true);
+        result = codeGenerator.add(
+            left, isSigned(getPrimitiveType(binaryExpression->getLeft())),
+            right, isSigned(getPrimitiveType(binaryExpression->getRight())),
+            InstructionGenerator::operandSizeFromBits(
+                getBits(getPrimitiveType(binaryExpression))));
+        break;
+      }
+      case BinaryOperator::CHECKED_ADD:
+      case BinaryOperator::SATURATING_ADD: {
+        PrimitiveTypeType type = getPrimitiveType(binaryExpression);
+        bool isSignedLeft =
+            isSigned(getPrimitiveType(binaryExpression->getLeft()));
+        bool isSignedRight =
+            isSigned(getPrimitiveType(binaryExpression->getRight()));
+        OperandSize size =
+            InstructionGenerator::operandSizeFromBits(getBits(type));
+        result = binaryExpression->getOperator() == BinaryOperator::CHECKED_ADD
+                     ? codeGenerator.checkedAdd(left, isSignedLeft, right,
+                                                isSignedRight, size,
+                                                isSigned(type))
+                     : codeGenerator.saturatingAdd(left, isSignedLeft, right,
+                                                   isSignedRight, size,
+                                                   isSigned(type));
         break;
       }
       default:
         throw std::runtime_error("Not implemented - binary expression");
       }
-      function.destroyValue(left);
-      function.destroyValue(right);
+      values.push_back(result);
+    }
+
+    void leaveVariableReference(VariableReferenceNode *variableReference) {
+      std::optional<Value> variable =
+          findVariable(variableReference->getName());
+      if (!variable) {
+        throw std::runtime_error("Variable not found");
+      }
+      values.push_back(*variable);
+    }
+
+    void leaveVariableDefinition(VariableDefinitionNode *variableDefinition) {
+      OperandSize size = InstructionGenerator::operandSizeFromBits(
+          getBits(getPrimitiveType(variableDefinition)));
+      Value value = codeGenerator.convert(
+          values.back(),
+          isSigned(getPrimitiveType(variableDefinition->getValue())), size);
+      values.pop_back();
+      Value variable;
+      if (!value.variable) {
+        // A temporary becomes the variable without being copied.
+        variable = value;
+        variable.variable = true;
+      } else {
+        variable = function.createValue(size, true);
+        Register valueRegister =
+            codeGenerator.getIntoRegister(value, scratchRegister(0));
+        codeGenerator.getBackToValue(valueRegister, variable);
+      }
+      variable.zeroExtended = isZeroExtended(value);
+      function.variables.emplace_back(variableDefinition->getName(), variable);
+    }
+
+    void leaveAssignment(AssignmentNode *assignment) {
+      Value value = values.back();
+      values.pop_back();
+      std::optional<Value> variable = findVariable(assignment->getName());
+      if (!variable) {
+        throw std::runtime_error("Variable not found");
+      }
+      value = codeGenerator.convert(
+          value, isSigned(getPrimitiveType(assignment->getValue())),
+          variable->size);
+      Register valueRegister =
+          codeGenerator.getIntoRegister(value, scratchRegister(0));
+      if (variable->zeroExtended && !isZeroExtended(value) &&
+          std::holds_alternative<Register>(variable->position)) {
+        // Keeps the upper bits the variable is known to have.
+        instructions += codeGenerator.instructionGenerator.extend(
+            false, value.size, OperandSize::I64,
+            Operand::ofRegister(valueRegister),
+            std::get<Register>(variable->position));
+      } else {
+        codeGenerator.getBackToValue(valueRegister, *variable);
+      }
+      function.destroyValue(value);
+    }
+
+    void leaveCallExpression(CallExpressionNode *callExpression) {
+      size_t argumentsBegin =
+          values.size() - callExpression->getArguments().size();
+      if (FunctionNode *callee =
+              codeGenerator.findInlinedCallee(callExpression)) {
+        Value result = inlineCall(callExpression, callee, argumentsBegin);
+        values.push_back(result);
+        return;
+      }
+      Value result = codeGenerator.call(
+          callExpression,
+          std::span<const Value>(values.data() + argumentsBegin,
+                                 values.size() - argumentsBegin));
+      values.resize(argumentsBegin);
+      values.push_back(result);
+    }
+
+    // Generates the callee's returned expression in place of the call, with
+    // its parameters bound to the arguments converted like a call would.
+    // Temporaries become parameters without being copied, like they become
+    // variables, and are released afterwards unless they are the result.
+    Value inlineCall(CallExpressionNode *callExpression, FunctionNode *callee,
+                     size_t argumentsBegin) {
+      auto &arguments = callExpression->getArguments();
+      auto &parameters = callee->getParameters();
+      std::array<bool, InstructionGenerator::parameterPassingRegisters().size()>
+          temporaries{};
+      size_t variablesBegin = function.variables.size();
+      for (size_t i = 0; i < parameters.size(); i++) {
+        Value parameter = codeGenerator.convert(
+            values[argumentsBegin + i],
+            isSigned(getPrimitiveType(arguments[i].get())),
+            InstructionGenerator::operandSizeFromBits(
+                getBits(static_cast<PrimitiveTypeNode *>(
+                            parameters[i].type.get())
+                            ->getPrimitiveType())));
+        temporaries[i] = !parameter.variable;
+        parameter.variable = true;
+        function.variables.emplace_back(parameters[i].name, parameter);
+      }
+      values.resize(argumentsBegin);
+      AstNode *expression =
+          static_cast<ReturnStatementNode *>(callee->getBody()[0].get())
+              ->getExpression();
+      codeGenerator.inlineTraversal.run(expression, {this});
+      Value value = values.back();
+      values.pop_back();
+      Value result = codeGenerator.convert(
+          value, isSigned(getPrimitiveType(expression)),
+          InstructionGenerator::operandSizeFromBits(
+              getBits(getPrimitiveType(callExpression))));
+      for (size_t i = 0; i < parameters.size(); i++) {
+        const Value &parameter = function.variables[variablesBegin + i].second;
+        if (!temporaries[i]) {
+          continue;
+        }
+        if (parameter.position == result.position) {
+          result.variable = false;
+        } else {
+          function.release(parameter);
+        }
+      }
+      function.variables.resize(variablesBegin);
       return result;
-      break;
     }
-    default:
-      throw std::runtime_error("Unimplemented expression type");
+  };
+  FunctionBodyPass bodyPass{*this};
+
+  // Removes the jumps in [begin, end of buffer) which only skip labels.
+  void removeJumpsToNextInstruction(size_t begin) {
+    size_t output = begin;
+    for (size_t i = begin; i < instructions.size(); i++) {
+      const Instruction &instruction = instructions[i];
+      if (instruction.opcode == Opcode::JMP) {
+        int64_t targetLabel = instruction.operands[0].value;
+        bool jumpsToNextInstruction = false;
+        // Labels don't generate any code, so look past them.
+        for (size_t j = i + 1; j < instructions.size() &&
+                               instructions[j].opcode == Opcode::LABEL;
+             j++) {
+          if (instructions[j].operands[0].value == targetLabel) {
+            jumpsToNextInstruction = true;
+            break;
+          }
+        }
+        if (jumpsToNextInstruction) {
+          continue;
+        }
+      }
+      instructions[output++] = instruction;
     }
+    instructions.resize(output);
   }
 
-  void generateStatement(Function &function, AstNode *node) {
-    switch (node->getNodeType()) {
-    case AstNodeType::RETURN_STATEMENT: {
-      returnValue(
-          function,
-          generateExpression(
-              function,
-              static_cast<ReturnStatementNode *>(node)->getExpression()));
-      break;
+  // Assigns offsets to the stack slots, largest first so that every slot is
+  // naturally aligned without padding, and keeps RSP aligned for calls once
+  // the saved registers have been pushed. A leaf function whose slots fit in
+  // the red zone keeps them below RSP instead, after the saved registers.
+  void layoutStackFrame() {
+    size_t frameSize = 0;
+    for (OperandSize size : {OperandSize::I64, OperandSize::I32,
+                             OperandSize::I16, OperandSize::I8}) {
+      for (StackSlot &slot : function.stackSlots) {
+        if (slot.size == size) {
+          frameSize += InstructionGenerator::getSize(size);
+          slot.offset = -static_cast<ptrdiff_t>(frameSize);
+        }
+      }
     }
-    default:
-      function.destroyValue(generateExpression(function, node));
+    function.hasFramePointer =
+        !function.isLeaf || frameSize > InstructionGenerator::redZoneSize;
+    Register base = Register::RSP;
+    if (function.hasFramePointer) {
+      base = Register::RBP;
+      constexpr size_t alignment = InstructionGenerator::stackAlignmentOnCall;
+      size_t savedSize = function.savedRegisters.get().size() *
+                         InstructionGenerator::registerSize;
+      function.stackAllocationSize =
+          (frameSize + savedSize + alignment - 1) / alignment * alignment -
+          savedSize;
+    }
+    for (size_t i = function.bodyBegin; i < instructions.size(); i++) {
+      Instruction &instruction = instructions[i];
+      for (size_t j = 0; j < instruction.operandCount; j++) {
+        Operand &operand = instruction.operands[j];
+        if (operand.kind == Operand::Kind::STACK_SLOT) {
+          operand =
+              Operand::memory(base, function.stackSlots[operand.value].offset);
+        }
+      }
     }
   }
 
-  Function generateFunction(FunctionNode *node, size_t functionIndex) {
-    Function function;
-    function.name = node->getName();
-    function.labelPrefix = "l" + std::to_string(functionIndex);
-    std::map<std::string, Value> parameters;
+  void generateFunction(FunctionNode *node) {
+    ZIPS_PROBE1(function__begin, node->getName().c_str());
+    function.reset(node->getName(), instructions.size());
+    function.returnSize = InstructionGenerator::operandSizeFromBits(
+        getBits(static_cast<PrimitiveTypeNode *>(
+                    static_cast<FunctionTypeNode *>(node->type->get())
+                        ->getReturnType()
+                        .get())
+                    ->getPrimitiveType()));
+    // Reserve the prolog, which depends on the registers the body uses.
+    instructions.resize(function.bodyBegin);
+    function.scopes.push_back(0);
+    constexpr auto parameterRegisters =
+        InstructionGenerator::parameterPassingRegisters();
+    if (node->getParameters().size() > parameterRegisters.size()) {
+      throw std::runtime_error("Not implemented - arguments on the stack");
+    }
     size_t i = 0;
     for (auto &parameter : node->getParameters()) {
       if (parameter.type->getType() != TypeType::PRIMITIVE) {
         throw std::runtime_error("Not implemented - non-primitive parameters");
       }
-      parameters[parameter.name] = function.createValue(
-          InstructionGenerator::operandSizeFromBits(
-              getBits(static_cast<PrimitiveTypeNode *>(parameter.type.get())
-                          ->getPrimitiveType())),
-          true, InstructionGenerator::parameterPassingRegisters()[i]);
+      function.variables.emplace_back(
+          parameter.name,
+          function.createValue(
+              InstructionGenerator::operandSizeFromBits(
+                  getBits(static_cast<PrimitiveTypeNode *>(parameter.type.get())
+                              ->getPrimitiveType())),
+              true, parameterRegisters[i]));
       i++;
     }
-    function.variables += std::move(parameters);
-    for (auto &statement : node->getBody()) {
-      generateStatement(function, statement.get());
+    if (instrument) {
+      // Counts the function entry; blocks are counted by emitLabel.
+      instructions += instructionGenerator.incrementBlockCounter(0);
     }
-    std::vector<Instruction> actualInstructions =
-        instructionGenerator.generateProlog(function.stackAllocationSize);
-    for (auto &savedRegister : function.savedRegisters) {
-      actualInstructions +=
-          instructionGenerator.generateSaveRegister(savedRegister);
+    bodyPass.reset();
+    traversal.run(node, {&bodyPass});
+    layoutStackFrame();
+    emitLabel(END_LABEL);
+    removeJumpsToNextInstruction(function.bodyBegin);
+    std::span<const Register> savedRegisters = function.savedRegisters.get();
+    size_t prologSize = instructionGenerator.generateProlog(
+        std::span<Instruction, InstructionGenerator::maxPrologSize>(
+            instructions.data() + function.begin,
+            InstructionGenerator::maxPrologSize),
+        function.hasFramePointer, function.stackAllocationSize,
+        savedRegisters);
+    instructionGenerator.generateEpilog(instructions, function.hasFramePointer,
+                                        function.stackAllocationSize,
+                                        savedRegisters);
+    if (function.trapLabel) {
+      emitLabel(*function.trapLabel);
+      instructions += instructionGenerator.trap();
     }
-    actualInstructions += std::move(function.instructions);
-    actualInstructions +=
-        instructionGenerator.generateLabel(function.labelPrefix + "_end");
-    for (auto &savedRegister : function.savedRegisters) {
-      actualInstructions +=
-          instructionGenerator.generateRestoreRegister(savedRegister);
+    generatedFunctions.push_back(GeneratedFunction{
+        node->getName(), function.bodyBegin - prologSize, instructions.size(),
+        function.getBlockCount(),
+        profile ? profile->getFunctionCount(function.name) : 0});
+    size_t instructionCount =
+        generatedFunctions.back().end - generatedFunctions.back().begin;
+    WorkCounters &counters = getWorkCounters();
+    counters.generatedFunctionCount++;
+    counters.instructionCount += instructionCount;
+    ZIPS_PROBE2(function__end, node->getName().c_str(), instructionCount);
+  }
+
+  // The bytes of machine code of instructions [begin, end), with jumps and
+  // calls as wide as encodeFunction leaves them.
+  size_t getEncodedSize(size_t begin, size_t end) {
+    measuredCode.clear();
+    size_t relocationsBegin = relocations.size();
+    for (size_t i = begin; i < end; i++) {
+      InstructionGenerator::encode(instructions[i], measuredCode, relocations);
+    }
+    relocations.resize(relocationsBegin);
+    return measuredCode.size();
+  }
+
+  // Functions with the same instructions, which includes calling the same
+  // functions and using the same labels, share the body of the one whose
+  // name comes first, so the choice doesn't depend on the order of the unit.
+  void foldIdenticalFunctions() {
+    functionHashes.clear();
+    for (size_t i = 0; i < generatedFunctions.size(); i++) {
+      const GeneratedFunction &function = generatedFunctions[i];
+      functionHashes.emplace_back(
+          InstructionGenerator::hash(
+              std::span(instructions.data() + function.begin,
+                        instructions.data() + function.end)),
+          i);
+    }
+    std::sort(functionHashes.begin(), functionHashes.end(),
+              [&](const auto &a, const auto &b) {
+                if (a.first != b.first) {
+                  return a.first < b.first;
+                }
+                return generatedFunctions[a.second].name <
+                       generatedFunctions[b.second].name;
+              });
+    for (size_t groupBegin = 0; groupBegin < functionHashes.size();) {
+      size_t groupEnd = groupBegin + 1;
+      while (groupEnd < functionHashes.size() &&
+             functionHashes[groupEnd].first ==
+                 functionHashes[groupBegin].first) {
+        groupEnd++;
+      }
+      for (size_t i = groupBegin + 1; i < groupEnd; i++) {
+        GeneratedFunction &function =
+            generatedFunctions[functionHashes[i].second];
+        for (size_t j = groupBegin; j < i; j++) {
+          size_t candidateIndex = functionHashes[j].second;
+          const GeneratedFunction &candidate =
+              generatedFunctions[candidateIndex];
+          if (candidate.foldedInto == NO_FUNCTION &&
+              std::equal(instructions.begin() + function.begin,
+                         instructions.begin() + function.end,
+                         instructions.begin() + candidate.begin,
+                         instructions.begin() + candidate.end)) {
+            function.foldedInto = candidateIndex;
+            break;
+          }
+        }
+      }
+      // Linked backwards, so that the aliases are in name order.
+      for (size_t i = groupEnd; i-- > groupBegin + 1;) {
+        size_t index = functionHashes[i].second;
+        GeneratedFunction &function = generatedFunctions[index];
+        if (function.foldedInto != NO_FUNCTION) {
+          GeneratedFunction &target = generatedFunctions[function.foldedInto];
+          function.nextAlias = target.nextAlias;
+          target.nextAlias = index;
+          foldingStatistics.foldedFunctionCount++;
+          foldingStatistics.instructionCount += function.end - function.begin;
+          foldingStatistics.codeBytes +=
+              getEncodedSize(function.begin, function.end);
+        }
+      }
+      groupBegin = groupEnd;
     }
-    actualInstructions +=
-        instructionGenerator.generateEpilog(function.stackAllocationSize);
-    function.instructions = std::move(actualInstructions);
-    return function;
+  }
+
+  void generateInstructions(CompilationUnitNode *node) {
+    instructions.clear();
+    generatedFunctions.clear();
+    symbols.clear();
+    foldingStatistics = {};
+    findInlineCandidates(node);
+    for (auto &function : node->getNodes()) {
+      generateFunction(static_cast<FunctionNode *>(function.get()));
+    }
+    if (profile) {
+      std::stable_sort(generatedFunctions.begin(), generatedFunctions.end(),
+                       [](const GeneratedFunction &a,
+                          const GeneratedFunction &b) {
+                         return a.profileCount > b.profileCount;
+                       });
+    }
+    if (fold && !instrument) {
+      foldIdenticalFunctions();
+    }
+  }
+
+  static void patchDisplacement(std::string &code, size_t position,
+                                size_t target) {
+    uint64_t displacement = target - (position + 4);
+    for (size_t i = 0; i < 4; i++) {
+      code[position + i] = static_cast<char>(displacement >> (i * 8));
+    }
+  }
+
+  // Appends the machine code of instructions [begin, end) to code and
+  // resolves its jumps. Calls are left in relocations until every function
+  // has been placed.
+  void encodeFunction(size_t begin, size_t end, std::string &code) {
+    labelOffsets.clear();
+    size_t endLabelOffset = 0;
+    size_t relocationsBegin = relocations.size();
+    for (size_t i = begin; i < end; i++) {
+      const Instruction &instruction = instructions[i];
+      if (instruction.opcode == Opcode::LABEL) {
+        Label label = static_cast<Label>(instruction.operands[0].value);
+        if (label == END_LABEL) {
+          endLabelOffset = code.size();
+        } else {
+          labelOffsets.resize(std::max<size_t>(labelOffsets.size(), label + 1));
+          labelOffsets[label] = code.size();
+        }
+      }
+      InstructionGenerator::encode(instruction, code, relocations);
+    }
+    size_t keptEnd = relocationsBegin;
+    for (size_t i = relocationsBegin; i < relocations.size(); i++) {
+      const auto &relocation = relocations[i];
+      if (relocation.target.kind != Operand::Kind::LABEL) {
+        relocations[keptEnd++] = relocation;
+        continue;
+      }
+      Label label = static_cast<Label>(relocation.target.value);
+      patchDisplacement(code, relocation.position,
+                        label == END_LABEL ? endLabelOffset
+                                           : labelOffsets[label]);
+    }
+    relocations.resize(keptEnd);
+  }
+
+  // Labels are local to the assembly file, so they never reach the object's
+  // symbol table. Names can't contain ".", so they can't clash.
+  void setLabelPrefix(std::string_view functionName) {
+    labelPrefix = ".L";
+    labelPrefix += functionName;
   }
 
 public:
+  CodeGenerator() = default;
+  // The body pass refers back to its generator.
+  CodeGenerator(const CodeGenerator &) = delete;
+  CodeGenerator &operator=(const CodeGenerator &) = delete;
+
+  // Adds block counters which runtime/profile.c writes out at exit.
+  void setInstrumentation(bool instrument) { this->instrument = instrument; }
+  // Prints functions with identical bodies once, with the others as aliases
+  // of it. Instrumented functions are never folded, since each needs its own
+  // counters.
+  void setFolding(bool fold) { this->fold = fold; }
+  const FoldingStatistics &getFoldingStatistics() const {
+    return foldingStatistics;
+  }
+  // Orders functions hot first, lays out blocks and inlines small hot
+  // callees using the profile.
+  void setProfile(std::optional<Profile> profile) {
+    this->profile = std::move(profile);
+  }
+
   std::string generate(CompilationUnitNode *node) {
-    std::vector<Function> functions;
-    size_t functionIndex = 0;
-    for (auto &function : node->getNodes()) {
-      functions.push_back(generateFunction(
-          static_cast<FunctionNode *>(function.get()), functionIndex++));
-    }
-    std::string result =
-        instructionGenerator.generateFileHeader(node->getLocation().file) +
-        "\n";
-    for (auto &function : functions) {
-      result +=
-          instructionGenerator.generateFunctionHeader(function.name) + "\n";
-      for (auto &instruction : function.instructions) {
-        result += "\t" + instruction.toString() + "\n";
-      }
-      result +=
-          instructionGenerator.generateFunctionFooter(function.name) + "\n";
-    }
-    result += instructionGenerator.generateFileFooter();
+    std::string result;
+    generate(node, result);
     return result;
   }
+
+  // Appends to result so that callers can reuse its capacity.
+  void generate(CompilationUnitNode *node, std::string &result) {
+    generateInstructions(node);
+    MemoryCategoryScope category(MemoryCategory::OUTPUT);
+    instructionGenerator.generateFileHeader(node->getLocation().file, result);
+    // Everything of a function, its profile record included, is printed
+    // together, so identical functions print identically wherever they are.
+    for (auto &function : generatedFunctions) {
+      if (function.foldedInto != NO_FUNCTION) {
+        continue;
+      }
+      setLabelPrefix(function.name);
+      instructionGenerator.generateFunctionHeader(function.name, result);
+      for (size_t i = function.begin; i < function.end; i++) {
+        InstructionGenerator::format(instructions[i], labelPrefix, result,
+                                     symbols);
+      }
+      instructionGenerator.generateFunctionFooter(function.name, result);
+      for (size_t alias = function.nextAlias; alias != NO_FUNCTION;
+           alias = generatedFunctions[alias].nextAlias) {
+        instructionGenerator.generateFunctionAlias(
+            generatedFunctions[alias].name, function.name, result);
+      }
+      if (instrument) {
+        instructionGenerator.generateProfileRecord(
+            labelPrefix, function.name, function.blockCount, result);
+      }
+    }
+    instructionGenerator.generateFileFooter(result);
+  }
+
+  // Appends a static executable of the unit instead of assembly, see elf.h.
+  // It starts by calling entryFunction with the command line arguments, see
+  // generateStart. Without a linker, the unit must define every function it
+  // calls.
+  void generateExecutable(CompilationUnitNode *node,
+                          std::string_view entryFunction,
+                          std::string &result) {
+    if constexpr (arch != TargetArchitecture::X86_64 ||
+                  abi != TargetAbi::X86_64) {
+      throw std::runtime_error("Not implemented - executables for the target");
+    }
+    if (instrument) {
+      throw std::runtime_error("Not implemented - instrumented executables");
+    }
+    auto &nodes = node->getNodes();
+    auto entry = std::find_if(nodes.begin(), nodes.end(), [&](auto &function) {
+      return static_cast<FunctionNode *>(function.get())->getName() ==
+             entryFunction;
+    });
+    if (entry == nodes.end()) {
+      throw std::runtime_error("Entry function " + std::string(entryFunction) +
+                               " not found");
+    }
+    generateInstructions(node);
+    size_t startBegin = instructions.size();
+    instructionGenerator.generateStart(
+        instructions,
+        static_cast<FunctionNode *>(entry->get())->getParameters().size(),
+        getSymbol(entryFunction));
+    MemoryCategoryScope category(MemoryCategory::OUTPUT);
+    size_t imageBegin = result.size();
+    result.resize(imageBegin + elfHeadersSize);
+    relocations.clear();
+    encodeFunction(startBegin, instructions.size(), result);
+    functionOffsets.assign(generatedFunctions.size(), 0);
+    for (size_t i = 0; i < generatedFunctions.size(); i++) {
+      const GeneratedFunction &function = generatedFunctions[i];
+      if (function.foldedInto == NO_FUNCTION) {
+        functionOffsets[i] = result.size();
+        encodeFunction(function.begin, function.end, result);
+      }
+    }
+    for (const auto &relocation : relocations) {
+      std::string_view name = symbols[relocation.target.value];
+      auto function = std::find_if(
+          generatedFunctions.begin(), generatedFunctions.end(),
+          [&](const GeneratedFunction &function) {
+            return function.name == name;
+          });
+      if (function == generatedFunctions.end()) {
+        throw std::runtime_error(
+            "Not implemented - calling " + std::string(name) +
+            " from another unit in an executable, which isn't linked");
+      }
+      size_t index = function->foldedInto != NO_FUNCTION
+                         ? function->foldedInto
+                         : static_cast<size_t>(function -
+                                               generatedFunctions.begin());
+      patchDisplacement(result, relocation.position, functionOffsets[index]);
+    }
+    writeElfHeaders(std::span<char>(result.data() + imageBegin,
+                                    result.size() - imageBegin),
+                    elfHeadersSize);
+  }
 };
+
+// The compiler only targets System V, so the Microsoft x64 generator is
+// instantiated in compiler.cpp to keep it compiling.
+extern template class CodeGenerator<TargetArchitecture::X86_64,
+                                    TargetAbi::MS_X64>;
 } // namespace zips
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,68 @@
+#ifndef ZIPS_ELF_H
+#define ZIPS_ELF_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace zips {
+/**
+ * @brief the headers of a static x86-64 Linux executable.
+ *
+ * The whole file, headers included, is loaded as one readable and executable
+ * segment at elfBaseAddress, so there are no sections and nothing to
+ * relocate: the code follows the headers directly. A second program header
+ * asks for a non-executable stack.
+ */
+constexpr uint64_t elfBaseAddress = 0x400000;
+constexpr size_t elfFileHeaderSize = 64;
+constexpr size_t elfProgramHeaderSize = 56;
+constexpr size_t elfProgramHeaderCount = 2;
+constexpr size_t elfHeadersSize =
+    elfFileHeaderSize + elfProgramHeaderCount * elfProgramHeaderSize;
+
+// Fills the first elfHeadersSize bytes of image, which is the whole file,
+// so that the process starts at entryOffset from the start of the file.
+inline void writeElfHeaders(std::span<char> image, size_t entryOffset) {
+  auto put = [&](size_t offset, uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+      image[offset + i] = static_cast<char>(value >> (i * 8));
+    }
+  };
+  std::fill(image.begin(), image.begin() + elfHeadersSize, '\0');
+  // Magic, 64-bit, little endian, version 1, System V ABI.
+  put(0, 0x7f, 1);
+  put(1, 'E', 1);
+  put(2, 'L', 1);
+  put(3, 'F', 1);
+  put(4, 2, 1);
+  put(5, 1, 1);
+  put(6, 1, 1);
+  put(16, 2, 2);  // ET_EXEC
+  put(18, 62, 2); // EM_X86_64
+  put(20, 1, 4);
+  put(24, elfBaseAddress + entryOffset, 8);
+  put(32, elfFileHeaderSize, 8);
+  put(52, elfFileHeaderSize, 2);
+  put(54, elfProgramHeaderSize, 2);
+  put(56, elfProgramHeaderCount, 2);
+  put(58, 64, 2);
+
+  size_t load = elfFileHeaderSize;
+  put(load, 1, 4);     // PT_LOAD
+  put(load + 4, 5, 4); // PF_R | PF_X
+  put(load + 16, elfBaseAddress, 8);
+  put(load + 24, elfBaseAddress, 8);
+  put(load + 32, image.size(), 8);
+  put(load + 40, image.size(), 8);
+  put(load + 48, 0x1000, 8);
+
+  size_t stack = load + elfProgramHeaderSize;
+  put(stack, 0x6474e551, 4); // PT_GNU_STACK
+  put(stack + 4, 6, 4);      // PF_R | PF_W
+  put(stack + 48, 16, 8);
+}
+} // namespace zips
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef ZIPS_PROFILE_H
+#define ZIPS_PROFILE_H
+
+#include <cstdint>
+#include <istream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace zips {
+/**
+ * @brief block execution counts of a program built with --instrument.
+ *
+ * Each line holds a function name followed by the number of times each of
+ * its blocks ran. Block 0 is the function entry, and block n starts at the
+ * function's label with suffix n - 1. The runtime appends a line per function
+ * on every run, so lines for the same function are summed.
+ */
+class Profile {
+  std::unordered_map<std::string, std::vector<uint64_t>> blockCounts;
+
+public:
+  // Returns nothing if the profile is malformed.
+  static std::optional<Profile> read(std::istream &input) {
+    Profile profile;
+    std::string line;
+    while (std::getline(input, line)) {
+      std::istringstream fields(line);
+      std::string functionName;
+      if (!(fields >> functionName)) {
+        continue;
+      }
+      std::vector<uint64_t> &counts = profile.blockCounts[functionName];
+      uint64_t count;
+      for (size_t block = 0; fields >> count; block++) {
+        if (block >= counts.size()) {
+          counts.resize(block + 1);
+        }
+        counts[block] += count;
+      }
+      if (!fields.eof()) {
+        return std::nullopt;
+      }
+    }
+    return profile;
+  }
+
+  uint64_t getBlockCount(const std::string &functionName, size_t block) const {
+    auto counts = blockCounts.find(functionName);
+    if (counts == blockCounts.end() || block >= counts->second.size()) {
+      return 0;
+    }
+    return counts->second[block];
+  }
+  uint64_t getFunctionCount(const std::string &functionName) const {
+    return getBlockCount(functionName, 0);
+  }
+};
+} // namespace zips
+
+#endif
@@ -0,0 +1,169 @@
+#include "compiler.h"
+#include "handParser.h"
+#include "lexer.h"
+#include "memoryUsage.h"
+#include "parser.hh"
+#include "typeCheck.h"
+#include <iostream>
+#include <set>
+
+namespace zips {
+template class CodeGenerator<TargetArchitecture::X86_64, TargetAbi::MS_X64>;
+
+Compiler::Compiler(DiagnosticHandler diagnosticHandler)
+    : diagnosticHandler(std::move(diagnosticHandler)), input(&inputBuffer) {}
+Compiler::~Compiler() {}
+
+bool Compiler::compile(std::string_view source, std::string_view fileName) {
+  return run(source, fileName, true);
+}
+
+bool Compiler::check(std::string_view source, std::string_view fileName) {
+  return run(source, fileName, false);
+}
+
+bool Compiler::run(std::string_view source, std::string_view fileName,
+                   bool generateCode) {
+  bool succeeded;
+  {
+    DiagnosticScope diagnosticScope(&diagnostics);
+    succeeded = compileUnit(source, fileName, generateCode) &&
+                diagnostics.getErrorCount() == 0;
+  }
+  return flushDiagnostics(succeeded);
+}
+
+bool Compiler::compile(std::unique_ptr<CompilationUnitNode> unit) {
+  bool succeeded;
+  {
+    DiagnosticScope diagnosticScope(&diagnostics);
+    output.clear();
+    ast = std::move(unit);
+    succeeded = generate() && diagnostics.getErrorCount() == 0;
+  }
+  return flushDiagnostics(succeeded);
+}
+
+bool Compiler::parse(std::string_view source, std::string_view fileName) {
+  bool succeeded;
+  {
+    DiagnosticScope diagnosticScope(&diagnostics);
+    succeeded =
+        parseUnit(source, fileName) && diagnostics.getErrorCount() == 0;
+  }
+  return flushDiagnostics(succeeded);
+}
+
+bool Compiler::checkAndCompile(std::unique_ptr<CompilationUnitNode> unit) {
+  bool succeeded;
+  {
+    DiagnosticScope diagnosticScope(&diagnostics);
+    output.clear();
+    ast = std::move(unit);
+    succeeded = checkUnit(true) && diagnostics.getErrorCount() == 0;
+  }
+  return flushDiagnostics(succeeded);
+}
+
+bool Compiler::flushDiagnostics(bool succeeded) {
+  if (diagnosticHandler) {
+    diagnostics.flush(diagnosticHandler);
+  } else if (!diagnostics.empty()) {
+    diagnostics.flush(*diagnosticOutput);
+  }
+  return succeeded;
+}
+
+bool Compiler::compileUnit(std::string_view source, std::string_view fileName,
+                           bool generateCode) {
+  return parseUnit(source, fileName) && checkUnit(generateCode);
+}
+
+bool Compiler::parseUnit(std::string_view source, std::string_view fileName) {
+  this->fileName = fileName;
+  inputBuffer.reset(source);
+  input.clear();
+  if (lexer) {
+    lexer->reset(input, this->fileName);
+  } else {
+    lexer = std::make_unique<Lexer>(input, this->fileName);
+  }
+  output.clear();
+  ast.reset();
+  {
+    MemoryPhaseScope phase(MemoryPhase::PARSING);
+    if (parserKind == ParserKind::HAND_WRITTEN) {
+      ast = HandParser(*lexer, this->fileName).parse();
+      return ast != nullptr;
+    }
+    Parser parser(*lexer, this->fileName, &ast, parserLists);
+    int result = parser();
+    // Lists which error recovery discarded may be left.
+    parserLists.clear();
+    if (result != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Compiler::checkUnit(bool generateCode) {
+  try {
+    MemoryPhaseScope phase(MemoryPhase::TYPE_CHECKING);
+    // The interfaces are only needed while checking; calls keep copies of
+    // the signatures.
+    std::vector<std::shared_ptr<const ModuleInterface>> interfaces;
+    std::set<std::string_view> importedModules;
+    Context context;
+    for (auto &import : getAst()->getImports()) {
+      if (!importedModules.insert(import.moduleName).second) {
+        continue;
+      }
+      std::shared_ptr<const ModuleInterface> interface =
+          importResolver ? importResolver(import.moduleName) : nullptr;
+      if (!interface) {
+        error(import.location, DiagnosticId::MODULE_NOT_FOUND,
+              {import.moduleName});
+        continue;
+      }
+      context.addImport(*interface, import.location);
+      interfaces.push_back(std::move(interface));
+    }
+    context.entryPoints = entryPoints;
+    checkTypes(getAst(), context);
+    if (!entryPoints.empty()) {
+      removeUnreachableFunctions(getAst(), context);
+    }
+  } catch (const ZipsError &e) {
+    error(e);
+    return false;
+  } catch (std::runtime_error &e) {
+    error(ast->getLocation().file, ast->getLocation().line,
+          ast->getLocation().column, e.what());
+    return false;
+  }
+  if (diagnostics.getErrorCount() > 0) {
+    return false;
+  }
+  return !generateCode || generate();
+}
+
+bool Compiler::generate() {
+  try {
+    MemoryPhaseScope phase(MemoryPhase::CODE_GENERATION);
+    if (executableEntry.empty()) {
+      codeGenerator.generate(getAst(), output);
+    } else {
+      codeGenerator.generateExecutable(getAst(), executableEntry, output);
+    }
+  } catch (const ZipsError &e) {
+    error(e);
+    return false;
+  } catch (std::runtime_error &e) {
+    error(ast->getLocation().file, ast->getLocation().line,
+          ast->getLocation().column, e.what());
+    return false;
+  }
+  return true;
+}
+} // namespace zips
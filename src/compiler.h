@@ -0,0 +1,157 @@
+#ifndef ZIPS_COMPILER_H
+#define ZIPS_COMPILER_H
+
+#include "ast.h"
+#include "codegen/codegen.h"
+#include "diagnostics.h"
+#include "error.h"
+#include "moduleInterface.h"
+#include "parserLists.h"
+#include <functional>
+#include <iostream>
+#include <istream>
+#include <memory>
+#include <optional>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace zips {
+class Lexer;
+
+// Reads from a caller-owned buffer without copying it.
+class MemoryBuffer : public std::streambuf {
+public:
+  void reset(std::string_view source) {
+    char *begin = const_cast<char *>(source.data());
+    setg(begin, begin, begin + source.size());
+  }
+};
+
+enum class ParserKind {
+  BISON,
+  // See handParser.h.
+  HAND_WRITTEN
+};
+
+// Returns the interface of an imported module, or null if it can't be found.
+using ImportResolver = std::function<std::shared_ptr<const ModuleInterface>(
+    const std::string &moduleName)>;
+
+/**
+ * @brief a reusable compilation session.
+ *
+ * The lexer, input stream and output buffer are kept between calls to
+ * compile, so compiling many small sources doesn't reallocate them each time.
+ * Diagnostics are collected while compiling and passed to the handler
+ * afterwards, or printed to the diagnostic output if there is no handler.
+ */
+class Compiler {
+  DiagnosticHandler diagnosticHandler;
+  DiagnosticEngine diagnostics;
+  std::ostream *diagnosticOutput = &std::cout;
+  ImportResolver importResolver;
+  std::vector<std::string> entryPoints;
+#ifdef ZIPS_HAND_WRITTEN_PARSER
+  ParserKind parserKind = ParserKind::HAND_WRITTEN;
+#else
+  ParserKind parserKind = ParserKind::BISON;
+#endif
+  std::string fileName;
+  MemoryBuffer inputBuffer;
+  std::istream input;
+  std::unique_ptr<Lexer> lexer;
+  ParserLists parserLists;
+  std::unique_ptr<AstNode> ast;
+  CodeGenerator<TargetArchitecture::X86_64, TargetAbi::X86_64> codeGenerator;
+  std::string executableEntry;
+  std::string output;
+
+  bool run(std::string_view source, std::string_view fileName,
+           bool generateCode);
+  bool compileUnit(std::string_view source, std::string_view fileName,
+                   bool generateCode);
+  bool parseUnit(std::string_view source, std::string_view fileName);
+  bool checkUnit(bool generateCode);
+  bool generate();
+  bool flushDiagnostics(bool succeeded);
+
+public:
+  Compiler(DiagnosticHandler diagnosticHandler = {});
+  ~Compiler();
+
+  void setDiagnosticHandler(DiagnosticHandler handler) {
+    diagnosticHandler = std::move(handler);
+  }
+
+  // Used to configure the format and limit of printed diagnostics.
+  DiagnosticEngine &getDiagnostics() { return diagnostics; }
+  void setDiagnosticOutput(std::ostream &output) {
+    diagnosticOutput = &output;
+  }
+
+  // Without a resolver, units with imports fail to type check.
+  void setImportResolver(ImportResolver resolver) {
+    importResolver = std::move(resolver);
+  }
+
+  // Only the entry points and the functions they call are checked and
+  // compiled; the others are left out of the AST and the output. Without
+  // entry points, every function is one.
+  void setEntryPoints(std::vector<std::string> entryPoints) {
+    this->entryPoints = std::move(entryPoints);
+  }
+
+  // Both parsers build the same AST and report the same syntax errors. The
+  // default is chosen at build time, with ZIPS_HAND_WRITTEN_PARSER.
+  void setParserKind(ParserKind kind) { parserKind = kind; }
+
+  // Adds block counters to the output, see runtime/profile.c.
+  void setInstrumentation(bool instrument) {
+    codeGenerator.setInstrumentation(instrument);
+  }
+  // Uses the counters of an instrumented build to lay out the output and
+  // inline hot calls.
+  void setProfile(std::optional<Profile> profile) {
+    codeGenerator.setProfile(std::move(profile));
+  }
+  // On by default.
+  void setFolding(bool fold) { codeGenerator.setFolding(fold); }
+  const FoldingStatistics &getFoldingStatistics() const {
+    return codeGenerator.getFoldingStatistics();
+  }
+  // Makes the output a static executable which runs the given function,
+  // rather than assembly, see CodeGenerator::generateExecutable. An empty
+  // name goes back to assembly.
+  void setExecutableEntry(std::string function) {
+    executableEntry = std::move(function);
+  }
+
+  // Returns false if any errors were reported.
+  bool compile(std::string_view source, std::string_view fileName = "<memory>");
+  // Parses and type checks without generating code, for example to run the
+  // AST with BytecodeInterpreter.
+  bool check(std::string_view source, std::string_view fileName = "<memory>");
+  // Generates code for an AST type checked earlier, such as one loaded from
+  // an AST cache.
+  bool compile(std::unique_ptr<CompilationUnitNode> unit);
+  // Only parses, so that the imports can be found before compiling the AST
+  // with checkAndCompile.
+  bool parse(std::string_view source, std::string_view fileName = "<memory>");
+  bool checkAndCompile(std::unique_ptr<CompilationUnitNode> unit);
+
+  // Only valid until the next call to compile. Executables are binary.
+  std::string_view getOutput() const { return output; }
+  // The type checked AST of the last compile, or null if it failed to parse.
+  CompilationUnitNode *getAst() const {
+    return static_cast<CompilationUnitNode *>(ast.get());
+  }
+  std::unique_ptr<CompilationUnitNode> takeAst() {
+    return std::unique_ptr<CompilationUnitNode>(
+        static_cast<CompilationUnitNode *>(ast.release()));
+  }
+};
+} // namespace zips
+
+#endif
@@ -0,0 +1,258 @@
+#include "diagnostics.h"
+#include <iostream>
+
+namespace zips {
+static const char *const diagnosticFormats[] = {
+    "{0}",
+    "Performing binary operator {0} with types of different signedness: {1} "
+    "and {2}",
+    "Converting from {0} to {1} changes signedness",
+    "Converting from {0} to {1} loses precision",
+    "Undefined identifier {0}",
+    "Incompatible types for binary operator {0}: {1} and {2}",
+    "Cannot execute binary expression on functions",
+    "Can't convert {0} to {1}",
+    "Converting of function types not yet supported",
+    "Function {0} doesn't return a value",
+    "Condition must be a bool, not {0}",
+    "Not every path through function {0} returns a value",
+    "Undefined function {0}",
+    "Function {0} takes {1} arguments, not {2}",
+    "Return type of function {0} is needed before it is known; declare it",
+    "Function {0} is already defined",
+    "Can't find the interface of module {0}",
+    "Entry point {0} isn't a function of this module",
+    "{0} more diagnostics suppressed",
+};
+
+static thread_local DiagnosticEngine *currentEngine = nullptr;
+
+DiagnosticScope::DiagnosticScope(DiagnosticEngine *engine)
+    : previousEngine(currentEngine) {
+  currentEngine = engine;
+}
+DiagnosticScope::~DiagnosticScope() { currentEngine = previousEngine; }
+
+static void writeText(std::ostream &output, const Diagnostic &diagnostic) {
+  output << diagnostic.file << ":" << diagnostic.line << ":"
+         << diagnostic.column << ":" << std::endl;
+  if (diagnostic.severity == DiagnosticSeverity::ERROR) {
+    output << "Error: " << diagnostic.message << std::endl;
+  } else {
+    output << "Warning: " << diagnostic.message << std::endl;
+  }
+}
+
+static void writeJsonString(std::ostream &output, std::string_view string) {
+  static const char hexDigits[] = "0123456789abcdef";
+  output << '"';
+  for (char c : string) {
+    switch (c) {
+    case '"':
+      output << "\\\"";
+      break;
+    case '\\':
+      output << "\\\\";
+      break;
+    case '\n':
+      output << "\\n";
+      break;
+    case '\t':
+      output << "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        output << "\\u00" << hexDigits[(c >> 4) & 0xf] << hexDigits[c & 0xf];
+      } else {
+        output << c;
+      }
+    }
+  }
+  output << '"';
+}
+
+void report(DiagnosticSeverity severity, DiagnosticId id,
+            const std::string &file, size_t line, size_t column,
+            std::initializer_list<DiagnosticArgument> arguments) {
+  if (currentEngine) {
+    currentEngine->report(severity, id, file, line, column, arguments);
+  } else {
+    writeText(std::cout, DiagnosticEngine::format(severity, id, file, line,
+                                                  column, arguments));
+  }
+}
+
+size_t DiagnosticEngine::RecordHash::operator()(const Record &record) const {
+  size_t hash = static_cast<size_t>(record.id) |
+                static_cast<size_t>(record.severity) << 16;
+  auto combine = [&](size_t value) {
+    hash ^= value + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+  };
+  combine(record.file);
+  combine(record.line);
+  combine(record.column);
+  for (auto &argument : record.arguments) {
+    combine(static_cast<size_t>(argument.kind) << 32 | argument.value);
+  }
+  return hash;
+}
+
+uint32_t DiagnosticEngine::intern(std::string_view string) {
+  // Most strings are file names, which were interned before.
+  auto found = stringIndices.find(string);
+  if (found != stringIndices.end()) {
+    return found->second;
+  }
+  auto index = static_cast<uint32_t>(strings.size());
+  strings.emplace_back(string);
+  stringIndices.emplace(strings.back(), index);
+  return index;
+}
+
+DiagnosticEngine::StoredArgument
+DiagnosticEngine::store(const DiagnosticArgument &argument) {
+  if (auto primitiveType = std::get_if<PrimitiveTypeType>(&argument.value)) {
+    return {ArgumentKind::PRIMITIVE_TYPE,
+            static_cast<uint32_t>(*primitiveType)};
+  } else if (auto operatorType = std::get_if<BinaryOperator>(&argument.value)) {
+    return {ArgumentKind::OPERATOR, static_cast<uint32_t>(*operatorType)};
+  } else if (auto type = std::get_if<Type *>(&argument.value)) {
+    if ((*type)->getType() == TypeType::PRIMITIVE) {
+      return {ArgumentKind::PRIMITIVE_TYPE,
+              static_cast<uint32_t>(static_cast<PrimitiveTypeNode *>(*type)
+                                        ->getPrimitiveType())};
+    }
+    return {ArgumentKind::STRING, intern((*type)->toString())};
+  } else {
+    return {ArgumentKind::STRING,
+            intern(std::get<std::string_view>(argument.value))};
+  }
+}
+
+void DiagnosticEngine::report(
+    DiagnosticSeverity severity, DiagnosticId id, const std::string &file,
+    size_t line, size_t column,
+    std::initializer_list<DiagnosticArgument> arguments) {
+  if (severity == DiagnosticSeverity::ERROR) {
+    errorCount++;
+  }
+  Record record{id,
+                severity,
+                intern(file),
+                static_cast<uint32_t>(line),
+                static_cast<uint32_t>(column),
+                {}};
+  size_t i = 0;
+  for (auto &argument : arguments) {
+    if (i == record.arguments.size()) {
+      break;
+    }
+    record.arguments[i++] = store(argument);
+  }
+  // Repeats are dropped before the limit, so only new diagnostics count as
+  // suppressed.
+  if (!seen.insert(record).second) {
+    return;
+  }
+  if (limit != 0 && records.size() >= limit) {
+    suppressed++;
+    return;
+  }
+  records.push_back(record);
+}
+
+std::string
+DiagnosticEngine::formatArgument(const StoredArgument &argument) const {
+  switch (argument.kind) {
+  case ArgumentKind::PRIMITIVE_TYPE:
+    return primitiveTypeTypeToString[static_cast<PrimitiveTypeType>(
+        argument.value)];
+  case ArgumentKind::OPERATOR:
+    return binaryOperatorToString[static_cast<BinaryOperator>(argument.value)];
+  case ArgumentKind::STRING:
+    return strings[argument.value];
+  case ArgumentKind::NONE:
+    break;
+  }
+  return "";
+}
+
+std::string DiagnosticEngine::formatMessage(const Record &record) const {
+  std::string result;
+  for (const char *c = diagnosticFormats[static_cast<size_t>(record.id)]; *c;
+       c++) {
+    if (c[0] == '{' && c[1] >= '0' && c[1] <= '2' && c[2] == '}') {
+      result += formatArgument(record.arguments[c[1] - '0']);
+      c += 2;
+    } else {
+      result += *c;
+    }
+  }
+  return result;
+}
+
+Diagnostic DiagnosticEngine::toDiagnostic(const Record &record) const {
+  return Diagnostic{record.severity, record.id,   strings[record.file],
+                    record.line,     record.column, formatMessage(record)};
+}
+
+Diagnostic DiagnosticEngine::format(
+    DiagnosticSeverity severity, DiagnosticId id, const std::string &file,
+    size_t line, size_t column,
+    std::initializer_list<DiagnosticArgument> arguments) {
+  DiagnosticEngine engine;
+  engine.report(severity, id, file, line, column, arguments);
+  return engine.toDiagnostic(engine.records.front());
+}
+
+void DiagnosticEngine::flush(std::ostream &output) {
+  if (outputFormat == Format::JSON) {
+    output << "{\"diagnostics\": [";
+    for (size_t i = 0; i < records.size(); i++) {
+      Diagnostic diagnostic = toDiagnostic(records[i]);
+      output << (i > 0 ? ",\n  " : "\n  ") << "{\"severity\": "
+             << (diagnostic.severity == DiagnosticSeverity::ERROR
+                     ? "\"error\""
+                     : "\"warning\"")
+             << ", \"id\": " << static_cast<unsigned>(diagnostic.id)
+             << ", \"file\": ";
+      writeJsonString(output, diagnostic.file);
+      output << ", \"line\": " << diagnostic.line
+             << ", \"column\": " << diagnostic.column << ", \"message\": ";
+      writeJsonString(output, diagnostic.message);
+      output << "}";
+    }
+    output << (records.empty() ? "" : "\n") << "], \"suppressed\": "
+           << suppressed << "}" << std::endl;
+  } else {
+    for (auto &record : records) {
+      writeText(output, toDiagnostic(record));
+    }
+    if (suppressed > 0) {
+      output << suppressed << " more diagnostics suppressed" << std::endl;
+    }
+  }
+  clear();
+}
+
+void DiagnosticEngine::flush(const DiagnosticHandler &handler) {
+  for (auto &record : records) {
+    handler(toDiagnostic(record));
+  }
+  if (suppressed > 0) {
+    handler(format(DiagnosticSeverity::WARNING,
+                   DiagnosticId::DIAGNOSTICS_SUPPRESSED, "", 0, 0,
+                   {std::to_string(suppressed)}));
+  }
+  clear();
+}
+
+void DiagnosticEngine::clear() {
+  records.clear();
+  seen.clear();
+  strings.clear();
+  stringIndices.clear();
+  suppressed = 0;
+  errorCount = 0;
+}
+} // namespace zips
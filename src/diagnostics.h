@@ -0,0 +1,168 @@
+#ifndef ZIPS_DIAGNOSTICS_H
+#define ZIPS_DIAGNOSTICS_H
+
+#include "ast.h"
+#include "type.h"
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+namespace zips {
+enum class DiagnosticSeverity : uint8_t { ERROR, WARNING };
+
+enum class DiagnosticId : uint16_t {
+  MESSAGE,
+  BINARY_OPERATOR_SIGNEDNESS,
+  CONVERSION_CHANGES_SIGNEDNESS,
+  CONVERSION_LOSES_PRECISION,
+  UNDEFINED_IDENTIFIER,
+  INCOMPATIBLE_BINARY_OPERANDS,
+  BINARY_OPERATOR_ON_FUNCTIONS,
+  INCOMPATIBLE_CONVERSION,
+  FUNCTION_CONVERSION,
+  MISSING_RETURN_VALUE,
+  CONDITION_NOT_BOOL,
+  NOT_ALL_PATHS_RETURN,
+  UNDEFINED_FUNCTION,
+  WRONG_ARGUMENT_COUNT,
+  UNKNOWN_RETURN_TYPE,
+  DUPLICATE_FUNCTION,
+  MODULE_NOT_FOUND,
+  UNDEFINED_ENTRY_POINT,
+  DIAGNOSTICS_SUPPRESSED
+};
+
+// A formatted diagnostic, as passed to a DiagnosticHandler.
+struct Diagnostic {
+  DiagnosticSeverity severity;
+  DiagnosticId id;
+  std::string file;
+  size_t line;
+  size_t column;
+  std::string message;
+};
+
+using DiagnosticHandler = std::function<void(const Diagnostic &)>;
+
+struct DiagnosticArgument {
+  std::variant<PrimitiveTypeType, BinaryOperator, Type *, std::string_view>
+      value;
+
+  DiagnosticArgument(PrimitiveTypeType type) : value(type) {}
+  DiagnosticArgument(BinaryOperator operatorType) : value(operatorType) {}
+  DiagnosticArgument(Type *type) : value(type) {}
+  DiagnosticArgument(std::string_view text) : value(text) {}
+  DiagnosticArgument(const std::string &text) : value(text) {}
+};
+
+/**
+ * @brief collects diagnostics as compact records and emits them in a batch.
+ *
+ * Messages are only formatted when the diagnostics are emitted. Repeats of the
+ * same diagnostic at the same location are dropped, and once the limit is
+ * reached further diagnostics are only counted.
+ */
+class DiagnosticEngine {
+public:
+  enum class Format { TEXT, JSON };
+
+private:
+  enum class ArgumentKind : uint8_t { NONE, PRIMITIVE_TYPE, OPERATOR, STRING };
+  struct StoredArgument {
+    ArgumentKind kind = ArgumentKind::NONE;
+    uint32_t value = 0;
+
+    bool operator==(const StoredArgument &) const = default;
+  };
+  struct Record {
+    DiagnosticId id;
+    DiagnosticSeverity severity;
+    uint32_t file;
+    uint32_t line;
+    uint32_t column;
+    std::array<StoredArgument, 3> arguments;
+
+    bool operator==(const Record &) const = default;
+  };
+  struct RecordHash {
+    size_t operator()(const Record &record) const;
+  };
+
+  std::vector<Record> records;
+  std::unordered_set<Record, RecordHash> seen;
+  // A deque, so the keys of stringIndices can view its strings.
+  std::deque<std::string> strings;
+  std::unordered_map<std::string_view, uint32_t> stringIndices;
+  size_t limit = 0;
+  size_t suppressed = 0;
+  size_t errorCount = 0;
+  Format outputFormat = Format::TEXT;
+
+  uint32_t intern(std::string_view string);
+  StoredArgument store(const DiagnosticArgument &argument);
+  std::string formatArgument(const StoredArgument &argument) const;
+  std::string formatMessage(const Record &record) const;
+  Diagnostic toDiagnostic(const Record &record) const;
+
+public:
+  // A limit of 0 keeps every diagnostic.
+  void setLimit(size_t limit) { this->limit = limit; }
+  void setFormat(Format format) { outputFormat = format; }
+
+  void report(DiagnosticSeverity severity, DiagnosticId id,
+              const std::string &file, size_t line, size_t column,
+              std::initializer_list<DiagnosticArgument> arguments);
+
+  size_t getErrorCount() const { return errorCount; }
+  bool empty() const { return records.empty() && suppressed == 0; }
+
+  void flush(std::ostream &output);
+  // If diagnostics were suppressed, the handler is last passed a
+  // DIAGNOSTICS_SUPPRESSED warning without a location, with their count.
+  void flush(const DiagnosticHandler &handler);
+  void clear();
+
+  // Formats a single diagnostic without recording it.
+  static Diagnostic
+  format(DiagnosticSeverity severity, DiagnosticId id, const std::string &file,
+         size_t line, size_t column,
+         std::initializer_list<DiagnosticArgument> arguments);
+};
+
+/**
+ * @brief send diagnostics reported on the current thread to an engine.
+ *
+ * Without an engine, diagnostics are printed to std::cout as they are
+ * reported. The previous engine is restored when the scope ends.
+ */
+class DiagnosticScope {
+  DiagnosticEngine *previousEngine;
+
+public:
+  DiagnosticScope(DiagnosticEngine *engine);
+  ~DiagnosticScope();
+  DiagnosticScope(const DiagnosticScope &) = delete;
+  DiagnosticScope &operator=(const DiagnosticScope &) = delete;
+};
+
+void report(DiagnosticSeverity severity, DiagnosticId id,
+            const std::string &file, size_t line, size_t column,
+            std::initializer_list<DiagnosticArgument> arguments);
+static inline void report(DiagnosticSeverity severity, DiagnosticId id,
+                          const Location &location,
+                          std::initializer_list<DiagnosticArgument> arguments) {
+  report(severity, id, location.file, location.line, location.column,
+         arguments);
+}
+} // namespace zips
+
+#endif
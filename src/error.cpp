@@ -1,15 +1,14 @@
 #include "error.h"
-#include <iostream>
 
 namespace zips {
 void error(const std::string &fileName, size_t line, size_t column,
            const std::string &message) {
-  std::cout << fileName << ":" << line << ":" << column << ":" << std::endl;
-  std::cout << "Error: " << message << std::endl;
+  report(DiagnosticSeverity::ERROR, DiagnosticId::MESSAGE, fileName, line,
+         column, {message});
 }
 void warn(const std::string &fileName, size_t line, size_t column,
           const std::string &message) {
-  std::cout << fileName << ":" << line << ":" << column << ":" << std::endl;
-  std::cout << "Warning: " << message << std::endl;
+  report(DiagnosticSeverity::WARNING, DiagnosticId::MESSAGE, fileName, line,
+         column, {message});
 }
 } // namespace zips
@@ -2,6 +2,7 @@
 #define ZIPS_ERROR_H
 
 #include "ast.h"
+#include "diagnostics.h"
 #include <cstdint>
 #include <exception>
 #include <string>
@@ -18,6 +19,11 @@ struct ZipsError : public std::exception {
   const char *what() const noexcept override { return message.c_str(); }
 };
 
+static inline void error(const Location &location, DiagnosticId id,
+                         std::initializer_list<DiagnosticArgument> arguments) {
+  report(DiagnosticSeverity::ERROR, id, location, arguments);
+}
+
 static inline void error(const ZipsError &error) {
   zips::error(error.location.file, error.location.line, error.location.column,
               error.message);
@@ -28,6 +34,10 @@ void warn(const std::string &fileName, size_t line, size_t column,
 static inline void warn(const Location &location, const std::string &message) {
   zips::warn(location.file, location.line, location.column, message);
 }
+static inline void warn(const Location &location, DiagnosticId id,
+                        std::initializer_list<DiagnosticArgument> arguments) {
+  report(DiagnosticSeverity::WARNING, id, location, arguments);
+}
 } // namespace zips
 
-#endif
\ No newline at end of file
+#endif
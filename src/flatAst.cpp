@@ -0,0 +1,564 @@
+#include "flatAst.h"
+#include "visitor.h"
+#include <array>
+
+namespace zips {
+namespace {
+class FlatAstBuilder : public AstPass {
+  FlatAst &flatAst;
+  std::unordered_map<std::string_view, FlatStringId> stringIds;
+  std::array<FlatTypeId, PRIMITIVE_TYPE_TYPE_COUNT> primitiveTypeIds;
+  FlatTypeId errorTypeId = NO_FLAT_TYPE;
+  // Ids of nodes whose parent hasn't been added yet.
+  std::vector<FlatNodeId> pendingChildren;
+
+  FlatStringId intern(std::string_view string) {
+    auto existing = stringIds.find(string);
+    if (existing != stringIds.end()) {
+      return existing->second;
+    }
+    FlatStringId id = static_cast<FlatStringId>(flatAst.stringOffsets.size());
+    flatAst.stringOffsets.push_back(
+        static_cast<uint32_t>(flatAst.stringData.size()));
+    flatAst.stringData += string;
+    // Keys refer to the caller's string, which outlives the builder.
+    stringIds[string] = id;
+    return id;
+  }
+
+  FlatTypeId addType(FlatType type) {
+    flatAst.types.push_back(type);
+    return static_cast<FlatTypeId>(flatAst.types.size() - 1);
+  }
+
+  FlatTypeId internType(Type *type) {
+    switch (type->getType()) {
+    case TypeType::PRIMITIVE: {
+      auto primitiveType =
+          static_cast<PrimitiveTypeNode *>(type)->getPrimitiveType();
+      FlatTypeId &id = primitiveTypeIds[static_cast<size_t>(primitiveType)];
+      if (id == NO_FLAT_TYPE) {
+        id = addType(FlatType{TypeType::PRIMITIVE,
+                              static_cast<uint32_t>(primitiveType),
+                              {0, 0}});
+      }
+      return id;
+    }
+    case TypeType::FUNCTION: {
+      auto functionType = static_cast<FunctionTypeNode *>(type);
+      std::vector<FlatTypeId> parameterTypes;
+      for (auto &parameterType : functionType->getParameterTypes()) {
+        parameterTypes.push_back(internType(parameterType.get()));
+      }
+      FlatTypeId returnType = internType(functionType->getReturnType().get());
+      uint32_t begin = static_cast<uint32_t>(flatAst.typeParameters.size());
+      flatAst.typeParameters.insert(flatAst.typeParameters.end(),
+                                    parameterTypes.begin(),
+                                    parameterTypes.end());
+      return addType(FlatType{
+          TypeType::FUNCTION,
+          returnType,
+          {begin, static_cast<uint32_t>(flatAst.typeParameters.size())}});
+    }
+    case TypeType::ERROR:
+      if (errorTypeId == NO_FLAT_TYPE) {
+        errorTypeId = addType(FlatType{TypeType::ERROR, 0, {0, 0}});
+      }
+      return errorTypeId;
+    }
+    return NO_FLAT_TYPE;
+  }
+
+  void addNode(AstNode *node, uint32_t data) {
+    FlatNodeId id = static_cast<FlatNodeId>(flatAst.nodeTypes.size());
+    flatAst.nodeTypes.push_back(node->getNodeType());
+    flatAst.nodeData.push_back(data);
+    size_t childCount = node->getChildCount();
+    uint32_t begin = static_cast<uint32_t>(flatAst.children.size());
+    flatAst.children.insert(flatAst.children.end(),
+                            pendingChildren.end() - childCount,
+                            pendingChildren.end());
+    pendingChildren.resize(pendingChildren.size() - childCount);
+    flatAst.nodeChildren.push_back(
+        FlatChildRange{begin, static_cast<uint32_t>(flatAst.children.size())});
+    flatAst.nodeTypeIds.push_back(node->type ? internType(node->type->get())
+                                             : NO_FLAT_TYPE);
+    flatAst.nodeLocations.push_back(
+        FlatLocation{static_cast<uint32_t>(node->getLocation().line),
+                     static_cast<uint32_t>(node->getLocation().column)});
+    pendingChildren.push_back(id);
+  }
+
+public:
+  FlatAstBuilder(FlatAst &flatAst) : flatAst(flatAst) {
+    primitiveTypeIds.fill(NO_FLAT_TYPE);
+    onLeave<&FlatAstBuilder::leaveCompilationUnit>();
+    onLeave<&FlatAstBuilder::leaveFunction>();
+    onLeave<&FlatAstBuilder::leaveBinaryExpression>();
+    onLeave<&FlatAstBuilder::leaveVariableReference>();
+    onLeave<&FlatAstBuilder::leaveReturnStatement>();
+    onLeave<&FlatAstBuilder::leaveIfStatement>();
+    onLeave<&FlatAstBuilder::leaveWhileStatement>();
+    onLeave<&FlatAstBuilder::leaveVariableDefinition>();
+    onLeave<&FlatAstBuilder::leaveAssignment>();
+    onLeave<&FlatAstBuilder::leaveCallExpression>();
+    onLeave<&FlatAstBuilder::leaveError>();
+  }
+
+  void leaveCompilationUnit(CompilationUnitNode *compilationUnit) {
+    flatAst.file = intern(compilationUnit->getLocation().file);
+    for (auto &import : compilationUnit->getImports()) {
+      flatAst.imports.push_back(FlatImport{
+          intern(import.moduleName),
+          FlatLocation{static_cast<uint32_t>(import.location.line),
+                       static_cast<uint32_t>(import.location.column)}});
+    }
+    addNode(compilationUnit, 0);
+  }
+  void leaveFunction(FunctionNode *function) {
+    uint32_t begin = static_cast<uint32_t>(flatAst.parameters.size());
+    for (auto &parameter : function->getParameters()) {
+      flatAst.parameters.push_back(FlatParameter{
+          intern(parameter.name), internType(parameter.type.get())});
+    }
+    flatAst.functions.push_back(FlatFunction{
+        intern(function->getName()),
+        {begin, static_cast<uint32_t>(flatAst.parameters.size())}});
+    addNode(function, static_cast<uint32_t>(flatAst.functions.size() - 1));
+  }
+  void leaveBinaryExpression(BinaryExpressionNode *binaryExpression) {
+    addNode(binaryExpression,
+            static_cast<uint32_t>(binaryExpression->getOperator()));
+  }
+  void leaveVariableReference(VariableReferenceNode *variableReference) {
+    addNode(variableReference, intern(variableReference->getName()));
+  }
+  void leaveReturnStatement(ReturnStatementNode *returnStatement) {
+    addNode(returnStatement, 0);
+  }
+  void leaveIfStatement(IfStatementNode *ifStatement) {
+    // The else body starts after this many children.
+    addNode(ifStatement,
+            static_cast<uint32_t>(1 + ifStatement->getThenBody().size()));
+  }
+  void leaveWhileStatement(WhileStatementNode *whileStatement) {
+    addNode(whileStatement, 0);
+  }
+  void leaveVariableDefinition(VariableDefinitionNode *variableDefinition) {
+    addNode(variableDefinition, intern(variableDefinition->getName()));
+  }
+  void leaveAssignment(AssignmentNode *assignment) {
+    addNode(assignment, intern(assignment->getName()));
+  }
+  void leaveCallExpression(CallExpressionNode *callExpression) {
+    flatAst.calls.push_back(
+        FlatCall{intern(callExpression->getName()),
+                 internType(callExpression->functionType.get())});
+    addNode(callExpression, static_cast<uint32_t>(flatAst.calls.size() - 1));
+  }
+  void leaveError(ErrorNode *errorNode) { addNode(errorNode, 0); }
+};
+
+static size_t stringHeapBytes(const std::string &string) {
+  // Short strings are stored inline by common standard libraries.
+  return string.capacity() > 15 ? string.capacity() + 1 : 0;
+}
+
+static size_t typeBytes(Type *type) {
+  switch (type->getType()) {
+  case TypeType::PRIMITIVE:
+    return sizeof(PrimitiveTypeNode);
+  case TypeType::FUNCTION: {
+    auto functionType = static_cast<FunctionTypeNode *>(type);
+    size_t result =
+        sizeof(FunctionTypeNode) +
+        functionType->getParameterTypes().capacity() * sizeof(void *) +
+        typeBytes(functionType->getReturnType().get());
+    for (auto &parameterType : functionType->getParameterTypes()) {
+      result += typeBytes(parameterType.get());
+    }
+    return result;
+  }
+  case TypeType::ERROR:
+    return sizeof(ErrorTypeNode);
+  }
+  return 0;
+}
+
+class TreeMemoryPass : public AstPass {
+public:
+  size_t nodeCount = 0;
+  size_t bytes = 0;
+
+  TreeMemoryPass() {
+    onLeave<&TreeMemoryPass::leaveNode<CompilationUnitNode>>();
+    onLeave<&TreeMemoryPass::leaveNode<FunctionNode>>();
+    onLeave<&TreeMemoryPass::leaveNode<BinaryExpressionNode>>();
+    onLeave<&TreeMemoryPass::leaveNode<VariableReferenceNode>>();
+    onLeave<&TreeMemoryPass::leaveNode<ReturnStatementNode>>();
+    onLeave<&TreeMemoryPass::leaveNode<IfStatementNode>>();
+    onLeave<&TreeMemoryPass::leaveNode<WhileStatementNode>>();
+    onLeave<&TreeMemoryPass::leaveNode<VariableDefinitionNode>>();
+    onLeave<&TreeMemoryPass::leaveNode<AssignmentNode>>();
+    onLeave<&TreeMemoryPass::leaveNode<CallExpressionNode>>();
+    onLeave<&TreeMemoryPass::leaveNode<ErrorNode>>();
+  }
+
+  template <typename Node> void leaveNode(Node *node) {
+    nodeCount++;
+    bytes += sizeof(Node) + stringHeapBytes(node->getLocation().file);
+    if (node->type) {
+      bytes += typeBytes(node->type->get());
+    }
+    if constexpr (std::is_same_v<Node, CompilationUnitNode>) {
+      bytes += node->getNodes().capacity() * sizeof(void *) +
+               node->getImports().capacity() * sizeof(Import);
+      for (auto &import : node->getImports()) {
+        bytes += stringHeapBytes(import.moduleName) +
+                 stringHeapBytes(import.location.file);
+      }
+    } else if constexpr (std::is_same_v<Node, FunctionNode>) {
+      bytes += node->getBody().capacity() * sizeof(void *) +
+               node->getParameters().capacity() * sizeof(NamedType) +
+               stringHeapBytes(node->getName());
+      for (auto &parameter : node->getParameters()) {
+        bytes += stringHeapBytes(parameter.name) +
+                 typeBytes(parameter.type.get());
+      }
+    } else if constexpr (std::is_same_v<Node, IfStatementNode>) {
+      bytes += (node->getThenBody().capacity() +
+                node->getElseBody().capacity()) *
+               sizeof(void *);
+    } else if constexpr (std::is_same_v<Node, WhileStatementNode>) {
+      bytes += node->getBody().capacity() * sizeof(void *);
+    } else if constexpr (std::is_same_v<Node, VariableReferenceNode> ||
+                         std::is_same_v<Node, AssignmentNode>) {
+      bytes += stringHeapBytes(node->getName());
+    } else if constexpr (std::is_same_v<Node, VariableDefinitionNode>) {
+      bytes += stringHeapBytes(node->getName());
+      if (node->getDeclaredType()) {
+        bytes += typeBytes(node->getDeclaredType()->get());
+      }
+    } else if constexpr (std::is_same_v<Node, CallExpressionNode>) {
+      bytes += stringHeapBytes(node->getName()) +
+               node->getArguments().capacity() * sizeof(void *);
+      if (node->functionType) {
+        bytes += typeBytes(node->functionType.get());
+      }
+    }
+  }
+};
+
+// Builds nodes in post-order, so each node's children are already built and
+// deep trees don't recurse. Every index read from the arrays is checked.
+class TreeBuilder {
+  const FlatAstView &flatAst;
+  std::string file;
+  std::vector<std::unique_ptr<AstNode>> nodes;
+
+  static bool isValidRange(FlatChildRange range, size_t size) {
+    return range.begin <= range.end && range.end <= size;
+  }
+  bool isValidString(FlatStringId id) const {
+    return id < flatAst.stringOffsets.size();
+  }
+  std::optional<std::string> getString(FlatStringId id) const {
+    if (!isValidString(id)) {
+      return std::nullopt;
+    }
+    return std::string(flatAst.getString(id));
+  }
+
+  // Types are added after the types they refer to, which rules out cycles.
+  std::unique_ptr<Type> makeType(FlatTypeId id) const {
+    if (id >= flatAst.types.size()) {
+      return nullptr;
+    }
+    const FlatType &type = flatAst.types[id];
+    switch (type.kind) {
+    case TypeType::PRIMITIVE:
+      if (type.data >= PRIMITIVE_TYPE_TYPE_COUNT) {
+        return nullptr;
+      }
+      return std::make_unique<PrimitiveTypeNode>(
+          static_cast<PrimitiveTypeType>(type.data));
+    case TypeType::FUNCTION: {
+      if (type.data >= id ||
+          !isValidRange(type.parameters, flatAst.typeParameters.size())) {
+        return nullptr;
+      }
+      std::vector<std::unique_ptr<Type>> parameterTypes;
+      for (uint32_t i = type.parameters.begin; i < type.parameters.end; i++) {
+        FlatTypeId parameterType = flatAst.typeParameters[i];
+        if (parameterType >= id) {
+          return nullptr;
+        }
+        parameterTypes.push_back(makeType(parameterType));
+        if (!parameterTypes.back()) {
+          return nullptr;
+        }
+      }
+      std::unique_ptr<Type> returnType = makeType(type.data);
+      if (!returnType) {
+        return nullptr;
+      }
+      return std::make_unique<FunctionTypeNode>(std::move(parameterTypes),
+                                                std::move(returnType));
+    }
+    case TypeType::ERROR:
+      // Only ASTs without errors are flattened for later use.
+      return nullptr;
+    }
+    return nullptr;
+  }
+
+  // Moves the children out, making sure each is only used once.
+  bool takeChildren(FlatNodeId id, uint32_t begin, uint32_t end,
+                    std::vector<std::unique_ptr<AstNode>> &result) {
+    for (uint32_t i = begin; i < end; i++) {
+      FlatNodeId child = flatAst.children[i];
+      if (child >= id || !nodes[child]) {
+        return false;
+      }
+      result.push_back(std::move(nodes[child]));
+    }
+    return true;
+  }
+
+  std::unique_ptr<AstNode> buildNode(FlatNodeId id) {
+    FlatChildRange range = flatAst.nodeChildren[id];
+    if (!isValidRange(range, flatAst.children.size())) {
+      return nullptr;
+    }
+    std::vector<std::unique_ptr<AstNode>> children;
+    if (!takeChildren(id, range.begin, range.end, children)) {
+      return nullptr;
+    }
+    uint32_t data = flatAst.nodeData[id];
+    Location location(flatAst.nodeLocations[id].line,
+                      flatAst.nodeLocations[id].column, file);
+    switch (flatAst.nodeTypes[id]) {
+    case AstNodeType::COMPILATION_UNIT: {
+      std::vector<Import> imports;
+      for (const FlatImport &import : flatAst.imports) {
+        std::optional<std::string> moduleName = getString(import.moduleName);
+        if (!moduleName) {
+          return nullptr;
+        }
+        imports.push_back(Import{Location(import.location.line,
+                                          import.location.column, file),
+                                 std::move(*moduleName)});
+      }
+      return std::make_unique<CompilationUnitNode>(
+          location, std::move(children), std::move(imports));
+    }
+    case AstNodeType::FUNCTION: {
+      if (data >= flatAst.functions.size()) {
+        return nullptr;
+      }
+      const FlatFunction &function = flatAst.functions[data];
+      std::optional<std::string> name = getString(function.name);
+      if (!name ||
+          !isValidRange(function.parameters, flatAst.parameters.size())) {
+        return nullptr;
+      }
+      std::vector<NamedType> parameters;
+      for (uint32_t i = function.parameters.begin;
+           i < function.parameters.end; i++) {
+        std::optional<std::string> parameterName =
+            getString(flatAst.parameters[i].name);
+        std::unique_ptr<Type> parameterType =
+            makeType(flatAst.parameters[i].type);
+        if (!parameterName || !parameterType) {
+          return nullptr;
+        }
+        parameters.push_back(
+            NamedType{std::move(*parameterName), std::move(parameterType)});
+      }
+      return std::make_unique<FunctionNode>(location, std::move(*name),
+                                            std::move(parameters),
+                                            std::move(children));
+    }
+    case AstNodeType::BINARY_EXPRESSION:
+      if (children.size() != 2 || data >= BINARY_OPERATOR_COUNT) {
+        return nullptr;
+      }
+      return std::make_unique<BinaryExpressionNode>(
+          location, static_cast<BinaryOperator>(data), std::move(children[0]),
+          std::move(children[1]));
+    case AstNodeType::VARIABLE_REFERENCE: {
+      std::optional<std::string> name = getString(data);
+      if (!children.empty() || !name) {
+        return nullptr;
+      }
+      return std::make_unique<VariableReferenceNode>(location,
+                                                     std::move(*name));
+    }
+    case AstNodeType::RETURN_STATEMENT:
+      if (children.size() != 1) {
+        return nullptr;
+      }
+      return std::make_unique<ReturnStatementNode>(location,
+                                                   std::move(children[0]));
+    case AstNodeType::IF_STATEMENT: {
+      if (data < 1 || data > children.size()) {
+        return nullptr;
+      }
+      std::vector<std::unique_ptr<AstNode>> thenBody(
+          std::make_move_iterator(children.begin() + 1),
+          std::make_move_iterator(children.begin() + data));
+      std::vector<std::unique_ptr<AstNode>> elseBody(
+          std::make_move_iterator(children.begin() + data),
+          std::make_move_iterator(children.end()));
+      return std::make_unique<IfStatementNode>(location, std::move(children[0]),
+                                               std::move(thenBody),
+                                               std::move(elseBody));
+    }
+    case AstNodeType::WHILE_STATEMENT: {
+      if (children.empty()) {
+        return nullptr;
+      }
+      std::vector<std::unique_ptr<AstNode>> body(
+          std::make_move_iterator(children.begin() + 1),
+          std::make_move_iterator(children.end()));
+      return std::make_unique<WhileStatementNode>(
+          location, std::move(children[0]), std::move(body));
+    }
+    case AstNodeType::VARIABLE_DEFINITION: {
+      // The declared type, if any, is the variable's type once checked.
+      std::optional<std::string> name = getString(data);
+      std::unique_ptr<Type> type = makeType(flatAst.nodeTypeIds[id]);
+      if (children.size() != 1 || !name || !type) {
+        return nullptr;
+      }
+      return std::make_unique<VariableDefinitionNode>(
+          location, std::move(*name), std::move(type), std::move(children[0]));
+    }
+    case AstNodeType::ASSIGNMENT: {
+      std::optional<std::string> name = getString(data);
+      if (children.size() != 1 || !name) {
+        return nullptr;
+      }
+      return std::make_unique<AssignmentNode>(location, std::move(*name),
+                                              std::move(children[0]));
+    }
+    case AstNodeType::CALL_EXPRESSION: {
+      if (data >= flatAst.calls.size()) {
+        return nullptr;
+      }
+      std::optional<std::string> name = getString(flatAst.calls[data].name);
+      std::unique_ptr<Type> functionType =
+          makeType(flatAst.calls[data].functionType);
+      if (!name || !functionType ||
+          functionType->getType() != TypeType::FUNCTION ||
+          static_cast<FunctionTypeNode *>(functionType.get())
+                  ->getParameterTypes()
+                  .size() != children.size()) {
+        return nullptr;
+      }
+      auto callExpression = std::make_unique<CallExpressionNode>(
+          location, std::move(*name), std::move(children));
+      callExpression->functionType.reset(
+          static_cast<FunctionTypeNode *>(functionType.release()));
+      return callExpression;
+    }
+    case AstNodeType::ERROR:
+      return nullptr;
+    }
+    return nullptr;
+  }
+
+public:
+  TreeBuilder(const FlatAstView &flatAst) : flatAst(flatAst) {}
+
+  std::unique_ptr<CompilationUnitNode>
+  build(std::optional<std::string_view> fileOverride) {
+    size_t nodeCount = flatAst.getNodeCount();
+    if (nodeCount == 0 || flatAst.nodeData.size() != nodeCount ||
+        flatAst.nodeChildren.size() != nodeCount ||
+        flatAst.nodeTypeIds.size() != nodeCount ||
+        flatAst.nodeLocations.size() != nodeCount ||
+        flatAst.nodeTypes.back() != AstNodeType::COMPILATION_UNIT) {
+      return nullptr;
+    }
+    for (size_t i = 0; i < flatAst.stringOffsets.size(); i++) {
+      uint32_t end = i + 1 < flatAst.stringOffsets.size()
+                         ? flatAst.stringOffsets[i + 1]
+                         : static_cast<uint32_t>(flatAst.stringData.size());
+      if (flatAst.stringOffsets[i] > end || end > flatAst.stringData.size()) {
+        return nullptr;
+      }
+    }
+    std::optional<std::string> fileName = getString(flatAst.file);
+    if (!fileName) {
+      return nullptr;
+    }
+    file = fileOverride ? std::string(*fileOverride) : std::move(*fileName);
+    nodes.resize(nodeCount);
+    for (FlatNodeId id = 0; id < nodeCount; id++) {
+      nodes[id] = buildNode(id);
+      if (!nodes[id]) {
+        return nullptr;
+      }
+      if (flatAst.nodeTypeIds[id] != NO_FLAT_TYPE) {
+        std::unique_ptr<Type> type = makeType(flatAst.nodeTypeIds[id]);
+        if (!type) {
+          return nullptr;
+        }
+        nodes[id]->type = std::move(type);
+      }
+    }
+    // Every node but the root must have been used as a child.
+    for (FlatNodeId id = 0; id + 1 < nodeCount; id++) {
+      if (nodes[id]) {
+        return nullptr;
+      }
+    }
+    return std::unique_ptr<CompilationUnitNode>(
+        static_cast<CompilationUnitNode *>(nodes.back().release()));
+  }
+};
+} // namespace
+
+template <typename T> static size_t arrayBytes(const std::vector<T> &array) {
+  return array.size() * sizeof(T);
+}
+
+size_t FlatAst::getMemoryUsage() const {
+  return arrayBytes(nodeTypes) + arrayBytes(nodeData) +
+         arrayBytes(nodeChildren) + arrayBytes(nodeTypeIds) +
+         arrayBytes(nodeLocations) + arrayBytes(children) +
+         arrayBytes(functions) + arrayBytes(parameters) + arrayBytes(calls) +
+         arrayBytes(imports) + arrayBytes(types) +
+         arrayBytes(typeParameters) + stringData.size() +
+         arrayBytes(stringOffsets);
+}
+
+FlatAstView FlatAst::view() const {
+  return FlatAstView{nodeTypes,     nodeData,   nodeChildren, nodeTypeIds,
+                     nodeLocations, children,   functions,    parameters,
+                     calls,         imports,    types,        typeParameters,
+                     stringData,    stringOffsets, file};
+}
+
+FlatAst flatten(CompilationUnitNode *compilationUnit) {
+  FlatAst flatAst;
+  FlatAstBuilder builder(flatAst);
+  traverse(compilationUnit, {&builder});
+  return flatAst;
+}
+
+std::unique_ptr<CompilationUnitNode>
+unflatten(const FlatAstView &flatAst,
+          std::optional<std::string_view> fileName) {
+  return TreeBuilder(flatAst).build(fileName);
+}
+
+AstMemoryStatistics measureAst(CompilationUnitNode *compilationUnit,
+                               const FlatAst &flatAst) {
+  TreeMemoryPass treeMemory;
+  traverse(compilationUnit, {&treeMemory});
+  return AstMemoryStatistics{treeMemory.nodeCount, treeMemory.bytes,
+                             flatAst.getMemoryUsage()};
+}
+} // namespace zips
@@ -0,0 +1,162 @@
+#ifndef ZIPS_FLAT_AST_H
+#define ZIPS_FLAT_AST_H
+
+#include "ast.h"
+#include "type.h"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace zips {
+using FlatNodeId = uint32_t;
+using FlatTypeId = uint32_t;
+using FlatStringId = uint32_t;
+
+static constexpr FlatTypeId NO_FLAT_TYPE = UINT32_MAX;
+
+struct FlatLocation {
+  uint32_t line;
+  uint32_t column;
+};
+
+struct FlatChildRange {
+  uint32_t begin;
+  uint32_t end;
+};
+
+struct FlatType {
+  TypeType kind;
+  // The PrimitiveTypeType, or the return type of a function.
+  uint32_t data;
+  // Parameter types of a function, in typeParameters.
+  FlatChildRange parameters;
+};
+
+struct FlatParameter {
+  FlatStringId name;
+  FlatTypeId type;
+};
+
+struct FlatFunction {
+  FlatStringId name;
+  FlatChildRange parameters;
+};
+
+struct FlatCall {
+  FlatStringId name;
+  // The called function's type.
+  FlatTypeId functionType;
+};
+
+struct FlatImport {
+  FlatStringId moduleName;
+  FlatLocation location;
+};
+
+struct FlatAstView;
+
+/**
+ * @brief a compact, pointer-free copy of a type checked AST.
+ *
+ * It is not an alternative AST for the compiler: the parsers build the tree,
+ * and type checking and code generation run over it. flatten copies the tree
+ * for the AST cache, which stores these arrays, and for --ast-stats, which
+ * compares the memory of both forms.
+ *
+ * Nodes are numbered in post-order, so children always come before their
+ * parent and the compilation unit is the last node. Each node's children are
+ * a range of the children array. Types and locations are kept in arrays
+ * parallel to the node arrays.
+ */
+struct FlatAst {
+  std::vector<AstNodeType> nodeTypes;
+  // BinaryOperator, variable name, index into functions or calls, or the
+  // index of the first else child, by node type.
+  std::vector<uint32_t> nodeData;
+  std::vector<FlatChildRange> nodeChildren;
+  std::vector<FlatTypeId> nodeTypeIds;
+  std::vector<FlatLocation> nodeLocations;
+
+  std::vector<FlatNodeId> children;
+  std::vector<FlatFunction> functions;
+  std::vector<FlatParameter> parameters;
+  std::vector<FlatCall> calls;
+  std::vector<FlatImport> imports;
+  std::vector<FlatType> types;
+  std::vector<FlatTypeId> typeParameters;
+
+  // Strings are stored back to back, starting at stringOffsets[id].
+  std::string stringData;
+  std::vector<uint32_t> stringOffsets;
+  FlatStringId file = 0;
+
+  size_t getNodeCount() const { return nodeTypes.size(); }
+  FlatNodeId getRoot() const {
+    return static_cast<FlatNodeId>(nodeTypes.size() - 1);
+  }
+  std::string_view getString(FlatStringId id) const {
+    size_t end = id + 1 < stringOffsets.size() ? stringOffsets[id + 1]
+                                               : stringData.size();
+    return std::string_view(stringData).substr(stringOffsets[id],
+                                               end - stringOffsets[id]);
+  }
+
+  // Bytes used by the arrays, excluding unused capacity.
+  size_t getMemoryUsage() const;
+  FlatAstView view() const;
+};
+
+// The arrays of a FlatAst, owned elsewhere, for example by a memory-mapped
+// AST cache.
+struct FlatAstView {
+  std::span<const AstNodeType> nodeTypes;
+  std::span<const uint32_t> nodeData;
+  std::span<const FlatChildRange> nodeChildren;
+  std::span<const FlatTypeId> nodeTypeIds;
+  std::span<const FlatLocation> nodeLocations;
+
+  std::span<const FlatNodeId> children;
+  std::span<const FlatFunction> functions;
+  std::span<const FlatParameter> parameters;
+  std::span<const FlatCall> calls;
+  std::span<const FlatImport> imports;
+  std::span<const FlatType> types;
+  std::span<const FlatTypeId> typeParameters;
+
+  std::string_view stringData;
+  std::span<const uint32_t> stringOffsets;
+  FlatStringId file = 0;
+
+  size_t getNodeCount() const { return nodeTypes.size(); }
+  std::string_view getString(FlatStringId id) const {
+    size_t end = id + 1 < stringOffsets.size() ? stringOffsets[id + 1]
+                                               : stringData.size();
+    return stringData.substr(stringOffsets[id], end - stringOffsets[id]);
+  }
+};
+
+FlatAst flatten(CompilationUnitNode *compilationUnit);
+// Rebuilds the type checked tree. Returns null if the arrays don't describe
+// one, so views of untrusted data can be checked by converting them. A file
+// name replaces the one the tree was flattened with in every location.
+std::unique_ptr<CompilationUnitNode>
+unflatten(const FlatAstView &flatAst,
+          std::optional<std::string_view> fileName = std::nullopt);
+
+struct AstMemoryStatistics {
+  size_t nodeCount;
+  size_t treeBytes;
+  size_t flatBytes;
+};
+
+// Estimates the heap memory held by the tree, ignoring allocator overhead.
+AstMemoryStatistics measureAst(CompilationUnitNode *compilationUnit,
+                               const FlatAst &flatAst);
+} // namespace zips
+
+#endif
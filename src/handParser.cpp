@@ -0,0 +1,523 @@
+#include "handParser.h"
+#include "error.h"
+#include "lexer.h"
+#include "memoryUsage.h"
+#include <optional>
+#include <utility>
+
+namespace zips {
+namespace {
+using Kind = Parser::symbol_kind;
+using std::make_unique;
+
+// Thrown to the nearest statement or definition list, which recovers as the
+// grammar's error rules do.
+struct SyntaxError {};
+// Thrown where Bison would abort.
+struct ParseAborted {};
+
+// The precedence of the comparisons, which don't associate.
+constexpr int comparisonPrecedence = 1;
+
+struct BinaryOperatorToken {
+  BinaryOperator type;
+  int precedence;
+};
+
+std::optional<BinaryOperatorToken>
+getBinaryOperator(Parser::symbol_kind_type kind) {
+  switch (kind) {
+  case Kind::S_PLUS:
+    return BinaryOperatorToken{BinaryOperator::ADD, 2};
+  case Kind::S_MINUS:
+    return BinaryOperatorToken{BinaryOperator::SUBTRACT, 2};
+  case Kind::S_CHECKED_PLUS:
+    return BinaryOperatorToken{BinaryOperator::CHECKED_ADD, 2};
+  case Kind::S_SATURATING_PLUS:
+    return BinaryOperatorToken{BinaryOperator::SATURATING_ADD, 2};
+  case Kind::S_STAR:
+    return BinaryOperatorToken{BinaryOperator::MULTIPLY, 3};
+  case Kind::S_SLASH:
+    return BinaryOperatorToken{BinaryOperator::DIVIDE, 3};
+  case Kind::S_EQUALS_EQUALS:
+    return BinaryOperatorToken{BinaryOperator::EQUAL, comparisonPrecedence};
+  case Kind::S_NOT_EQUALS:
+    return BinaryOperatorToken{BinaryOperator::NOT_EQUAL, comparisonPrecedence};
+  case Kind::S_LESS:
+    return BinaryOperatorToken{BinaryOperator::LESS, comparisonPrecedence};
+  case Kind::S_LESS_EQUALS:
+    return BinaryOperatorToken{BinaryOperator::LESS_EQUAL,
+                               comparisonPrecedence};
+  case Kind::S_GREATER:
+    return BinaryOperatorToken{BinaryOperator::GREATER, comparisonPrecedence};
+  case Kind::S_GREATER_EQUALS:
+    return BinaryOperatorToken{BinaryOperator::GREATER_EQUAL,
+                               comparisonPrecedence};
+  default:
+    return std::nullopt;
+  }
+}
+
+std::optional<PrimitiveTypeType>
+getPrimitiveType(Parser::symbol_kind_type kind) {
+  switch (kind) {
+  case Kind::S_I8:
+    return PrimitiveTypeType::I8;
+  case Kind::S_I16:
+    return PrimitiveTypeType::I16;
+  case Kind::S_I32:
+    return PrimitiveTypeType::I32;
+  case Kind::S_I64:
+    return PrimitiveTypeType::I64;
+  case Kind::S_U8:
+    return PrimitiveTypeType::U8;
+  case Kind::S_U16:
+    return PrimitiveTypeType::U16;
+  case Kind::S_U32:
+    return PrimitiveTypeType::U32;
+  case Kind::S_U64:
+    return PrimitiveTypeType::U64;
+  case Kind::S_ISIZE:
+    return PrimitiveTypeType::ISIZE;
+  case Kind::S_USIZE:
+    return PrimitiveTypeType::USIZE;
+  case Kind::S_BOOL:
+    return PrimitiveTypeType::BOOL;
+  default:
+    return std::nullopt;
+  }
+}
+
+bool isStatementStart(Parser::symbol_kind_type kind) {
+  return kind == Kind::S_IDENTIFIER || kind == Kind::S_LET ||
+         kind == Kind::S_IF || kind == Kind::S_WHILE ||
+         kind == Kind::S_LEFT_PAREN;
+}
+} // namespace
+
+void HandParser::readToken() {
+  MemoryCategoryScope category(MemoryCategory::TOKENS);
+  Parser::symbol_type token = lexer.next();
+  kind = token.kind();
+  tokenLocation = token.location;
+  if (kind == Kind::S_IDENTIFIER) {
+    identifier = std::move(token.value.as<std::string>());
+  }
+}
+
+void HandParser::consume() {
+  if (errorStatus > 0) {
+    errorStatus--;
+  }
+  consumedCount++;
+  readToken();
+}
+
+// The expected tokens are listed in the order of their kinds, as Bison does,
+// and only if there are at most four; callers pass none otherwise.
+void HandParser::syntaxError(std::initializer_list<TokenKind> expected) {
+  if (errorStatus == 0) {
+    std::string message =
+        "syntax error, unexpected " + Parser::symbol_name(kind);
+    const char *separator = ", expecting ";
+    for (TokenKind expectedKind : expected) {
+      message += separator + Parser::symbol_name(expectedKind);
+      separator = " or ";
+    }
+    error(fileName, tokenLocation.begin.line, tokenLocation.begin.column,
+          message);
+  }
+  errorLocation = tokenLocation;
+  if (errorStatus == 3) {
+    // Nothing was consumed since the last error, so the token is discarded
+    // to make progress.
+    if (kind == Kind::S_YYEOF) {
+      throw ParseAborted();
+    }
+    readToken();
+  }
+  errorStatus = 3;
+  throw SyntaxError();
+}
+
+std::unique_ptr<AstNode> HandParser::parse() {
+  location initialLocation;
+  initialLocation.initialize(&fileName);
+  consumedCount = 0;
+  errorStatus = 0;
+  readToken();
+  std::vector<Import> imports;
+  std::vector<std::unique_ptr<AstNode>> definitions;
+  try {
+    while (kind == Kind::S_IMPORT) {
+      consume();
+      if (kind != Kind::S_IDENTIFIER) {
+        syntaxError({Kind::S_IDENTIFIER});
+      }
+      imports.push_back(Import{tokenLocation, std::move(identifier)});
+      consume();
+      if (kind != Kind::S_SEMICOLON) {
+        syntaxError({Kind::S_SEMICOLON});
+      }
+      consume();
+    }
+    // Errors before the first definition can't be recovered from.
+    if (kind != Kind::S_YYEOF && kind != Kind::S_LET) {
+      syntaxError({Kind::S_YYEOF, Kind::S_LET, Kind::S_IMPORT});
+    }
+    while (kind != Kind::S_YYEOF) {
+      try {
+        if (kind != Kind::S_LET) {
+          syntaxError({Kind::S_YYEOF, Kind::S_LET});
+        }
+        definitions.push_back(parseFunction());
+      } catch (const SyntaxError &) {
+        // Skip to the next definition.
+      }
+    }
+  } catch (const SyntaxError &) {
+    return nullptr;
+  } catch (const ParseAborted &) {
+    return nullptr;
+  }
+  return make_unique<CompilationUnitNode>(
+      initialLocation, std::move(definitions), std::move(imports));
+}
+
+std::unique_ptr<AstNode> HandParser::parseFunction() {
+  Location location(tokenLocation);
+  consume();
+  if (kind != Kind::S_IDENTIFIER) {
+    syntaxError({Kind::S_IDENTIFIER});
+  }
+  std::string name = std::move(identifier);
+  consume();
+  if (kind != Kind::S_LEFT_PAREN) {
+    syntaxError({Kind::S_LEFT_PAREN});
+  }
+  consume();
+  std::vector<NamedType> parameters;
+  if (kind == Kind::S_IDENTIFIER) {
+    parameters.push_back(parseNamedType());
+    while (kind != Kind::S_RIGHT_PAREN) {
+      if (kind != Kind::S_COMMA) {
+        syntaxError({Kind::S_RIGHT_PAREN, Kind::S_COMMA});
+      }
+      consume();
+      if (kind != Kind::S_IDENTIFIER) {
+        syntaxError({Kind::S_IDENTIFIER});
+      }
+      parameters.push_back(parseNamedType());
+    }
+  } else if (kind != Kind::S_RIGHT_PAREN) {
+    syntaxError({Kind::S_IDENTIFIER, Kind::S_RIGHT_PAREN});
+  }
+  consume();
+  std::optional<std::unique_ptr<Type>> returnType;
+  if (kind == Kind::S_COLON) {
+    consume();
+    returnType = parseType();
+    if (kind != Kind::S_EQUALS) {
+      syntaxError({Kind::S_EQUALS});
+    }
+  } else if (kind != Kind::S_EQUALS) {
+    syntaxError({Kind::S_EQUALS, Kind::S_COLON});
+  }
+  consume();
+  if (kind != Kind::S_LEFT_BRACE) {
+    syntaxError({Kind::S_LEFT_BRACE});
+  }
+  std::vector<std::unique_ptr<AstNode>> body = parseBlock();
+  return make_unique<FunctionNode>(location, std::move(name),
+                                   std::move(parameters), std::move(body),
+                                   std::move(returnType));
+}
+
+NamedType HandParser::parseNamedType() {
+  std::string name = std::move(identifier);
+  consume();
+  if (kind != Kind::S_COLON) {
+    syntaxError({Kind::S_COLON});
+  }
+  consume();
+  return {std::move(name), parseType()};
+}
+
+std::unique_ptr<Type> HandParser::parseType() {
+  std::optional<PrimitiveTypeType> type = getPrimitiveType(kind);
+  if (!type) {
+    syntaxError();
+  }
+  consume();
+  return make_unique<PrimitiveTypeNode>(*type);
+}
+
+// Like the grammar's statement-list, which is followed by "}" both in
+// functions and in blocks.
+std::vector<std::unique_ptr<AstNode>> HandParser::parseStatementList() {
+  std::vector<std::unique_ptr<AstNode>> statements;
+  while (kind != Kind::S_RIGHT_BRACE) {
+    Location start(tokenLocation);
+    size_t consumedBefore = consumedCount;
+    try {
+      if (!isStatementStart(kind)) {
+        syntaxError();
+      }
+      statements.push_back(parseStatement());
+    } catch (const SyntaxError &) {
+      // Leave a placeholder so that the type checker doesn't report errors
+      // caused by the missing statement. It is where Bison's error token
+      // would start: at the statement, or at the token which didn't start
+      // one.
+      statements.push_back(make_unique<ErrorNode>(
+          consumedCount > consumedBefore ? start : Location(errorLocation)));
+    }
+  }
+  return statements;
+}
+
+std::vector<std::unique_ptr<AstNode>> HandParser::parseBlock() {
+  consume();
+  std::vector<std::unique_ptr<AstNode>> statements = parseStatementList();
+  consume();
+  return statements;
+}
+
+std::unique_ptr<AstNode> HandParser::parseStatement() {
+  switch (kind) {
+  case Kind::S_LET:
+    return parseVariableDefinition();
+  case Kind::S_IF:
+    return parseIfStatement();
+  case Kind::S_WHILE:
+    return parseWhileStatement();
+  case Kind::S_IDENTIFIER: {
+    Location location(tokenLocation);
+    std::string name = std::move(identifier);
+    consume();
+    if (kind == Kind::S_EQUALS) {
+      Location assignmentLocation(tokenLocation);
+      consume();
+      std::unique_ptr<AstNode> value = parseExpression();
+      if (kind != Kind::S_SEMICOLON) {
+        syntaxError();
+      }
+      consume();
+      return make_unique<AssignmentNode>(assignmentLocation, std::move(name),
+                                         std::move(value));
+    }
+    return finishExpressionStatement(
+        location, parseExpression(ExpressionStart{location, std::move(name)}));
+  }
+  default: {
+    Location location(tokenLocation);
+    return finishExpressionStatement(location, parseExpression());
+  }
+  }
+}
+
+// An expression without a ";" returns it, if the statement ends there.
+std::unique_ptr<AstNode>
+HandParser::finishExpressionStatement(Location location,
+                                      std::unique_ptr<AstNode> expression) {
+  if (kind == Kind::S_SEMICOLON) {
+    consume();
+    return expression;
+  }
+  if (!isStatementStart(kind) && kind != Kind::S_RIGHT_BRACE) {
+    syntaxError();
+  }
+  return make_unique<ReturnStatementNode>(location, std::move(expression));
+}
+
+std::unique_ptr<AstNode> HandParser::parseVariableDefinition() {
+  Location location(tokenLocation);
+  consume();
+  if (kind != Kind::S_IDENTIFIER) {
+    syntaxError({Kind::S_IDENTIFIER});
+  }
+  std::string name = std::move(identifier);
+  consume();
+  std::optional<std::unique_ptr<Type>> declaredType;
+  if (kind == Kind::S_COLON) {
+    consume();
+    declaredType = parseType();
+    if (kind != Kind::S_EQUALS) {
+      syntaxError({Kind::S_EQUALS});
+    }
+  } else if (kind != Kind::S_EQUALS) {
+    syntaxError({Kind::S_EQUALS, Kind::S_COLON});
+  }
+  consume();
+  std::unique_ptr<AstNode> value = parseExpression();
+  if (kind != Kind::S_SEMICOLON) {
+    syntaxError();
+  }
+  consume();
+  return make_unique<VariableDefinitionNode>(
+      location, std::move(name), std::move(declaredType), std::move(value));
+}
+
+std::unique_ptr<AstNode> HandParser::parseIfStatement() {
+  Location location(tokenLocation);
+  consume();
+  std::unique_ptr<AstNode> condition = parseExpression();
+  if (kind != Kind::S_LEFT_BRACE) {
+    syntaxError();
+  }
+  std::vector<std::unique_ptr<AstNode>> thenBody = parseBlock();
+  std::vector<std::unique_ptr<AstNode>> elseBody;
+  if (kind == Kind::S_ELSE) {
+    consume();
+    if (kind == Kind::S_IF) {
+      elseBody.push_back(parseIfStatement());
+    } else if (kind == Kind::S_LEFT_BRACE) {
+      elseBody = parseBlock();
+    } else {
+      syntaxError({Kind::S_IF, Kind::S_LEFT_BRACE});
+    }
+  } else if (!isStatementStart(kind) && kind != Kind::S_RIGHT_BRACE) {
+    // Whether the statement ends here depends on the token, so it is
+    // discarded with the statement, as in Bison.
+    syntaxError();
+  }
+  return make_unique<IfStatementNode>(location, std::move(condition),
+                                      std::move(thenBody), std::move(elseBody));
+}
+
+std::unique_ptr<AstNode> HandParser::parseWhileStatement() {
+  Location location(tokenLocation);
+  consume();
+  std::unique_ptr<AstNode> condition = parseExpression();
+  if (kind != Kind::S_LEFT_BRACE) {
+    syntaxError();
+  }
+  std::vector<std::unique_ptr<AstNode>> body = parseBlock();
+  return make_unique<WhileStatementNode>(location, std::move(condition),
+                                         std::move(body));
+}
+
+// Operators are held until one of lower precedence, or the end of their
+// frame, shows where their right operand ends. Those of the same precedence
+// are folded first, so they associate to the left.
+std::unique_ptr<AstNode>
+HandParser::parseExpression(std::optional<ExpressionStart> start) {
+  expressionFrames.clear();
+  operands.clear();
+  operators.clear();
+  calls.clear();
+  beginExpressionFrame(ExpressionFrameKind::EXPRESSION);
+  bool expectOperand = true;
+  while (true) {
+    if (expectOperand) {
+      std::optional<Location> location;
+      std::string name;
+      if (start) {
+        location = start->location;
+        name = std::move(start->name);
+        start.reset();
+      } else if (kind == Kind::S_IDENTIFIER) {
+        location = tokenLocation;
+        name = std::move(identifier);
+        consume();
+      } else if (kind == Kind::S_LEFT_PAREN) {
+        consume();
+        beginExpressionFrame(ExpressionFrameKind::PARENTHESES);
+        continue;
+      } else {
+        syntaxError({Kind::S_IDENTIFIER, Kind::S_LEFT_PAREN});
+      }
+      expectOperand = false;
+      if (kind != Kind::S_LEFT_PAREN) {
+        operands.push_back(
+            make_unique<VariableReferenceNode>(*location, std::move(name)));
+        continue;
+      }
+      // A name followed by "(" is a call.
+      consume();
+      calls.push_back(PendingCall{*location, std::move(name), {}});
+      if (kind != Kind::S_RIGHT_PAREN) {
+        if (kind != Kind::S_IDENTIFIER && kind != Kind::S_LEFT_PAREN) {
+          syntaxError(
+              {Kind::S_IDENTIFIER, Kind::S_LEFT_PAREN, Kind::S_RIGHT_PAREN});
+        }
+        beginExpressionFrame(ExpressionFrameKind::CALL);
+        expectOperand = true;
+        continue;
+      }
+    } else if (std::optional<BinaryOperatorToken> binaryOperator =
+                   getBinaryOperator(kind)) {
+      // Comparisons don't associate, and have the lowest precedence, so one
+      // can only be pending at the bottom of the frame.
+      const ExpressionFrame &frame = expressionFrames.back();
+      if (binaryOperator->precedence == comparisonPrecedence &&
+          operators.size() > frame.operatorsBegin &&
+          operators[frame.operatorsBegin].precedence == comparisonPrecedence) {
+        syntaxError();
+      }
+      reduceOperators(binaryOperator->precedence);
+      operators.push_back(PendingOperator{binaryOperator->type,
+                                          binaryOperator->precedence,
+                                          Location(tokenLocation)});
+      consume();
+      expectOperand = true;
+      continue;
+    } else {
+      // The innermost frame ends here.
+      reduceOperators(comparisonPrecedence);
+      ExpressionFrameKind frameKind = expressionFrames.back().kind;
+      expressionFrames.pop_back();
+      if (frameKind == ExpressionFrameKind::EXPRESSION) {
+        std::unique_ptr<AstNode> expression = std::move(operands.back());
+        operands.pop_back();
+        return expression;
+      } else if (frameKind == ExpressionFrameKind::PARENTHESES) {
+        // The expression stays as an operand of the enclosing frame.
+        if (kind != Kind::S_RIGHT_PAREN) {
+          syntaxError();
+        }
+        consume();
+        continue;
+      }
+      calls.back().arguments.push_back(std::move(operands.back()));
+      operands.pop_back();
+      if (kind == Kind::S_COMMA) {
+        consume();
+        beginExpressionFrame(ExpressionFrameKind::CALL);
+        expectOperand = true;
+        continue;
+      } else if (kind != Kind::S_RIGHT_PAREN) {
+        syntaxError();
+      }
+    }
+    // The ")" of the innermost call.
+    consume();
+    PendingCall call = std::move(calls.back());
+    calls.pop_back();
+    operands.push_back(make_unique<CallExpressionNode>(
+        call.location, std::move(call.name), std::move(call.arguments)));
+  }
+}
+
+void HandParser::beginExpressionFrame(ExpressionFrameKind frameKind) {
+  expressionFrames.push_back(
+      ExpressionFrame{frameKind, operators.size()});
+}
+
+// Folds the innermost frame's operators of at least the minimum precedence
+// into binary expressions.
+void HandParser::reduceOperators(int minimumPrecedence) {
+  size_t operatorsBegin = expressionFrames.back().operatorsBegin;
+  while (operators.size() > operatorsBegin &&
+         operators.back().precedence >= minimumPrecedence) {
+    PendingOperator pendingOperator = std::move(operators.back());
+    operators.pop_back();
+    std::unique_ptr<AstNode> right = std::move(operands.back());
+    operands.pop_back();
+    std::unique_ptr<AstNode> &left = operands.back();
+    left = make_unique<BinaryExpressionNode>(pendingOperator.location,
+                                             pendingOperator.type,
+                                             std::move(left), std::move(right));
+  }
+}
+} // namespace zips
@@ -0,0 +1,106 @@
+#ifndef ZIPS_HAND_PARSER_H
+#define ZIPS_HAND_PARSER_H
+
+#include "ast.h"
+#include "parser.hh"
+#include <cstddef>
+#include <initializer_list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace zips {
+class Lexer;
+
+/**
+ * @brief a recursive descent parser for the grammar of parser.y, with an
+ * operator precedence parser for expressions.
+ *
+ * It builds the same AST as the Bison parser, without a symbol stack, and
+ * reports the same syntax errors. Expressions keep their operands, operators
+ * and nested parentheses and calls on explicit stacks, so as in Bison their
+ * nesting is only limited by memory. Errors are recovered from where the
+ * grammar's error rules are: an error in a statement replaces it with an
+ * ErrorNode, and one in a definition skips to the next "let". Like Bison,
+ * errors are only reported once three tokens were consumed after the last
+ * one, and an error before the first definition, or at the end of the file
+ * inside a function, aborts the parse.
+ */
+class HandParser {
+  using TokenKind = Parser::symbol_kind_type;
+
+  Lexer &lexer;
+  std::string &fileName;
+  TokenKind kind;
+  location tokenLocation;
+  // The value of the current token, if it is an identifier.
+  std::string identifier;
+  size_t consumedCount = 0;
+  // As Bison's yyerrstatus_: 3 after an error, less for each token consumed
+  // since, and 0 once errors are reported again.
+  int errorStatus = 0;
+  location errorLocation;
+
+  // The expression being parsed. Each frame is the whole expression, a
+  // parenthesized one or a call argument, and owns the operators above where
+  // it begins.
+  enum class ExpressionFrameKind : uint8_t { EXPRESSION, PARENTHESES, CALL };
+  struct ExpressionFrame {
+    ExpressionFrameKind kind;
+    size_t operatorsBegin;
+  };
+  struct PendingOperator {
+    BinaryOperator type;
+    int precedence;
+    Location location;
+  };
+  struct PendingCall {
+    Location location;
+    std::string name;
+    std::vector<std::unique_ptr<AstNode>> arguments;
+  };
+  std::vector<ExpressionFrame> expressionFrames;
+  std::vector<std::unique_ptr<AstNode>> operands;
+  std::vector<PendingOperator> operators;
+  std::vector<PendingCall> calls;
+  // The first name of an expression statement, which was consumed to tell
+  // it from an assignment.
+  struct ExpressionStart {
+    Location location;
+    std::string name;
+  };
+
+  void readToken();
+  void consume();
+  [[noreturn]] void
+  syntaxError(std::initializer_list<TokenKind> expected = {});
+
+  std::unique_ptr<AstNode> parseFunction();
+  NamedType parseNamedType();
+  std::unique_ptr<Type> parseType();
+  std::vector<std::unique_ptr<AstNode>> parseStatementList();
+  std::vector<std::unique_ptr<AstNode>> parseBlock();
+  std::unique_ptr<AstNode> parseStatement();
+  std::unique_ptr<AstNode> parseVariableDefinition();
+  std::unique_ptr<AstNode> parseIfStatement();
+  std::unique_ptr<AstNode> parseWhileStatement();
+  std::unique_ptr<AstNode>
+  finishExpressionStatement(Location location,
+                            std::unique_ptr<AstNode> expression);
+  std::unique_ptr<AstNode>
+  parseExpression(std::optional<ExpressionStart> start = std::nullopt);
+  void beginExpressionFrame(ExpressionFrameKind kind);
+  void reduceOperators(int minimumPrecedence);
+
+public:
+  HandParser(Lexer &lexer, std::string &fileName)
+      : lexer(lexer), fileName(fileName) {}
+
+  // Returns null if the parse was aborted. Errors it recovered from were
+  // reported, so the AST is only valid if there were none.
+  std::unique_ptr<AstNode> parse();
+};
+} // namespace zips
+
+#endif
@@ -0,0 +1,267 @@
+#include "interpreter.h"
+#include <stdexcept>
+
+namespace zips {
+AstInterpreter::Variable &AstInterpreter::findVariable(std::string_view name) {
+  for (auto variable = variables.rbegin();
+       variable != variables.rend() - static_cast<ptrdiff_t>(frameBegin);
+       variable++) {
+    if (variable->name == name) {
+      return *variable;
+    }
+  }
+  throw std::runtime_error("Variable not found");
+}
+
+static uint64_t executeBinaryOperator(BinaryOperator operatorType,
+                                      PrimitiveTypeType operandType,
+                                      PrimitiveTypeType resultType,
+                                      uint64_t a, uint64_t b) {
+  bool isSignedOperand = isSigned(operandType);
+  int64_t signedA = static_cast<int64_t>(a);
+  int64_t signedB = static_cast<int64_t>(b);
+  switch (operatorType) {
+  case BinaryOperator::ADD:
+    return a + b;
+  case BinaryOperator::SUBTRACT:
+    return a - b;
+  case BinaryOperator::MULTIPLY:
+    return a * b;
+  case BinaryOperator::DIVIDE:
+  case BinaryOperator::MODULO: {
+    if (b == 0) {
+      throw std::runtime_error("Division by zero");
+    }
+    bool isDivide = operatorType == BinaryOperator::DIVIDE;
+    if (!isSignedOperand) {
+      return isDivide ? a / b : a % b;
+    }
+    // The only signed overflow, which wraps around.
+    if (signedA == INT64_MIN && signedB == -1) {
+      return isDivide ? a : 0;
+    }
+    return static_cast<uint64_t>(isDivide ? signedA / signedB
+                                          : signedA % signedB);
+  }
+  case BinaryOperator::CHECKED_ADD:
+  case BinaryOperator::SATURATING_ADD: {
+    a = wrapToType(resultType, a);
+    b = wrapToType(resultType, b);
+    uint64_t sum;
+    if (!addOverflows(resultType, a, b, sum)) {
+      return sum;
+    } else if (operatorType == BinaryOperator::CHECKED_ADD) {
+      throw std::runtime_error("Arithmetic overflow");
+    }
+    return getSaturatedSum(resultType, b);
+  }
+  case BinaryOperator::EQUAL:
+    return a == b;
+  case BinaryOperator::NOT_EQUAL:
+    return a != b;
+  case BinaryOperator::LESS:
+    return isSignedOperand ? signedA < signedB : a < b;
+  case BinaryOperator::LESS_EQUAL:
+    return isSignedOperand ? signedA <= signedB : a <= b;
+  case BinaryOperator::GREATER:
+    return isSignedOperand ? signedA > signedB : a > b;
+  case BinaryOperator::GREATER_EQUAL:
+    return isSignedOperand ? signedA >= signedB : a >= b;
+  }
+  throw std::runtime_error("Unknown binary operator");
+}
+
+class AstInterpreter::ExpressionPass : public AstPass {
+  AstInterpreter &interpreter;
+
+  void leaveVariableReference(VariableReferenceNode *node) {
+    interpreter.values.push_back(
+        interpreter.findVariable(node->getName()).value);
+  }
+
+  void leaveBinaryExpression(BinaryExpressionNode *node) {
+    auto &values = interpreter.values;
+    uint64_t right = values.back();
+    values.pop_back();
+    uint64_t left = values.back();
+    // Comparisons take their signedness from the left operand, like the
+    // code generator.
+    uint64_t result = executeBinaryOperator(
+        node->getOperator(), getPrimitiveType(node->getLeft()),
+        getPrimitiveType(node), left, right);
+    values.back() = wrapToType(getPrimitiveType(node), result);
+  }
+
+  void leaveCallExpression(CallExpressionNode *node) {
+    auto &values = interpreter.values;
+    auto function = interpreter.functions.find(node->getName());
+    if (function == interpreter.functions.end()) {
+      throw std::runtime_error("Can't call " + node->getName() +
+                               " from another module");
+    }
+    size_t argumentsBegin = values.size() - node->getArguments().size();
+    // invoke copies the arguments into variables before values can grow.
+    uint64_t result = interpreter.invoke(
+        function->second, std::span(values).subspan(argumentsBegin));
+    values.resize(argumentsBegin);
+    values.push_back(result);
+  }
+
+public:
+  explicit ExpressionPass(AstInterpreter &interpreter)
+      : interpreter(interpreter) {
+    onLeave<&ExpressionPass::leaveVariableReference>();
+    onLeave<&ExpressionPass::leaveBinaryExpression>();
+    onLeave<&ExpressionPass::leaveCallExpression>();
+  }
+};
+
+AstInterpreter::AstInterpreter(CompilationUnitNode *unit) {
+  for (auto &node : unit->getNodes()) {
+    auto function = static_cast<FunctionNode *>(node.get());
+    functions[function->getName()] = function;
+  }
+  expressionPass = std::make_unique<ExpressionPass>(*this);
+}
+
+AstInterpreter::~AstInterpreter() = default;
+
+uint64_t AstInterpreter::evaluate(AstNode *expression) {
+  switch (expression->getNodeType()) {
+  case AstNodeType::VARIABLE_REFERENCE:
+  case AstNodeType::BINARY_EXPRESSION:
+  case AstNodeType::CALL_EXPRESSION:
+    break;
+  default:
+    throw std::runtime_error("Not an expression");
+  }
+  if (traversals.size() < callDepth) {
+    traversals.push_back(std::make_unique<Traversal>());
+  }
+  traversals[callDepth - 1]->run(expression, {expressionPass.get()});
+  uint64_t value = values.back();
+  values.pop_back();
+  return value;
+}
+
+void AstInterpreter::countStep() {
+  if (++steps > stepLimit) {
+    throw std::runtime_error("Step limit exceeded");
+  }
+}
+
+bool AstInterpreter::execute(const std::vector<std::unique_ptr<AstNode>> &body,
+                             uint64_t &result) {
+  size_t blocksBegin = blocks.size();
+  blocks.push_back(Block{&body, 0, variables.size(), nullptr});
+  while (blocks.size() > blocksBegin) {
+    Block &block = blocks.back();
+    if (block.nextStatement == block.statements->size()) {
+      variables.resize(block.scopeBegin);
+      WhileStatementNode *loop = block.loop;
+      // Evaluating the condition can run calls, which push their own blocks.
+      if (loop && evaluate(loop->getCondition()) != 0) {
+        countStep();
+        blocks.back().nextStatement = 0;
+      } else {
+        blocks.pop_back();
+      }
+      continue;
+    }
+    AstNode *statement = (*block.statements)[block.nextStatement++].get();
+    switch (statement->getNodeType()) {
+    case AstNodeType::RETURN_STATEMENT:
+      result = evaluate(
+          static_cast<ReturnStatementNode *>(statement)->getExpression());
+      blocks.resize(blocksBegin);
+      return true;
+    case AstNodeType::VARIABLE_DEFINITION: {
+      auto variableDefinition = static_cast<VariableDefinitionNode *>(statement);
+      PrimitiveTypeType type = getPrimitiveType(variableDefinition);
+      uint64_t value = evaluate(variableDefinition->getValue());
+      variables.push_back(Variable{variableDefinition->getName(), type,
+                                   wrapToType(type, value)});
+      break;
+    }
+    case AstNodeType::ASSIGNMENT: {
+      auto assignment = static_cast<AssignmentNode *>(statement);
+      uint64_t value = evaluate(assignment->getValue());
+      Variable &variable = findVariable(assignment->getName());
+      variable.value = wrapToType(variable.type, value);
+      break;
+    }
+    case AstNodeType::IF_STATEMENT: {
+      auto ifStatement = static_cast<IfStatementNode *>(statement);
+      bool condition = evaluate(ifStatement->getCondition()) != 0;
+      blocks.push_back(Block{condition ? &ifStatement->getThenBody()
+                                       : &ifStatement->getElseBody(),
+                             0, variables.size(), nullptr});
+      break;
+    }
+    case AstNodeType::WHILE_STATEMENT: {
+      auto whileStatement = static_cast<WhileStatementNode *>(statement);
+      if (evaluate(whileStatement->getCondition()) != 0) {
+        countStep();
+        blocks.push_back(Block{&whileStatement->getBody(), 0, variables.size(),
+                               whileStatement});
+      }
+      break;
+    }
+    default:
+      // An expression statement, evaluated for nothing but its errors.
+      evaluate(statement);
+      break;
+    }
+  }
+  return false;
+}
+
+uint64_t AstInterpreter::call(std::string_view functionName,
+                              std::span<const uint64_t> arguments) {
+  auto function = functions.find(functionName);
+  if (function == functions.end()) {
+    throw std::runtime_error("Function not found");
+  }
+  if (arguments.size() != function->second->getParameters().size()) {
+    throw std::runtime_error("Wrong number of arguments");
+  }
+  variables.clear();
+  blocks.clear();
+  values.clear();
+  frameBegin = 0;
+  steps = 0;
+  callDepth = 0;
+  return invoke(function->second, arguments);
+}
+
+// Arguments are wrapped to the parameter types, which also converts the
+// arguments of calls.
+uint64_t AstInterpreter::invoke(FunctionNode *node,
+                                std::span<const uint64_t> arguments) {
+  if (++callDepth > MAX_CALL_DEPTH) {
+    throw std::runtime_error("Call depth limit exceeded");
+  }
+  size_t callerFrameBegin = frameBegin;
+  frameBegin = variables.size();
+  auto &parameters = node->getParameters();
+  for (size_t i = 0; i < parameters.size(); i++) {
+    PrimitiveTypeType type =
+        static_cast<PrimitiveTypeNode *>(parameters[i].type.get())
+            ->getPrimitiveType();
+    variables.push_back(
+        Variable{parameters[i].name, type, wrapToType(type, arguments[i])});
+  }
+  uint64_t result = 0;
+  if (!execute(node->getBody(), result)) {
+    throw std::runtime_error("Function did not return");
+  }
+  variables.resize(frameBegin);
+  frameBegin = callerFrameBegin;
+  callDepth--;
+  auto functionType = static_cast<FunctionTypeNode *>(node->type->get());
+  return wrapToType(static_cast<PrimitiveTypeNode *>(
+                        functionType->getReturnType().get())
+                        ->getPrimitiveType(),
+                    result);
+}
+} // namespace zips
@@ -0,0 +1,135 @@
+#ifndef ZIPS_INTERPRETER_H
+#define ZIPS_INTERPRETER_H
+
+#include "ast.h"
+#include "type.h"
+#include "visitor.h"
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace zips {
+// Calls nest at most this deep in the interpreters, which use the native
+// stack for them.
+static constexpr size_t MAX_CALL_DEPTH = 1000;
+
+// Wraps value around to the width of type. The result is sign extended for
+// signed types and zero extended otherwise, which is how the interpreters
+// hold every value.
+static inline uint64_t wrapToType(PrimitiveTypeType type, uint64_t value) {
+  size_t bits = getBits(type);
+  if (bits >= 64) {
+    return value;
+  }
+  uint64_t mask = (uint64_t{1} << bits) - 1;
+  value &= mask;
+  if (isSigned(type) && (value >> (bits - 1)) != 0) {
+    value |= ~mask;
+  }
+  return value;
+}
+
+// The largest value of type, as wrapToType represents it. The smallest is
+// its complement for signed types, and zero otherwise.
+static inline uint64_t getMaximum(PrimitiveTypeType type) {
+  return UINT64_MAX >> (64 - getBits(type) + isSigned(type));
+}
+
+// Whether a + b, both values of type, doesn't fit type. The wrapped around
+// sum is stored in sum.
+static inline bool addOverflows(PrimitiveTypeType type, uint64_t a,
+                                uint64_t b, uint64_t &sum) {
+  sum = a + b;
+  if (getBits(type) < 64) {
+    // The exact sum fits in 64 bits.
+    bool overflows = wrapToType(type, sum) != sum;
+    sum = wrapToType(type, sum);
+    return overflows;
+  } else if (isSigned(type)) {
+    // The operands have the same sign, which the sum doesn't.
+    return ((a ^ sum) & (b ^ sum)) >> 63 != 0;
+  }
+  return sum < a;
+}
+
+// What a + b saturates to when it overflows: the maximum, or for signed
+// types the minimum if b, and so a, is negative.
+static inline uint64_t getSaturatedSum(PrimitiveTypeType type, uint64_t b) {
+  uint64_t maximum = getMaximum(type);
+  return isSigned(type) && static_cast<int64_t>(b) < 0 ? ~maximum : maximum;
+}
+
+/**
+ * @brief evaluates type checked functions by walking their AST.
+ *
+ * This is the reference semantics of the language, so it favours being
+ * obviously right over being fast. Arithmetic wraps around at the width of
+ * its type, exactly as getBits and isSigned describe it, except for checked
+ * and saturating additions, whose operands are first converted to the result
+ * type. Errors such as division by zero, checked overflow, running out of
+ * steps or calling a function of another module throw std::runtime_error.
+ *
+ * Only calls use the native stack. Expressions are evaluated by a Traversal,
+ * and the blocks being run are kept on a stack, so deeply nested code runs
+ * like the compiler compiles it.
+ */
+class AstInterpreter {
+  std::unordered_map<std::string_view, FunctionNode *> functions;
+  uint64_t stepLimit = UINT64_MAX;
+  uint64_t steps = 0;
+  size_t callDepth = 0;
+
+  struct Variable {
+    std::string_view name;
+    PrimitiveTypeType type;
+    uint64_t value;
+  };
+  // Variables in scope, innermost last. Those of the function being run
+  // start at frameBegin.
+  std::vector<Variable> variables;
+  size_t frameBegin = 0;
+
+  // Statements being run, innermost last. A loop's body runs again once it
+  // ends, while the loop's condition holds.
+  struct Block {
+    const std::vector<std::unique_ptr<AstNode>> *statements;
+    size_t nextStatement;
+    size_t scopeBegin;
+    WhileStatementNode *loop;
+  };
+  std::vector<Block> blocks;
+
+  // Values of the expressions being evaluated, innermost last. Each call
+  // evaluates with its own Traversal, since its caller's is still walking.
+  class ExpressionPass;
+  std::unique_ptr<ExpressionPass> expressionPass;
+  std::vector<std::unique_ptr<Traversal>> traversals;
+  std::vector<uint64_t> values;
+
+  Variable &findVariable(std::string_view name);
+  uint64_t invoke(FunctionNode *function, std::span<const uint64_t> arguments);
+  uint64_t evaluate(AstNode *expression);
+  void countStep();
+  // Returns whether a return statement was executed, setting result.
+  bool execute(const std::vector<std::unique_ptr<AstNode>> &body,
+               uint64_t &result);
+
+public:
+  explicit AstInterpreter(CompilationUnitNode *unit);
+  ~AstInterpreter();
+
+  // Limits how many loop iterations a call can run, so that generated
+  // programs can't hang.
+  void setStepLimit(uint64_t limit) { stepLimit = limit; }
+
+  // Arguments are wrapped to the parameter types.
+  uint64_t call(std::string_view functionName,
+                std::span<const uint64_t> arguments);
+};
+} // namespace zips
+
+#endif
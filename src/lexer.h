@@ -24,6 +24,11 @@ public:
       : yyFlexLexer(&input) {
         currentLocation.begin.filename = &fileName;
   }
+  void reset(std::istream &input, std::string &fileName) {
+    yyrestart(&input);
+    currentLocation = location();
+    currentLocation.begin.filename = &fileName;
+  }
   Parser::symbol_type next();
   location getLocation() { return currentLocation; }
 
@@ -1,47 +1,431 @@
-#include "ast.h"
-#include "codegen/codegen.h"
-#include "error.h"
-#include "lexer.h"
-#include "parser.hh"
-#include "typeCheck.h"
+#include "astCache.h"
+#include "bytecode.h"
+#include "compiler.h"
+#include "flatAst.h"
+#include "memoryUsage.h"
+#include "moduleBuild.h"
+#include "probes.h"
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
 #include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string_view>
+#include <vector>
 
 void usage(const char *program) {
-  std::cerr << "Usage: " << program << " file" << std::endl;
+  std::cerr << "Usage: " << program << " [options] file" << std::endl;
+  std::cerr << "       " << program
+            << " [options] --interpret=function file [arguments]" << std::endl;
+  std::cerr << "       " << program << " [options] --build [-j jobs] files"
+            << std::endl;
+  std::cerr << "Options:" << std::endl;
+  std::cerr << "  --diagnostics-format=text|json" << std::endl;
+  std::cerr << "  --max-diagnostics=count" << std::endl;
+  std::cerr << "  --ast-stats" << std::endl;
+  std::cerr << "  --emit-ast-bin" << std::endl;
+  std::cerr << "  --mem-report" << std::endl;
+  std::cerr << "  --mem-budget=bytes-per-line" << std::endl;
+  std::cerr << "  --instrument" << std::endl;
+  std::cerr << "  --profile-use=file" << std::endl;
+  std::cerr << "  --no-fold" << std::endl;
+  std::cerr << "  --fold-stats" << std::endl;
+  std::cerr << "  --work-counters" << std::endl;
+  std::cerr << "  --interpret=function" << std::endl;
+  std::cerr << "  --emit-interface" << std::endl;
+  std::cerr << "  --emit-executable=function" << std::endl;
+  std::cerr << "  --entry=function[,function...]" << std::endl;
+  std::cerr << "  --build" << std::endl;
+  std::cerr << "  -j jobs, --jobs=jobs" << std::endl;
 }
 
 using namespace zips;
 
+// Counts of options are decimal, with nothing after the digits.
+static std::optional<size_t> parseCount(std::string_view text) {
+  size_t count;
+  auto [end, error] =
+      std::from_chars(text.data(), text.data() + text.size(), count);
+  if (error != std::errc() || end != text.data() + text.size()) {
+    return std::nullopt;
+  }
+  return count;
+}
+
+// Arguments are integers, or true and false.
+static std::optional<uint64_t> parseArgument(const std::string &argument) {
+  if (argument == "true" || argument == "false") {
+    return argument == "true";
+  }
+  try {
+    size_t length;
+    uint64_t value = argument.starts_with("-")
+                         ? static_cast<uint64_t>(std::stoll(argument, &length))
+                         : std::stoull(argument, &length);
+    if (length == argument.size()) {
+      return value;
+    }
+  } catch (const std::logic_error &) {
+  }
+  return std::nullopt;
+}
+
+static void printValue(PrimitiveTypeType type, uint64_t value) {
+  if (type == PrimitiveTypeType::BOOL) {
+    std::cout << (value != 0 ? "true" : "false") << std::endl;
+  } else if (isSigned(type)) {
+    std::cout << static_cast<int64_t>(value) << std::endl;
+  } else {
+    std::cout << value << std::endl;
+  }
+}
+
+// Returns the AST of the source's .zpsast file, if there is one newer than
+// the source which loads. Its locations name the source as given, not as it
+// was named when the cache was written, which may have been another path.
+static std::unique_ptr<CompilationUnitNode>
+loadAstCache(const std::string &fileName) {
+  std::string cachePath = getAstCachePath(fileName);
+  std::error_code error;
+  auto cacheTime = std::filesystem::last_write_time(cachePath, error);
+  if (error) {
+    return nullptr;
+  }
+  auto sourceTime = std::filesystem::last_write_time(fileName, error);
+  if (error || cacheTime <= sourceTime) {
+    return nullptr;
+  }
+  std::unique_ptr<AstCacheFile> cache = AstCacheFile::open(cachePath);
+  return cache ? unflatten(cache->getAst(), fileName) : nullptr;
+}
+
+// Writes the cache through a temporary file, so concurrent builds never map
+// a partly written one.
+static bool writeAstCacheFile(const std::string &fileName,
+                              CompilationUnitNode *unit) {
+  std::string cachePath = getAstCachePath(fileName);
+  std::string temporaryPath = cachePath + ".tmp";
+  {
+    std::ofstream output(temporaryPath, std::ios::binary);
+    writeAstCache(flatten(unit), output);
+    if (!output) {
+      perror(temporaryPath.c_str());
+      return false;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(temporaryPath, cachePath, error);
+  if (error) {
+    std::cerr << cachePath << ": " << error.message() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Writes the interface through a temporary file, like the AST cache.
+static bool writeInterfaceFile(const std::string &fileName,
+                               CompilationUnitNode *unit) {
+  std::string interfacePath = getInterfacePath(fileName);
+  std::string temporaryPath = interfacePath + ".tmp";
+  {
+    std::ofstream output(temporaryPath);
+    ModuleInterface::fromAst(getModuleName(fileName), unit).write(output);
+    if (!output) {
+      perror(temporaryPath.c_str());
+      return false;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(temporaryPath, interfacePath, error);
+  if (error) {
+    std::cerr << interfacePath << ": " << error.message() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// The executable is written next to the source, named after it without the
+// extension, through a temporary file like the AST cache.
+static bool writeExecutableFile(const std::string &fileName,
+                                std::string_view image) {
+  std::filesystem::path executablePath =
+      std::filesystem::path(fileName).replace_extension();
+  if (executablePath == fileName) {
+    executablePath += ".out";
+  }
+  std::string temporaryPath = executablePath.string() + ".tmp";
+  {
+    std::ofstream output(temporaryPath, std::ios::binary);
+    output.write(image.data(), static_cast<std::streamsize>(image.size()));
+    if (!output) {
+      perror(temporaryPath.c_str());
+      return false;
+    }
+  }
+  std::error_code error;
+  std::filesystem::permissions(temporaryPath,
+                               std::filesystem::perms::owner_exec |
+                                   std::filesystem::perms::group_exec |
+                                   std::filesystem::perms::others_exec,
+                               std::filesystem::perm_options::add, error);
+  if (!error) {
+    std::filesystem::rename(temporaryPath, executablePath, error);
+  }
+  if (error) {
+    std::cerr << executablePath.string() << ": " << error.message()
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
 int main(int argc, char **argv) {
-  if (argc < 2) {
+  Compiler compiler;
+  std::string fileName;
+  std::vector<std::string> buildFiles;
+  bool build = false;
+  size_t jobs = 1;
+  bool emitInterface = false;
+  std::string executableEntry;
+  std::optional<DiagnosticEngine::Format> diagnosticsFormat;
+  std::optional<size_t> maxDiagnostics;
+  bool instrument = false;
+  bool fold = true;
+  bool printFoldingStatistics = false;
+  bool printCounters = false;
+  std::vector<std::string> entryPoints;
+  std::optional<Profile> profile;
+  bool printAstStatistics = false;
+  bool emitAstBinary = false;
+  bool printMemoryUsage = false;
+  std::optional<size_t> memoryBudget;
+  std::string interpretedFunction;
+  std::vector<uint64_t> interpreterArguments;
+  for (int i = 1; i < argc; i++) {
+    std::string_view argument = argv[i];
+    if (argument == "--diagnostics-format=json") {
+      diagnosticsFormat = DiagnosticEngine::Format::JSON;
+    } else if (argument == "--diagnostics-format=text") {
+      diagnosticsFormat = DiagnosticEngine::Format::TEXT;
+    } else if (argument.starts_with("--max-diagnostics=")) {
+      maxDiagnostics = parseCount(argument.substr(18));
+      if (!maxDiagnostics) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (argument == "--ast-stats") {
+      printAstStatistics = true;
+    } else if (argument == "--emit-ast-bin") {
+      emitAstBinary = true;
+    } else if (argument == "--mem-report") {
+      printMemoryUsage = true;
+      MemoryTracker::setEnabled(true);
+    } else if (argument.starts_with("--mem-budget=")) {
+      memoryBudget = parseCount(argument.substr(13));
+      if (!memoryBudget) {
+        usage(argv[0]);
+        return 1;
+      }
+      MemoryTracker::setEnabled(true);
+    } else if (argument == "--instrument") {
+      instrument = true;
+    } else if (argument.starts_with("--profile-use=")) {
+      std::string profileName(argument.substr(14));
+      std::ifstream profileInput(profileName);
+      if (!profileInput) {
+        perror(profileName.c_str());
+        return 1;
+      }
+      profile = Profile::read(profileInput);
+      if (!profile) {
+        std::cerr << profileName << ": malformed profile" << std::endl;
+        return 1;
+      }
+    } else if (argument == "--no-fold") {
+      fold = false;
+    } else if (argument == "--fold-stats") {
+      printFoldingStatistics = true;
+    } else if (argument == "--work-counters") {
+      printCounters = true;
+    } else if (argument.starts_with("--interpret=")) {
+      interpretedFunction = argument.substr(12);
+    } else if (argument.starts_with("--entry=")) {
+      std::string_view names = argument.substr(8);
+      while (!names.empty()) {
+        size_t comma = std::min(names.find(','), names.size());
+        entryPoints.emplace_back(names.substr(0, comma));
+        names.remove_prefix(std::min(comma + 1, names.size()));
+      }
+    } else if (argument == "--emit-interface") {
+      emitInterface = true;
+    } else if (argument.starts_with("--emit-executable=")) {
+      executableEntry = argument.substr(18);
+    } else if (argument == "--build") {
+      build = true;
+    } else if (argument.starts_with("--jobs=") ||
+               (argument == "-j" && i + 1 < argc)) {
+      std::optional<size_t> count =
+          parseCount(argument == "-j" ? argv[++i] : argument.substr(7));
+      if (!count) {
+        usage(argv[0]);
+        return 1;
+      }
+      jobs = *count;
+    } else if (build && !argument.starts_with("-")) {
+      buildFiles.emplace_back(argument);
+    } else if (!interpretedFunction.empty() && !fileName.empty()) {
+      std::optional<uint64_t> value = parseArgument(std::string(argument));
+      if (!value) {
+        std::cerr << argument << ": invalid argument" << std::endl;
+        return 1;
+      }
+      interpreterArguments.push_back(*value);
+    } else if (argument.starts_with("--") || !fileName.empty()) {
+      usage(argv[0]);
+      return 1;
+    } else {
+      fileName = argument;
+    }
+  }
+  // Only what the entry function needs goes into an executable.
+  if (!executableEntry.empty() && entryPoints.empty()) {
+    entryPoints.push_back(executableEntry);
+  }
+  // Applied to each compiler, since builds have one per worker.
+  auto configure = [&](Compiler &compiler) {
+    if (diagnosticsFormat) {
+      compiler.getDiagnostics().setFormat(*diagnosticsFormat);
+    }
+    if (maxDiagnostics) {
+      compiler.getDiagnostics().setLimit(*maxDiagnostics);
+    }
+    compiler.setInstrumentation(instrument);
+    compiler.setProfile(profile);
+    compiler.setFolding(fold);
+    compiler.setEntryPoints(entryPoints);
+  };
+  if (build) {
+    // Entry points are per program, while a build has one per module.
+    if (buildFiles.empty() || !interpretedFunction.empty() || emitAstBinary ||
+        !entryPoints.empty() || !executableEntry.empty()) {
+      usage(argv[0]);
+      return 1;
+    }
+    return buildModules(buildFiles, ModuleBuildOptions{jobs, configure}) ? 0
+                                                                         : 1;
+  }
+  configure(compiler);
+  compiler.setExecutableEntry(executableEntry);
+  if (fileName.empty()) {
     usage(argv[0]);
     return 1;
   }
-  std::string fileName = argv[1];
+  // Imports are the .zpsi files of modules built earlier, next to the source.
+  compiler.setImportResolver([&](const std::string &moduleName) {
+    std::filesystem::path directory =
+        std::filesystem::path(fileName).parent_path();
+    return readInterfaceFile((directory / (moduleName + ".zpsi")).string());
+  });
   std::ifstream input(fileName);
   if (!input) {
     perror(fileName.c_str());
     return 1;
   }
-  std::unique_ptr<AstNode> ast;
-  Lexer lexer(input, fileName);
-  Parser parser(lexer, fileName, &ast);
-  int result = parser();
+  std::string source{std::istreambuf_iterator<char>(input),
+                     std::istreambuf_iterator<char>()};
   input.close();
-  if (result == 0) {
+  if (emitAstBinary) {
+    return compiler.check(source, fileName) &&
+                   writeAstCacheFile(fileName, compiler.getAst())
+               ? 0
+               : 1;
+  }
+  // A cached AST skips lexing, parsing and type checking. It has every
+  // function checked, so it isn't used with entry points.
+  std::unique_ptr<CompilationUnitNode> cachedAst =
+      entryPoints.empty() ? loadAstCache(fileName) : nullptr;
+  if (!interpretedFunction.empty()) {
+    if (!cachedAst && !compiler.check(source, fileName)) {
+      return 1;
+    }
     try {
-      checkTypes(ast.get());
-      CodeGenerator<TargetArchitecture::X86_64, TargetAbi::X86_64>
-          codeGenerator;
-      std::cout << codeGenerator.generate(
-                       static_cast<CompilationUnitNode *>(ast.get()))
-                << std::endl;
+      BytecodeInterpreter interpreter(cachedAst ? cachedAst.get()
+                                                : compiler.getAst());
+      const BytecodeFunction *function =
+          interpreter.getFunction(interpretedFunction);
+      if (!function) {
+        std::cerr << interpretedFunction << ": no such function" << std::endl;
+        return 1;
+      }
+      if (interpreterArguments.size() != function->parameterTypes.size()) {
+        std::cerr << interpretedFunction << " takes "
+                  << function->parameterTypes.size() << " arguments"
+                  << std::endl;
+        return 1;
+      }
+      printValue(function->returnType,
+                 interpreter.call(*function, interpreterArguments));
     } catch (const ZipsError &e) {
-      error(e);
-    } catch (std::runtime_error &e) {
+      // Functions beyond the limits of the bytecode, reported like the
+      // errors of compiling them.
+      DiagnosticEngine &diagnostics = compiler.getDiagnostics();
+      {
+        DiagnosticScope diagnosticScope(&diagnostics);
+        error(e);
+      }
+      diagnostics.flush(std::cout);
+      return 1;
+    } catch (const std::runtime_error &e) {
       std::cerr << e.what() << std::endl;
+      return 1;
     }
-  } else {
-    std::cerr << "Error!" << std::endl;
+    return 0;
+  }
+  bool compiled = cachedAst ? compiler.compile(std::move(cachedAst))
+                            : compiler.compile(source, fileName);
+  if (printCounters) {
+    printWorkCounters(std::cerr, getWorkCounters());
+  }
+  if (MemoryTracker::isEnabled()) {
+    MemoryReport report = MemoryTracker::getReport();
+    size_t lineCount = std::count(source.begin(), source.end(), '\n') +
+                       (!source.empty() && source.back() != '\n');
+    if (printMemoryUsage) {
+      printMemoryReport(std::cerr, report, lineCount);
+    }
+    if (memoryBudget &&
+        report.peakLiveBytes > *memoryBudget * std::max<size_t>(lineCount, 1)) {
+      std::cerr << "Memory high-water mark of " << report.peakLiveBytes
+                << " bytes exceeds the budget of " << *memoryBudget
+                << " bytes per line for " << lineCount << " lines"
+                << std::endl;
+      return 1;
+    }
+  }
+  if (!compiled) {
+    return 1;
+  }
+  if (emitInterface && !writeInterfaceFile(fileName, compiler.getAst())) {
+    return 1;
+  }
+  if (!executableEntry.empty()) {
+    return writeExecutableFile(fileName, compiler.getOutput()) ? 0 : 1;
+  }
+  if (printAstStatistics) {
+    FlatAst flatAst = flatten(compiler.getAst());
+    AstMemoryStatistics statistics = measureAst(compiler.getAst(), flatAst);
+    std::cerr << "AST nodes: " << statistics.nodeCount << std::endl;
+    std::cerr << "Tree AST bytes: " << statistics.treeBytes << std::endl;
+    std::cerr << "Flat AST bytes: " << statistics.flatBytes << std::endl;
+  }
+  if (printFoldingStatistics) {
+    const FoldingStatistics &statistics = compiler.getFoldingStatistics();
+    std::cerr << "Folded functions: " << statistics.foldedFunctionCount
+              << std::endl;
+    std::cerr << "Folded instructions: " << statistics.instructionCount
+              << std::endl;
+    std::cerr << "Folded code bytes: " << statistics.codeBytes << std::endl;
   }
+  std::cout << compiler.getOutput() << std::endl;
 }
@@ -0,0 +1,70 @@
+// Replaces the global allocation functions to feed MemoryTracker. Only the
+// zips executable and the parser benchmark link this, so programs using the
+// library keep their own allocator.
+//
+// Each block is prefixed with its size and tag, which keeps the default new
+// alignment. Over-aligned allocations keep the default functions and aren't
+// counted.
+#include "memoryUsage.h"
+#include <cstdlib>
+#include <new>
+
+namespace {
+struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) AllocationHeader {
+  size_t size;
+  uint32_t tag;
+};
+
+void *allocate(size_t size) noexcept {
+  void *block = std::malloc(sizeof(AllocationHeader) + size);
+  if (!block) {
+    return nullptr;
+  }
+  auto header = static_cast<AllocationHeader *>(block);
+  header->size = size;
+  header->tag = zips::MemoryTracker::recordAllocation(size);
+  return header + 1;
+}
+
+void *allocateOrThrow(size_t size) {
+  while (true) {
+    if (void *pointer = allocate(size)) {
+      return pointer;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if (!handler) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+void deallocate(void *pointer) noexcept {
+  if (!pointer) {
+    return;
+  }
+  auto header = static_cast<AllocationHeader *>(pointer) - 1;
+  zips::MemoryTracker::recordDeallocation(header->size, header->tag);
+  std::free(header);
+}
+} // namespace
+
+void *operator new(size_t size) { return allocateOrThrow(size); }
+void *operator new[](size_t size) { return allocateOrThrow(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size);
+}
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size);
+}
+
+void operator delete(void *pointer) noexcept { deallocate(pointer); }
+void operator delete[](void *pointer) noexcept { deallocate(pointer); }
+void operator delete(void *pointer, size_t) noexcept { deallocate(pointer); }
+void operator delete[](void *pointer, size_t) noexcept { deallocate(pointer); }
+void operator delete(void *pointer, const std::nothrow_t &) noexcept {
+  deallocate(pointer);
+}
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept {
+  deallocate(pointer);
+}
@@ -0,0 +1,136 @@
+#include "memoryUsage.h"
+#include "probes.h"
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <iterator>
+#include <mutex>
+#include <string_view>
+
+namespace zips {
+static constexpr std::string_view phaseNames[] = {
+    "startup", "parsing", "type checking", "code generation"};
+static_assert(std::size(phaseNames) == MEMORY_PHASE_COUNT);
+static constexpr std::string_view categoryNames[] = {
+    "other", "tokens", "ast", "types", "instructions", "output"};
+static_assert(std::size(categoryNames) == MEMORY_CATEGORY_COUNT);
+
+static constexpr MemoryCategory defaultCategories[] = {
+    MemoryCategory::OTHER, MemoryCategory::AST, MemoryCategory::TYPES,
+    MemoryCategory::INSTRUCTIONS};
+static_assert(std::size(defaultCategories) == MEMORY_PHASE_COUNT);
+
+// Tags are the phase and category, with a bit telling counted allocations
+// from the ones made while disabled.
+static constexpr uint32_t countedTag = 1 << 16;
+
+// Everything here is constant initialized, since the allocator hook may run
+// before dynamic initialization.
+static std::atomic<bool> trackingEnabled = false;
+static std::mutex mutex;
+static MemoryReport report;
+static thread_local MemoryPhase currentPhase = MemoryPhase::STARTUP;
+static thread_local MemoryCategory currentCategory = MemoryCategory::OTHER;
+
+static void add(MemoryCounters &counters, size_t size) {
+  counters.allocationCount++;
+  counters.allocatedBytes += size;
+  counters.liveBytes += size;
+  counters.peakLiveBytes = std::max(counters.peakLiveBytes, counters.liveBytes);
+}
+
+void MemoryTracker::setEnabled(bool enabled) { trackingEnabled = enabled; }
+bool MemoryTracker::isEnabled() { return trackingEnabled; }
+
+uint32_t MemoryTracker::recordAllocation(size_t size) {
+  if (!trackingEnabled) {
+    return 0;
+  }
+  std::lock_guard lock(mutex);
+  add(report.categories[static_cast<size_t>(currentCategory)], size);
+  add(report.phases[static_cast<size_t>(currentPhase)], size);
+  report.liveBytes += size;
+  if (report.liveBytes > report.peakLiveBytes) {
+    report.peakLiveBytes = report.liveBytes;
+    report.peakPhase = currentPhase;
+    for (size_t i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+      report.peakCategoryBytes[i] = report.categories[i].liveBytes;
+    }
+  }
+  // The phase's peak counts everything live, not just its own allocations.
+  MemoryCounters &phase = report.phases[static_cast<size_t>(currentPhase)];
+  phase.peakLiveBytes = std::max(phase.peakLiveBytes, report.liveBytes);
+  return countedTag | static_cast<uint32_t>(currentPhase) << 8 |
+         static_cast<uint32_t>(currentCategory);
+}
+
+void MemoryTracker::recordDeallocation(size_t size, uint32_t tag) {
+  if (!(tag & countedTag)) {
+    return;
+  }
+  std::lock_guard lock(mutex);
+  report.phases[(tag >> 8) & 0xff].liveBytes -= size;
+  report.categories[tag & 0xff].liveBytes -= size;
+  report.liveBytes -= size;
+}
+
+MemoryPhase MemoryTracker::getPhase() { return currentPhase; }
+void MemoryTracker::setPhase(MemoryPhase phase) { currentPhase = phase; }
+MemoryCategory MemoryTracker::getCategory() { return currentCategory; }
+void MemoryTracker::setCategory(MemoryCategory category) {
+  currentCategory = category;
+}
+
+MemoryReport MemoryTracker::getReport() {
+  std::lock_guard lock(mutex);
+  return report;
+}
+
+MemoryPhaseScope::MemoryPhaseScope(MemoryPhase phase)
+    : previousPhase(currentPhase), previousCategory(currentCategory) {
+  currentPhase = phase;
+  currentCategory = defaultCategories[static_cast<size_t>(phase)];
+  ZIPS_PROBE1(phase__begin, phaseNames[static_cast<size_t>(phase)].data());
+}
+
+MemoryPhaseScope::~MemoryPhaseScope() {
+  ZIPS_PROBE1(phase__end, phaseNames[static_cast<size_t>(currentPhase)].data());
+  currentPhase = previousPhase;
+  currentCategory = previousCategory;
+}
+
+static void printRow(std::ostream &output, std::string_view name,
+                     const MemoryCounters &counters) {
+  output << "  " << std::left << std::setw(18) << name << std::right
+         << std::setw(12) << counters.allocationCount << std::setw(16)
+         << counters.allocatedBytes << std::setw(14) << counters.liveBytes
+         << std::setw(14) << counters.peakLiveBytes << "\n";
+}
+
+void printMemoryReport(std::ostream &output, const MemoryReport &report,
+                       size_t lineCount) {
+  auto printHeader = [&](std::string_view title) {
+    output << std::left << std::setw(20) << title << std::right
+           << std::setw(12) << "allocations" << std::setw(16) << "allocated"
+           << std::setw(14) << "live" << std::setw(14) << "peak" << "\n";
+  };
+  printHeader("Phase");
+  for (size_t i = 0; i < MEMORY_PHASE_COUNT; i++) {
+    printRow(output, phaseNames[i], report.phases[i]);
+  }
+  printHeader("Category");
+  for (size_t i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+    printRow(output, categoryNames[i], report.categories[i]);
+  }
+  output << "High-water mark: " << report.peakLiveBytes << " bytes during "
+         << phaseNames[static_cast<size_t>(report.peakPhase)] << ", "
+         << report.peakLiveBytes / std::max<size_t>(lineCount, 1)
+         << " bytes per source line\n";
+  for (size_t i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+    output << "  " << std::left << std::setw(18) << categoryNames[i]
+           << std::right << std::setw(12) << report.peakCategoryBytes[i]
+           << "\n";
+  }
+  output << std::flush;
+}
+} // namespace zips
@@ -0,0 +1,111 @@
+#ifndef ZIPS_MEMORY_USAGE_H
+#define ZIPS_MEMORY_USAGE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace zips {
+enum class MemoryPhase : uint8_t {
+  STARTUP,
+  PARSING,
+  TYPE_CHECKING,
+  CODE_GENERATION
+};
+// Must be kept in sync with the last MemoryPhase.
+static constexpr size_t MEMORY_PHASE_COUNT =
+    static_cast<size_t>(MemoryPhase::CODE_GENERATION) + 1;
+
+// What an allocation is for. Each phase has a default category, which
+// MemoryCategoryScope overrides for the parts of a phase doing something else.
+enum class MemoryCategory : uint8_t {
+  OTHER,
+  TOKENS,
+  AST,
+  TYPES,
+  INSTRUCTIONS,
+  OUTPUT
+};
+// Must be kept in sync with the last MemoryCategory.
+static constexpr size_t MEMORY_CATEGORY_COUNT =
+    static_cast<size_t>(MemoryCategory::OUTPUT) + 1;
+
+struct MemoryCounters {
+  size_t allocationCount = 0;
+  size_t allocatedBytes = 0;
+  size_t liveBytes = 0;
+  size_t peakLiveBytes = 0;
+};
+
+struct MemoryReport {
+  // Allocations are attributed to the phase and category current when they
+  // are made, and so are their deallocations. A phase's peak is the most
+  // memory live in total while it was running.
+  std::array<MemoryCounters, MEMORY_PHASE_COUNT> phases;
+  std::array<MemoryCounters, MEMORY_CATEGORY_COUNT> categories;
+  size_t liveBytes = 0;
+  size_t peakLiveBytes = 0;
+  // Where the memory live at the high-water mark came from.
+  MemoryPhase peakPhase = MemoryPhase::STARTUP;
+  std::array<size_t, MEMORY_CATEGORY_COUNT> peakCategoryBytes{};
+};
+
+/**
+ * @brief counts live bytes and allocations by phase and category.
+ *
+ * The counting only happens once the program links an allocator hook calling
+ * recordAllocation and recordDeallocation, like the zips executable does
+ * with --mem-report, and tracking is enabled. The phase and category are
+ * per thread.
+ */
+class MemoryTracker {
+public:
+  // Allocations made while disabled are never counted, not even when they
+  // are freed.
+  static void setEnabled(bool enabled);
+  static bool isEnabled();
+
+  // Returns the tag the hook keeps with the allocation for recordDeallocation.
+  static uint32_t recordAllocation(size_t size);
+  static void recordDeallocation(size_t size, uint32_t tag);
+
+  static MemoryPhase getPhase();
+  static void setPhase(MemoryPhase phase);
+  static MemoryCategory getCategory();
+  static void setCategory(MemoryCategory category);
+
+  static MemoryReport getReport();
+};
+
+// Sets the phase, and the phase's default category, until destroyed.
+class MemoryPhaseScope {
+  MemoryPhase previousPhase;
+  MemoryCategory previousCategory;
+
+public:
+  explicit MemoryPhaseScope(MemoryPhase phase);
+  ~MemoryPhaseScope();
+  MemoryPhaseScope(const MemoryPhaseScope &) = delete;
+  MemoryPhaseScope &operator=(const MemoryPhaseScope &) = delete;
+};
+
+class MemoryCategoryScope {
+  MemoryCategory previousCategory;
+
+public:
+  explicit MemoryCategoryScope(MemoryCategory category)
+      : previousCategory(MemoryTracker::getCategory()) {
+    MemoryTracker::setCategory(category);
+  }
+  ~MemoryCategoryScope() { MemoryTracker::setCategory(previousCategory); }
+  MemoryCategoryScope(const MemoryCategoryScope &) = delete;
+  MemoryCategoryScope &operator=(const MemoryCategoryScope &) = delete;
+};
+
+// Prints the counters as tables, with the high-water mark per source line.
+void printMemoryReport(std::ostream &output, const MemoryReport &report,
+                       size_t lineCount);
+} // namespace zips
+
+#endif
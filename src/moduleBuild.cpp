@@ -0,0 +1,362 @@
+#include "moduleBuild.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <thread>
+
+namespace zips {
+namespace {
+struct Module {
+  std::string name;
+  std::string sourcePath;
+  // Null once compiled, and for modules which are up to date; those are only
+  // parsed if the interface of an import changes.
+  std::unique_ptr<CompilationUnitNode> ast;
+  bool upToDate = false;
+  bool failed = false;
+  // The modules of this build which this one imports, and which import it.
+  std::vector<size_t> imports;
+  std::vector<size_t> dependents;
+  size_t pendingImports = 0;
+  bool importFailed = false;
+  bool importChanged = false;
+  bool interfaceChanged = false;
+  std::shared_ptr<const ModuleInterface> interface;
+};
+
+std::string getAssemblyPath(std::string_view sourcePath) {
+  return std::filesystem::path(sourcePath).replace_extension(".s").string();
+}
+
+// Imports are looked up in the directory of the importing source.
+std::string getImportPath(std::string_view importerPath,
+                          const std::string &moduleName,
+                          std::string_view extension) {
+  return (std::filesystem::path(importerPath).parent_path() /
+          (moduleName + std::string(extension)))
+      .string();
+}
+
+std::optional<std::filesystem::file_time_type>
+getWriteTime(const std::string &fileName) {
+  std::error_code error;
+  auto time = std::filesystem::last_write_time(fileName, error);
+  if (error) {
+    return std::nullopt;
+  }
+  return time;
+}
+
+std::optional<std::string> readFile(const std::string &fileName) {
+  std::ifstream input(fileName, std::ios::binary);
+  if (!input) {
+    return std::nullopt;
+  }
+  return std::string{std::istreambuf_iterator<char>(input),
+                     std::istreambuf_iterator<char>()};
+}
+
+// Writes through a temporary file, so concurrent builds never read a partly
+// written one.
+bool writeFile(const std::string &fileName, std::string_view contents) {
+  std::string temporaryPath = fileName + ".tmp";
+  {
+    std::ofstream output(temporaryPath, std::ios::binary);
+    output.write(contents.data(), contents.size());
+    if (!output) {
+      perror(temporaryPath.c_str());
+      return false;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(temporaryPath, fileName, error);
+  if (error) {
+    std::cerr << fileName << ": " << error.message() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+class ModuleBuild {
+  const ModuleBuildOptions &options;
+  std::vector<Module> modules;
+  std::map<std::string, size_t, std::less<>> moduleIndices;
+
+  // Guards the scheduling state, the modules' import flags and the output.
+  std::mutex mutex;
+  std::condition_variable readyChanged;
+  std::deque<size_t> ready;
+  size_t remaining = 0;
+  bool succeeded = true;
+
+  void configure(Compiler &compiler) const {
+    if (options.configure) {
+      options.configure(compiler);
+    }
+  }
+
+  std::optional<size_t> addModule(const std::string &sourcePath,
+                                  std::vector<size_t> &worklist) {
+    std::string name = getModuleName(sourcePath);
+    auto found = moduleIndices.find(name);
+    if (found != moduleIndices.end()) {
+      const std::string &otherPath = modules[found->second].sourcePath;
+      std::error_code error;
+      if (!std::filesystem::equivalent(otherPath, sourcePath, error)) {
+        std::cerr << sourcePath << ": module " << name
+                  << " is already defined by " << otherPath << std::endl;
+        return std::nullopt;
+      }
+      return found->second;
+    }
+    size_t index = modules.size();
+    modules.push_back(Module{name, sourcePath});
+    moduleIndices.emplace(std::move(name), index);
+    worklist.push_back(index);
+    return index;
+  }
+
+  // Finds the modules of the sources and everything they import. Sources are
+  // parsed one at a time here, since their imports are only known once they
+  // are.
+  bool discover(const std::vector<std::string> &sourcePaths) {
+    Compiler compiler;
+    configure(compiler);
+    std::vector<size_t> worklist;
+    bool discovered = true;
+    for (auto &sourcePath : sourcePaths) {
+      discovered = addModule(sourcePath, worklist).has_value() && discovered;
+    }
+    for (size_t next = 0; next < worklist.size(); next++) {
+      size_t index = worklist[next];
+      std::string sourcePath = modules[index].sourcePath;
+      auto sourceTime = getWriteTime(sourcePath);
+      auto assemblyTime = getWriteTime(getAssemblyPath(sourcePath));
+      std::vector<std::string> importNames;
+      if (sourceTime && assemblyTime && *assemblyTime > *sourceTime &&
+          (modules[index].interface =
+               readInterfaceFile(getInterfacePath(sourcePath)))) {
+        modules[index].upToDate = true;
+        importNames = modules[index].interface->getImports();
+      } else {
+        std::optional<std::string> source = readFile(sourcePath);
+        if (!source) {
+          perror(sourcePath.c_str());
+          modules[index].failed = true;
+          continue;
+        }
+        if (!compiler.parse(*source, sourcePath)) {
+          modules[index].failed = true;
+          continue;
+        }
+        modules[index].ast = compiler.takeAst();
+        for (auto &import : modules[index].ast->getImports()) {
+          importNames.push_back(import.moduleName);
+        }
+      }
+      for (auto &importName : importNames) {
+        std::string importPath = getImportPath(sourcePath, importName, ".zps");
+        if (!std::filesystem::exists(importPath)) {
+          // A prebuilt interface, which the assembly must be newer than.
+          auto interfaceTime =
+              getWriteTime(getImportPath(sourcePath, importName, ".zpsi"));
+          if (!interfaceTime || !assemblyTime ||
+              *interfaceTime >= *assemblyTime) {
+            modules[index].importChanged = true;
+          }
+          continue;
+        }
+        std::optional<size_t> importIndex = addModule(importPath, worklist);
+        if (!importIndex) {
+          discovered = false;
+          continue;
+        }
+        std::vector<size_t> &imports = modules[index].imports;
+        if (std::find(imports.begin(), imports.end(), *importIndex) ==
+            imports.end()) {
+          imports.push_back(*importIndex);
+        }
+      }
+    }
+    return discovered;
+  }
+
+  // Depth first, with marks of 1 for modules on the path and 2 for finished
+  // ones.
+  bool findCycle(size_t index, std::vector<uint8_t> &marks,
+                 std::vector<size_t> &path) {
+    marks[index] = 1;
+    path.push_back(index);
+    for (size_t import : modules[index].imports) {
+      if (marks[import] == 1) {
+        std::cerr << "Import cycle: ";
+        auto cycleBegin = std::find(path.begin(), path.end(), import);
+        for (auto module = cycleBegin; module != path.end(); module++) {
+          std::cerr << modules[*module].name << " -> ";
+        }
+        std::cerr << modules[import].name << std::endl;
+        return true;
+      }
+      if (marks[import] == 0 && findCycle(import, marks, path)) {
+        return true;
+      }
+    }
+    path.pop_back();
+    marks[index] = 2;
+    return false;
+  }
+
+  std::shared_ptr<const ModuleInterface>
+  resolveImport(size_t importer, const std::string &moduleName) {
+    for (size_t import : modules[importer].imports) {
+      if (modules[import].name == moduleName) {
+        return modules[import].interface;
+      }
+    }
+    return readInterfaceFile(
+        getImportPath(modules[importer].sourcePath, moduleName, ".zpsi"));
+  }
+
+  bool build(Compiler &compiler, size_t index) {
+    Module &module = modules[index];
+    if (module.failed) {
+      return false;
+    } else if (module.importFailed) {
+      std::lock_guard lock(mutex);
+      std::cerr << module.sourcePath << ": skipped, since an import failed"
+                << std::endl;
+      return false;
+    } else if (module.upToDate && !module.importChanged) {
+      return true;
+    }
+    if (!module.ast) {
+      std::optional<std::string> source = readFile(module.sourcePath);
+      if (!source) {
+        perror(module.sourcePath.c_str());
+        return false;
+      }
+      if (!compiler.parse(*source, module.sourcePath)) {
+        return false;
+      }
+      module.ast = compiler.takeAst();
+    }
+    if (!compiler.checkAndCompile(std::move(module.ast))) {
+      return false;
+    }
+    std::string assembly(compiler.getOutput());
+    assembly += '\n';
+    if (!writeFile(getAssemblyPath(module.sourcePath), assembly)) {
+      return false;
+    }
+    // An interface which didn't change is left alone, so that dependents
+    // aren't compiled again.
+    ModuleInterface interface =
+        ModuleInterface::fromAst(module.name, compiler.getAst());
+    std::ostringstream interfaceText;
+    interface.write(interfaceText);
+    std::string interfacePath = getInterfacePath(module.sourcePath);
+    module.interfaceChanged = readFile(interfacePath) != interfaceText.str();
+    if (module.interfaceChanged &&
+        !writeFile(interfacePath, interfaceText.str())) {
+      return false;
+    }
+    module.interface =
+        std::make_shared<const ModuleInterface>(std::move(interface));
+    return true;
+  }
+
+  void finish(size_t index, bool built) {
+    Module &module = modules[index];
+    succeeded = succeeded && built;
+    for (size_t dependent : module.dependents) {
+      modules[dependent].importFailed |= !built;
+      modules[dependent].importChanged |= module.interfaceChanged;
+      if (--modules[dependent].pendingImports == 0) {
+        ready.push_back(dependent);
+      }
+    }
+    remaining--;
+    readyChanged.notify_all();
+  }
+
+  void work() {
+    Compiler compiler;
+    configure(compiler);
+    std::ostringstream diagnosticOutput;
+    compiler.setDiagnosticOutput(diagnosticOutput);
+    size_t current = 0;
+    compiler.setImportResolver([&](const std::string &moduleName) {
+      return resolveImport(current, moduleName);
+    });
+    while (true) {
+      {
+        std::unique_lock lock(mutex);
+        readyChanged.wait(lock,
+                          [&] { return !ready.empty() || remaining == 0; });
+        if (ready.empty()) {
+          return;
+        }
+        current = ready.front();
+        ready.pop_front();
+      }
+      bool built = build(compiler, current);
+      std::lock_guard lock(mutex);
+      std::cout << diagnosticOutput.str() << std::flush;
+      diagnosticOutput.str("");
+      finish(current, built);
+    }
+  }
+
+public:
+  explicit ModuleBuild(const ModuleBuildOptions &options) : options(options) {}
+
+  bool run(const std::vector<std::string> &sourcePaths) {
+    if (!discover(sourcePaths)) {
+      return false;
+    }
+    std::vector<uint8_t> marks(modules.size());
+    std::vector<size_t> path;
+    for (size_t i = 0; i < modules.size(); i++) {
+      if (marks[i] == 0 && findCycle(i, marks, path)) {
+        return false;
+      }
+    }
+    for (size_t i = 0; i < modules.size(); i++) {
+      for (size_t import : modules[i].imports) {
+        modules[import].dependents.push_back(i);
+      }
+      modules[i].pendingImports = modules[i].imports.size();
+      if (modules[i].pendingImports == 0) {
+        ready.push_back(i);
+      }
+    }
+    remaining = modules.size();
+    size_t jobs = std::clamp<size_t>(options.jobs, 1, modules.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < jobs; i++) {
+      workers.emplace_back([this] { work(); });
+    }
+    for (auto &worker : workers) {
+      worker.join();
+    }
+    return succeeded;
+  }
+};
+} // namespace
+
+bool buildModules(const std::vector<std::string> &sourcePaths,
+                  const ModuleBuildOptions &options) {
+  if (sourcePaths.empty()) {
+    return true;
+  }
+  return ModuleBuild(options).run(sourcePaths);
+}
+} // namespace zips
@@ -0,0 +1,34 @@
+#ifndef ZIPS_MODULE_BUILD_H
+#define ZIPS_MODULE_BUILD_H
+
+#include "compiler.h"
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace zips {
+struct ModuleBuildOptions {
+  // How many modules are checked and compiled at once.
+  size_t jobs = 1;
+  // Applies the command line options to each worker's compiler.
+  std::function<void(Compiler &)> configure;
+};
+
+/**
+ * @brief compiles the given modules and the modules they import.
+ *
+ * Imports are looked up next to the importing source, as name.zps, or as a
+ * prebuilt name.zpsi without a source. Each module is written to name.s and
+ * name.zpsi next to its source. A module is only compiled once everything it
+ * imports is, and modules which don't depend on each other are compiled in
+ * parallel. Modules whose assembly is newer than their source are skipped,
+ * unless the interface of an import changed.
+ *
+ * Returns false if any module failed, or the imports form a cycle.
+ */
+bool buildModules(const std::vector<std::string> &sourcePaths,
+                  const ModuleBuildOptions &options);
+} // namespace zips
+
+#endif
@@ -0,0 +1,118 @@
+#include "moduleInterface.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace zips {
+static std::unique_ptr<Type> parseType(std::string_view name) {
+  for (auto &[type, typeName] : primitiveTypeTypeToString) {
+    if (typeName == name) {
+      return std::make_unique<PrimitiveTypeNode>(type);
+    }
+  }
+  return nullptr;
+}
+
+ModuleInterface ModuleInterface::fromAst(std::string moduleName,
+                                         CompilationUnitNode *unit) {
+  ModuleInterface interface(std::move(moduleName));
+  for (auto &import : unit->getImports()) {
+    interface.imports.push_back(import.moduleName);
+  }
+  for (auto &node : unit->getNodes()) {
+    auto function = static_cast<FunctionNode *>(node.get());
+    interface.functions.push_back(ExportedFunction{
+        function->getName(),
+        std::unique_ptr<FunctionTypeNode>(static_cast<FunctionTypeNode *>(
+            function->type->get()->clone().release()))});
+  }
+  return interface;
+}
+
+std::optional<ModuleInterface> ModuleInterface::read(std::istream &input) {
+  std::string line;
+  std::string magic;
+  uint32_t version = 0;
+  if (!std::getline(input, line) ||
+      !(std::istringstream(line) >> magic >> version) ||
+      magic != "zips-interface" || version != MODULE_INTERFACE_VERSION) {
+    return std::nullopt;
+  }
+  std::string keyword;
+  std::string moduleName;
+  if (!std::getline(input, line) ||
+      !(std::istringstream(line) >> keyword >> moduleName) ||
+      keyword != "module") {
+    return std::nullopt;
+  }
+  ModuleInterface interface(std::move(moduleName));
+  while (std::getline(input, line)) {
+    std::istringstream fields(line);
+    std::string name;
+    if (!(fields >> keyword)) {
+      continue;
+    }
+    if (!(fields >> name)) {
+      return std::nullopt;
+    }
+    if (keyword == "import") {
+      interface.imports.push_back(std::move(name));
+      continue;
+    } else if (keyword != "function") {
+      return std::nullopt;
+    }
+    std::vector<std::unique_ptr<Type>> parameterTypes;
+    std::unique_ptr<Type> returnType;
+    std::string typeName;
+    while (fields >> typeName && typeName != "->") {
+      parameterTypes.push_back(parseType(typeName));
+      if (!parameterTypes.back()) {
+        return std::nullopt;
+      }
+    }
+    if (typeName != "->" || !(fields >> typeName) ||
+        !(returnType = parseType(typeName)) || fields >> typeName) {
+      return std::nullopt;
+    }
+    interface.functions.push_back(ExportedFunction{
+        std::move(name), std::make_unique<FunctionTypeNode>(
+                             std::move(parameterTypes), std::move(returnType))});
+  }
+  return interface;
+}
+
+void ModuleInterface::write(std::ostream &output) const {
+  output << "zips-interface " << MODULE_INTERFACE_VERSION << "\n";
+  output << "module " << moduleName << "\n";
+  for (auto &import : imports) {
+    output << "import " << import << "\n";
+  }
+  for (auto &function : functions) {
+    output << "function " << function.name;
+    for (auto &parameterType : function.type->getParameterTypes()) {
+      output << ' ' << parameterType->toString();
+    }
+    output << " -> " << function.type->getReturnType()->toString() << "\n";
+  }
+}
+
+std::shared_ptr<const ModuleInterface>
+readInterfaceFile(const std::string &fileName) {
+  std::ifstream input(fileName);
+  if (!input) {
+    return nullptr;
+  }
+  std::optional<ModuleInterface> interface = ModuleInterface::read(input);
+  return interface ? std::make_shared<const ModuleInterface>(
+                         std::move(*interface))
+                   : nullptr;
+}
+
+std::string getModuleName(std::string_view sourcePath) {
+  return std::filesystem::path(sourcePath).stem().string();
+}
+
+std::string getInterfacePath(std::string_view sourcePath) {
+  return std::filesystem::path(sourcePath).replace_extension(".zpsi").string();
+}
+} // namespace zips
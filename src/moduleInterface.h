@@ -0,0 +1,66 @@
+#ifndef ZIPS_MODULE_INTERFACE_H
+#define ZIPS_MODULE_INTERFACE_H
+
+#include "ast.h"
+#include "type.h"
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace zips {
+// Must be increased whenever the format of .zpsi files changes.
+static constexpr uint32_t MODULE_INTERFACE_VERSION = 1;
+
+struct ExportedFunction {
+  std::string name;
+  std::unique_ptr<FunctionTypeNode> type;
+};
+
+/**
+ * @brief what other modules need to know about a type checked module.
+ *
+ * Modules importing it are checked against the signatures alone, without
+ * parsing the module's source. Every function is exported, under its own
+ * name. The .zpsi format is a version line, the module name, a line per
+ * import and a line per function with its parameter types, "->" and its
+ * return type.
+ */
+class ModuleInterface {
+  std::string moduleName;
+  std::vector<std::string> imports;
+  std::vector<ExportedFunction> functions;
+
+public:
+  explicit ModuleInterface(std::string moduleName)
+      : moduleName(std::move(moduleName)) {}
+
+  static ModuleInterface fromAst(std::string moduleName,
+                                 CompilationUnitNode *unit);
+  // Returns nothing if the interface is malformed or from another version.
+  static std::optional<ModuleInterface> read(std::istream &input);
+  void write(std::ostream &output) const;
+
+  const std::string &getModuleName() const { return moduleName; }
+  // The modules this one imports, which its dependents don't see.
+  const std::vector<std::string> &getImports() const { return imports; }
+  const std::vector<ExportedFunction> &getFunctions() const {
+    return functions;
+  }
+};
+
+// Returns null if the file can't be read or is malformed.
+std::shared_ptr<const ModuleInterface>
+readInterfaceFile(const std::string &fileName);
+
+// A source file defines the module named after it, so math.zps is math.
+std::string getModuleName(std::string_view sourcePath);
+// The .zpsi file next to a source file.
+std::string getInterfacePath(std::string_view sourcePath);
+} // namespace zips
+
+#endif
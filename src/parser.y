@@ -11,6 +11,7 @@
 
 %code requires {
     #include "ast.h"
+    #include "parserLists.h"
 
     namespace zips {
         class Lexer;
@@ -32,8 +33,10 @@
 #include "error.h"
 #include "ast.h"
 #include "lexer.h"
+#include "memoryUsage.h"
 
 zips::Parser::symbol_type yylex(zips::Lexer& lexer) {
+    zips::MemoryCategoryScope category(zips::MemoryCategory::TOKENS);
     return lexer.next();
 }
 
@@ -45,6 +48,7 @@ using std::make_unique;
 %parse-param { zips::Lexer& lexer }
 %parse-param { std::string fileName }
 %parse-param {std::unique_ptr<zips::AstNode> *ast}
+%parse-param { zips::ParserLists& lists }
 
 %initial-action {
     // Set the file name on the initial location (goes into compilation-unit).
@@ -53,65 +57,95 @@ using std::make_unique;
 
 %token <std::string> IDENTIFIER "identifier"
 
-%token LET "let"
+%token LET "let" IMPORT "import"
+%token IF "if" ELSE "else" WHILE "while"
 
 %token I8 "i8" I16 "i16" I32 "i32" I64 "i64"
 %token U8 "u8" U16 "u16" U32 "u32" U64 "u64"
 %token ISIZE "isize" USIZE "usize"
+%token BOOL "bool"
 
 %token EQUALS "="
 %token LEFT_PAREN "(" RIGHT_PAREN ")" LEFT_BRACKET "[" RIGHT_BRACKET "]" LEFT_BRACE "{" RIGHT_BRACE "}"
 %token COMMA "," COLON ":" SEMICOLON ";"
 %token PLUS "+" MINUS "-" STAR "*" SLASH "/"
+%token CHECKED_PLUS "+?" SATURATING_PLUS "+|"
+%token EQUALS_EQUALS "==" NOT_EQUALS "!=" LESS "<" LESS_EQUALS "<=" GREATER ">" GREATER_EQUALS ">="
 
 %token END 0 "EOF"
 
-%type <std::unique_ptr<AstNode>> definition function statement expression
-%type <std::vector<std::unique_ptr<AstNode>>> definitions statement-list
+%type <std::unique_ptr<AstNode>> definition function statement expression if-statement
+%type <std::vector<std::unique_ptr<AstNode>>> block else-part argument-list
 %type <std::unique_ptr<Type>> type primitive-type
+%type <std::optional<std::unique_ptr<Type>>> return-type
 %type <NamedType> named-type
 %type <std::vector<NamedType>> parameter-list
-
-%left "+" "-"
+// Lists still growing, in lists.
+%type <ListRange> imports definitions statement-list arguments parameters
+
+// A name followed by "(" is a call, rather than a variable returned before a
+// parenthesized statement.
+%precedence "identifier"
+%precedence "("
+%nonassoc "==" "!=" "<" "<=" ">" ">="
+%left "+" "-" "+?" "+|"
 %left "*" "/"
 
 %start compilation-unit
 
 %%
 
-compilation-unit: definitions {
-    *ast = make_unique<CompilationUnitNode>(@1, $1);
+compilation-unit: imports definitions {
+    auto definitions = lists.nodes.finish($2);
+    *ast = make_unique<CompilationUnitNode>(@$, std::move(definitions),
+                                            lists.imports.finish($1));
+}
+
+imports: imports "import" IDENTIFIER ";" {
+    $$ = lists.imports.append($1, Import{@3, $3});
+}
+| %empty {
+    $$ = lists.imports.start();
 }
 
 definitions: definitions definition {
-    auto definitions = $1;
-    definitions.push_back($2);
-    $$ = std::move(definitions);
+    $$ = lists.nodes.append($1, $2);
 }
-| {
-    $$ = std::vector<std::unique_ptr<AstNode>>{};
+| definitions error {
+    // Skip to the next definition.
+    $$ = $1;
+}
+| %empty {
+    $$ = lists.nodes.start();
 }
 
 definition: function
 
-function: "let" IDENTIFIER "(" parameter-list ")" "=" "{" statement-list "}" {
-    $$ = make_unique<FunctionNode>(@1, $2, $4, $8);
+function: "let" IDENTIFIER "(" parameter-list ")" return-type "=" "{" statement-list "}" {
+    $$ = make_unique<FunctionNode>(@1, $2, $4, lists.nodes.finish($9), $6);
 }
 
-parameter-list: parameter-list "," named-type {
-    auto parameterList = $1;
-    parameterList.push_back($3);
-    $$ = std::move(parameterList);
+return-type: ":" type {
+    $$ = $2;
 }
-| named-type {
-    std::vector<NamedType> parameterList;
-    parameterList.push_back($1);
-    $$ = std::move(parameterList);
+| %empty {
+    $$ = std::nullopt;
+}
+
+parameter-list: parameters {
+    $$ = lists.parameters.finish($1);
 }
-| {
+| %empty {
     $$ = std::vector<NamedType>{};
 }
 
+parameters: parameters "," named-type {
+    $$ = lists.parameters.append($1, $3);
+}
+| named-type {
+    $$ = lists.parameters.append(lists.parameters.start(), $1);
+}
+
 named-type: IDENTIFIER ":" type {
     $$ = {$1, $3};
 }
@@ -149,15 +183,21 @@ primitive-type:
 | "usize" {
     $$ = make_unique<PrimitiveTypeNode>(PrimitiveTypeType::USIZE);
 }
+| "bool" {
+    $$ = make_unique<PrimitiveTypeNode>(PrimitiveTypeType::BOOL);
+}
 
 statement-list:
 statement-list statement {
-    auto statementList = $1;
-    statementList.push_back($2);
-    $$ = std::move(statementList);
+    $$ = lists.nodes.append($1, $2);
 }
-| {
-    $$ = std::vector<std::unique_ptr<AstNode>>{};
+| statement-list error {
+    // Skip to the next statement, leaving a placeholder so that the type
+    // checker doesn't report errors caused by the missing statement.
+    $$ = lists.nodes.append($1, make_unique<ErrorNode>(@2));
+}
+| %empty {
+    $$ = lists.nodes.start();
 }
 
 statement: 
@@ -165,14 +205,60 @@ expression {
     $$ = make_unique<ReturnStatementNode>(@1, $1);
 }
 | expression ";"
+| if-statement
+| "let" IDENTIFIER "=" expression ";" {
+    $$ = make_unique<VariableDefinitionNode>(@1, $2, std::nullopt, $4);
+}
+| "let" IDENTIFIER ":" type "=" expression ";" {
+    $$ = make_unique<VariableDefinitionNode>(@1, $2, $4, $6);
+}
+| IDENTIFIER "=" expression ";" {
+    $$ = make_unique<AssignmentNode>(@2, $1, $3);
+}
+| "while" expression block {
+    $$ = make_unique<WhileStatementNode>(@1, $2, $3);
+}
+
+block: "{" statement-list "}" {
+    $$ = lists.nodes.finish($2);
+}
+
+if-statement: "if" expression block else-part {
+    $$ = make_unique<IfStatementNode>(@1, $2, $3, $4);
+}
+
+else-part:
+"else" block {
+    $$ = $2;
+}
+| "else" if-statement {
+    std::vector<std::unique_ptr<AstNode>> elseBody;
+    elseBody.push_back($2);
+    $$ = std::move(elseBody);
+}
+| %empty {
+    $$ = std::vector<std::unique_ptr<AstNode>>{};
+}
 
 expression:
 IDENTIFIER {
     $$ = make_unique<VariableReferenceNode>(@1, $1);
 }
+| IDENTIFIER "(" argument-list ")" {
+    $$ = make_unique<CallExpressionNode>(@1, $1, $3);
+}
+| "(" expression ")" {
+    $$ = $2;
+}
 | expression "+" expression {
     $$ = make_unique<BinaryExpressionNode>(@2, BinaryOperator::ADD, $1, $3);
 }
+| expression "+?" expression {
+    $$ = make_unique<BinaryExpressionNode>(@2, BinaryOperator::CHECKED_ADD, $1, $3);
+}
+| expression "+|" expression {
+    $$ = make_unique<BinaryExpressionNode>(@2, BinaryOperator::SATURATING_ADD, $1, $3);
+}
 | expression "-" expression {
     $$ = make_unique<BinaryExpressionNode>(@2, BinaryOperator::SUBTRACT, $1, $3);
 }
@@ -182,6 +268,38 @@ IDENTIFIER {
 | expression "/" expression {
     $$ = make_unique<BinaryExpressionNode>(@2, BinaryOperator::DIVIDE, $1, $3);
 }
+| expression "==" expression {
+    $$ = make_unique<BinaryExpressionNode>(@2, BinaryOperator::EQUAL, $1, $3);
+}
+| expression "!=" expression {
+    $$ = make_unique<BinaryExpressionNode>(@2, BinaryOperator::NOT_EQUAL, $1, $3);
+}
+| expression "<" expression {
+    $$ = make_unique<BinaryExpressionNode>(@2, BinaryOperator::LESS, $1, $3);
+}
+| expression "<=" expression {
+    $$ = make_unique<BinaryExpressionNode>(@2, BinaryOperator::LESS_EQUAL, $1, $3);
+}
+| expression ">" expression {
+    $$ = make_unique<BinaryExpressionNode>(@2, BinaryOperator::GREATER, $1, $3);
+}
+| expression ">=" expression {
+    $$ = make_unique<BinaryExpressionNode>(@2, BinaryOperator::GREATER_EQUAL, $1, $3);
+}
+
+argument-list: arguments {
+    $$ = lists.nodes.finish($1);
+}
+| %empty {
+    $$ = std::vector<std::unique_ptr<AstNode>>{};
+}
+
+arguments: arguments "," expression {
+    $$ = lists.nodes.append($1, $3);
+}
+| expression {
+    $$ = lists.nodes.append(lists.nodes.start(), $1);
+}
 
 %%
 
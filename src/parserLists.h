@@ -0,0 +1,63 @@
+#ifndef ZIPS_PARSER_LISTS_H
+#define ZIPS_PARSER_LISTS_H
+
+#include "ast.h"
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+namespace zips {
+// The elements a list nonterminal has accumulated so far, in a ListBuilder.
+struct ListRange {
+  size_t begin;
+  size_t end;
+};
+
+/**
+ * @brief accumulates the elements of the lists being parsed on one stack.
+ *
+ * Lists nest, so each one's elements are on top while it grows. A finished
+ * list is moved out into a vector of its exact size, instead of the parser
+ * moving a growing vector through each reduction. The stack keeps its
+ * capacity between parses.
+ */
+template <typename T> class ListBuilder {
+  std::vector<T> elements;
+
+public:
+  ListRange start() { return {elements.size(), elements.size()}; }
+
+  ListRange append(ListRange list, T element) {
+    // Anything above the list's end is left from lists which error recovery
+    // discarded.
+    elements.erase(elements.begin() + list.end, elements.end());
+    elements.push_back(std::move(element));
+    return {list.begin, list.end + 1};
+  }
+
+  std::vector<T> finish(ListRange list) {
+    std::vector<T> result(
+        std::make_move_iterator(elements.begin() + list.begin),
+        std::make_move_iterator(elements.begin() + list.end));
+    elements.erase(elements.begin() + list.begin, elements.end());
+    return result;
+  }
+
+  void clear() { elements.clear(); }
+};
+
+struct ParserLists {
+  ListBuilder<std::unique_ptr<AstNode>> nodes;
+  ListBuilder<NamedType> parameters;
+  ListBuilder<Import> imports;
+
+  void clear() {
+    nodes.clear();
+    parameters.clear();
+    imports.clear();
+  }
+};
+} // namespace zips
+
+#endif
@@ -0,0 +1,14 @@
+#include "probes.h"
+
+namespace zips {
+static thread_local WorkCounters workCounters;
+
+WorkCounters &getWorkCounters() { return workCounters; }
+
+void printWorkCounters(std::ostream &output, const WorkCounters &counters) {
+  output << counters.visitedNodeCount << ",,zips:visited-nodes\n";
+  output << counters.generatedFunctionCount << ",,zips:generated-functions\n";
+  output << counters.instructionCount << ",,zips:instructions\n";
+  output << counters.spillCount << ",,zips:spills\n";
+}
+} // namespace zips
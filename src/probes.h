@@ -0,0 +1,88 @@
+#ifndef ZIPS_PROBES_H
+#define ZIPS_PROBES_H
+
+#include <cstdint>
+#include <ostream>
+
+/**
+ * Statically defined tracing probes, in the format of systemtap's sys/sdt.h
+ * but without needing it installed. Each probe is a nop, listed with its
+ * arguments in the binary's .note.stapsdt section, so perf, bpftrace and
+ * systemtap can attach to it in any build. For example:
+ *
+ *   perf buildid-cache --add zips
+ *   perf record -e sdt_zips:function__begin -e sdt_zips:function__end ...
+ *   bpftrace -e 'usdt:zips:zips:function__begin { @[str(arg0)] = count(); }'
+ *
+ * The probes are:
+ * - phase__begin(name), phase__end(name): around parsing, type checking and
+ *   code generation, see MemoryPhaseScope.
+ * - function__begin(name), function__end(name, instructions): around the
+ *   code generation of each function.
+ *
+ * Arguments are passed as 64-bit values, names as pointers to C strings.
+ * Building with ZIPS_NO_PROBES leaves them out.
+ */
+#if !defined(ZIPS_NO_PROBES) && defined(__GNUC__) && defined(__ELF__) &&      \
+    (defined(__x86_64__) || defined(__aarch64__))
+#define ZIPS_PROBE_ASM(name, arguments)                                        \
+  "990: nop\n"                                                                 \
+  ".pushsection .note.stapsdt,\"?\",\"note\"\n"                                \
+  ".balign 4\n"                                                                \
+  ".4byte 992f-991f, 994f-993f, 3\n"                                           \
+  "991: .asciz \"stapsdt\"\n"                                                  \
+  "992: .balign 4\n"                                                           \
+  "993: .8byte 990b\n"                                                         \
+  ".8byte _.stapsdt.base\n"                                                    \
+  ".8byte 0\n"                                                                 \
+  ".asciz \"zips\"\n"                                                          \
+  ".asciz \"" #name "\"\n"                                                     \
+  ".asciz \"" arguments "\"\n"                                                 \
+  "994: .balign 4\n"                                                           \
+  ".popsection\n"                                                              \
+  ".ifndef _.stapsdt.base\n"                                                   \
+  ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"      \
+  ".weak _.stapsdt.base\n"                                                     \
+  ".hidden _.stapsdt.base\n"                                                   \
+  "_.stapsdt.base: .space 1\n"                                                 \
+  ".size _.stapsdt.base, 1\n"                                                  \
+  ".popsection\n"                                                              \
+  ".endif\n"
+#define ZIPS_PROBE_ARGUMENT(value) "r"((uint64_t)(uintptr_t)(value))
+#define ZIPS_PROBE1(name, a)                                                   \
+  __asm__ __volatile__(ZIPS_PROBE_ASM(name, "8@%0")::ZIPS_PROBE_ARGUMENT(a))
+#define ZIPS_PROBE2(name, a, b)                                                \
+  __asm__ __volatile__(ZIPS_PROBE_ASM(name, "8@%0 8@%1")::ZIPS_PROBE_ARGUMENT( \
+      a),                                                                      \
+                       ZIPS_PROBE_ARGUMENT(b))
+#else
+#define ZIPS_PROBE1(name, a) ((void)(a))
+#define ZIPS_PROBE2(name, a, b) ((void)(a), (void)(b))
+#endif
+
+namespace zips {
+/**
+ * @brief counts of the compiler's work, to relate its profile to the source.
+ *
+ * Like the memory phase, they are per thread, so each build worker counts
+ * the units it compiles.
+ */
+struct WorkCounters {
+  // Nodes entered by AST traversals, which every pass is one of.
+  uint64_t visitedNodeCount = 0;
+  uint64_t generatedFunctionCount = 0;
+  // Generated before identical code folding, prologs and epilogs included.
+  uint64_t instructionCount = 0;
+  // Stack slots handed out, for values without a register and for values
+  // saved across calls.
+  uint64_t spillCount = 0;
+};
+
+WorkCounters &getWorkCounters();
+
+// Prints the counters like perf stat -x, prints events: a line each with
+// the value, an empty unit and the name.
+void printWorkCounters(std::ostream &output, const WorkCounters &counters);
+} // namespace zips
+
+#endif
@@ -7,7 +7,7 @@
 #include <vector>
 
 namespace zips {
-enum class TypeType { PRIMITIVE, FUNCTION };
+enum class TypeType { PRIMITIVE, FUNCTION, ERROR };
 class Type {
   TypeType type;
 
@@ -35,8 +35,12 @@ enum class PrimitiveTypeType {
   U32,
   U64,
   ISIZE,
-  USIZE
+  USIZE,
+  BOOL
 };
+// Must be kept in sync with the last PrimitiveTypeType.
+static constexpr size_t PRIMITIVE_TYPE_TYPE_COUNT =
+    static_cast<size_t>(PrimitiveTypeType::BOOL) + 1;
 static inline bool isSigned(PrimitiveTypeType type) {
   switch (type) {
   case PrimitiveTypeType::I8:
@@ -71,6 +75,8 @@ static inline size_t getBits(PrimitiveTypeType type) {
     return 64;
   case PrimitiveTypeType::USIZE:
     return sizeof(size_t) * 8;
+  case PrimitiveTypeType::BOOL:
+    return 8;
   }
   return 0;
 }
@@ -79,7 +85,8 @@ static std::map<PrimitiveTypeType, std::string> primitiveTypeTypeToString = {
     {PrimitiveTypeType::I32, "i32"},     {PrimitiveTypeType::I64, "i64"},
     {PrimitiveTypeType::U8, "u8"},       {PrimitiveTypeType::U16, "u16"},
     {PrimitiveTypeType::U32, "u32"},     {PrimitiveTypeType::U64, "u64"},
-    {PrimitiveTypeType::ISIZE, "isize"}, {PrimitiveTypeType::USIZE, "usize"}};
+    {PrimitiveTypeType::ISIZE, "isize"}, {PrimitiveTypeType::USIZE, "usize"},
+    {PrimitiveTypeType::BOOL, "bool"}};
 class PrimitiveTypeNode : public Type {
   PrimitiveTypeType primitiveType;
 
@@ -132,6 +139,18 @@ public:
         std::move(parameterTypes), returnType->clone());
   }
 };
+// The type of an expression which failed to type check. Operations on it
+// produce more error types without reporting further errors.
+class ErrorTypeNode : public Type {
+public:
+  ErrorTypeNode() : Type(TypeType::ERROR) {}
+
+  std::string toString() override { return "<error>"; }
+
+  std::unique_ptr<Type> clone() override {
+    return std::make_unique<ErrorTypeNode>();
+  }
+};
 } // namespace zips
 
 #endif
\ No newline at end of file
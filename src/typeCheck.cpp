@@ -1,24 +1,48 @@
 #include "typeCheck.h"
 #include "error.h"
+#include "visitor.h"
 #include <algorithm>
+#include <unordered_map>
 
 using namespace std::string_literals;
 
 namespace zips {
+static ErrorTypeNode errorType;
+static PrimitiveTypeNode boolType(PrimitiveTypeType::BOOL);
+
+static inline bool isBool(Type *type) {
+  return type->getType() == TypeType::PRIMITIVE &&
+         static_cast<PrimitiveTypeNode *>(type)->getPrimitiveType() ==
+             PrimitiveTypeType::BOOL;
+}
+
 static inline Type *executeBinaryExpression(BinaryOperator operatorType,
                                             Type *a, Type *b,
                                             const Location &location) {
+  if (a->getType() == TypeType::ERROR || b->getType() == TypeType::ERROR) {
+    return &errorType;
+  }
   if (a->getType() == b->getType()) {
     switch (a->getType()) {
     case TypeType::PRIMITIVE: {
       auto aPrimitive = static_cast<PrimitiveTypeNode *>(a);
       auto bPrimitive = static_cast<PrimitiveTypeNode *>(b);
+      if (isBool(a) || isBool(b)) {
+        // Bools can only be compared for equality with each other.
+        if (isBool(a) && isBool(b) &&
+            (operatorType == BinaryOperator::EQUAL ||
+             operatorType == BinaryOperator::NOT_EQUAL)) {
+          return &boolType;
+        }
+        break;
+      }
       if (isSigned(aPrimitive->getPrimitiveType()) !=
           isSigned(bPrimitive->getPrimitiveType())) {
-        warn(location, "Performing binary operator " +
-                           binaryOperatorToString[operatorType] +
-                           " with types of different signedness: " +
-                           a->toString() + " and " + b->toString());
+        warn(location, DiagnosticId::BINARY_OPERATOR_SIGNEDNESS,
+             {operatorType, a, b});
+      }
+      if (isComparison(operatorType)) {
+        return &boolType;
       }
       if (getBits(aPrimitive->getPrimitiveType()) >=
           getBits(bPrimitive->getPrimitiveType())) {
@@ -29,27 +53,31 @@ static inline Type *executeBinaryExpression(BinaryOperator operatorType,
       break;
     }
     case TypeType::FUNCTION: {
-      throw ZipsError(location,
-                      "Cannot execute binary expression on functions");
+      error(location, DiagnosticId::BINARY_OPERATOR_ON_FUNCTIONS, {});
+      return &errorType;
     }
+    case TypeType::ERROR:
+      return &errorType;
     }
-  } else {
-    throw ZipsError(location, "Incompatible types for binary operator"s +
-                                  binaryOperatorToString[operatorType] + ": " +
-                                  a->toString() + " and " + b->toString());
   }
+  error(location, DiagnosticId::INCOMPATIBLE_BINARY_OPERANDS,
+        {operatorType, a, b});
+  return &errorType;
 }
 
 /**
  * @brief attempt the conversion to a given type.
  *
- * This function throws if the types are not convertible.
+ * This function reports an error if the types are not convertible.
  *
  * @param from
  * @param to
  */
 static void convert(Type *from, Type *to, const Location &location) {
-  if (from->getType() == to->getType()) {
+  if (from->getType() == TypeType::ERROR || to->getType() == TypeType::ERROR) {
+    return;
+  }
+  if (from->getType() == to->getType() && isBool(from) == isBool(to)) {
     switch (from->getType()) {
     case TypeType::PRIMITIVE: {
       auto fromPrimitiveType =
@@ -57,96 +85,409 @@ static void convert(Type *from, Type *to, const Location &location) {
       auto toPrimitiveType =
           static_cast<PrimitiveTypeNode *>(to)->getPrimitiveType();
       if (isSigned(fromPrimitiveType) != isSigned(toPrimitiveType)) {
-        warn(location, "Converting from " + from->toString() + " to " +
-                           to->toString() + " changes signedness");
+        warn(location, DiagnosticId::CONVERSION_CHANGES_SIGNEDNESS,
+             {from, to});
       }
       if (getBits(fromPrimitiveType) > getBits(toPrimitiveType)) {
-        warn(location, "Converting from " + from->toString() + " to " +
-                           to->toString() + " loses precision");
+        warn(location, DiagnosticId::CONVERSION_LOSES_PRECISION, {from, to});
       }
       break;
     }
     case TypeType::FUNCTION: {
-      throw ZipsError(location,
-                      "Converting of function types not yet supported");
+      error(location, DiagnosticId::FUNCTION_CONVERSION, {});
       break;
     }
+    case TypeType::ERROR:
+      break;
     }
   } else {
-    throw ZipsError(location, "Can't convert "s + from->toString() + " to " +
-                                  to->toString());
+    error(location, DiagnosticId::INCOMPATIBLE_CONVERSION, {from, to});
+  }
+}
+
+static std::unique_ptr<Type> makeFunctionType(FunctionNode *function,
+                                              std::unique_ptr<Type> returnType) {
+  std::vector<std::unique_ptr<Type>> parameterTypes;
+  for (auto &parameter : function->getParameters()) {
+    parameterTypes.push_back(parameter.type->clone());
+  }
+  return std::make_unique<FunctionTypeNode>(std::move(parameterTypes),
+                                            std::move(returnType));
+}
+
+static void checkCondition(AstNode *condition) {
+  Type *type = condition->type->get();
+  if (type->getType() != TypeType::ERROR && !isBool(type)) {
+    error(condition->getLocation(), DiagnosticId::CONDITION_NOT_BOOL, {type});
   }
 }
 
-void checkTypes(AstNode *node, Context &context) {
-  switch (node->getNodeType()) {
-  case AstNodeType::COMPILATION_UNIT: {
-    auto compilationUnit = static_cast<CompilationUnitNode *>(node);
-    for (auto &node : compilationUnit->getNodes()) {
-      checkTypes(node.get(), context);
+void Context::addImport(const ModuleInterface &interface,
+                        const Location &location) {
+  for (auto &exported : interface.getFunctions()) {
+    auto [symbol, inserted] = functions.try_emplace(exported.name);
+    if (!inserted) {
+      error(location, DiagnosticId::DUPLICATE_FUNCTION, {exported.name});
+      continue;
     }
-    break;
+    symbol->second.type = exported.type.get();
   }
-  case AstNodeType::FUNCTION: {
-    auto function = static_cast<FunctionNode *>(node);
-    std::map<std::string, Type *> parameters;
-    for (auto &parameter : function->getParameters()) {
-      parameters[parameter.name] = parameter.type.get();
-    }
-    context.symbolTable.push_back(std::move(parameters));
-    for (auto &node : function->getBody()) {
-      checkTypes(node.get(), context);
-    }
-    context.symbolTable.pop_back();
-    std::vector<std::unique_ptr<Type>> parameterTypes;
-    for (auto &parameter : function->getParameters()) {
-      parameterTypes.push_back(parameter.type->clone());
-    }
-    function->type = std::make_unique<FunctionTypeNode>(
-        std::move(parameterTypes),
-        context.currentFunctionReturnType.value()->clone());
-    break;
-  }
-  case AstNodeType::RETURN_STATEMENT: {
-    auto returnNode = static_cast<ReturnStatementNode *>(node);
-    checkTypes(returnNode->getExpression(), context);
-    if (context.currentFunctionReturnType) {
-      convert(returnNode->getExpression()->type->get(),
-              *context.currentFunctionReturnType, returnNode->getLocation());
-    } else {
-      context.currentFunctionReturnType =
-          returnNode->getExpression()->type->get();
-    }
-    break;
-  }
-  case AstNodeType::BINARY_EXPRESSION: {
-    auto binaryExpression = static_cast<BinaryExpressionNode *>(node);
-    checkTypes(binaryExpression->getLeft(), context);
-    checkTypes(binaryExpression->getRight(), context);
-    binaryExpression->type =
-        executeBinaryExpression(binaryExpression->getOperator(),
-                                binaryExpression->getLeft()->type->get(),
-                                binaryExpression->getRight()->type->get(),
-                                binaryExpression->getLocation())
-            ->clone();
-    break;
-  }
-  case AstNodeType::VARIABLE_REFERENCE: {
-    auto variableReference = static_cast<VariableReferenceNode *>(node);
-    for (auto symbolTable = context.symbolTable.rbegin();
-         symbolTable != context.symbolTable.rend(); symbolTable++) {
-          if (symbolTable->contains(variableReference->getName())) {
-            variableReference->type =
-                (*symbolTable)[variableReference->getName()]->clone();
-            break;
-          }
-         }
-         if (!variableReference->type.has_value()) {
-            throw ZipsError(variableReference->getLocation(),
-                            "Undefined identifier "s + variableReference->getName());
-         }
-      break;
+}
+
+TypeCheckPass::TypeCheckPass(Context &context) : context(context) {
+  onEnter<&TypeCheckPass::enterFunction>();
+  onLeave<&TypeCheckPass::leaveFunction>();
+  onLeave<&TypeCheckPass::leaveReturnStatement>();
+  onLeave<&TypeCheckPass::leaveBinaryExpression>();
+  onLeave<&TypeCheckPass::leaveVariableReference>();
+  onLeave<&TypeCheckPass::leaveError>();
+  onEnter<&TypeCheckPass::enterIfStatement>();
+  onAfterChild<&TypeCheckPass::afterIfStatementChild>();
+  onLeave<&TypeCheckPass::leaveIfStatement>();
+  onEnter<&TypeCheckPass::enterWhileStatement>();
+  onAfterChild<&TypeCheckPass::afterWhileStatementChild>();
+  onLeave<&TypeCheckPass::leaveWhileStatement>();
+  onLeave<&TypeCheckPass::leaveVariableDefinition>();
+  onLeave<&TypeCheckPass::leaveAssignment>();
+  onLeave<&TypeCheckPass::leaveCallExpression>();
+}
+
+Type *TypeCheckPass::findVariable(const std::string &name) {
+  for (auto symbolTable = context.symbolTable.rbegin();
+       symbolTable != context.symbolTable.rend(); symbolTable++) {
+    auto symbol = symbolTable->find(name);
+    if (symbol != symbolTable->end()) {
+      return symbol->second;
+    }
+  }
+  return nullptr;
+}
+
+// Null for a function which isn't in the table, because another function of
+// the same name is.
+FunctionSymbol *TypeCheckPass::findSymbol(FunctionNode *function) {
+  auto symbol = context.functions.find(function->getName());
+  if (symbol == context.functions.end() ||
+      symbol->second.function != function) {
+    return nullptr;
+  }
+  return &symbol->second;
+}
+
+void TypeCheckPass::declareFunctions(CompilationUnitNode *compilationUnit) {
+  for (auto &node : compilationUnit->getNodes()) {
+    auto function = static_cast<FunctionNode *>(node.get());
+    auto [symbol, inserted] =
+        context.functions.try_emplace(function->getName());
+    if (!inserted) {
+      error(function->getLocation(), DiagnosticId::DUPLICATE_FUNCTION,
+            {function->getName()});
+      continue;
+    }
+    symbol->second.function = function;
+    // Calls to it can be checked before its body, even recursive ones.
+    if (auto &returnType = function->getDeclaredReturnType()) {
+      function->type = makeFunctionType(function, returnType->get()->clone());
+      symbol->second.type =
+          static_cast<FunctionTypeNode *>(function->type->get());
+    }
+    symbol->second.reachable = context.entryPoints.empty();
+  }
+  for (auto &entryPoint : context.entryPoints) {
+    auto symbol = context.functions.find(entryPoint);
+    if (symbol == context.functions.end() || !symbol->second.function) {
+      error(compilationUnit->getLocation(),
+            DiagnosticId::UNDEFINED_ENTRY_POINT, {entryPoint});
+      continue;
+    }
+    symbol->second.reachable = true;
+  }
+}
+
+void TypeCheckPass::enterFunction(FunctionNode *function) {
+  std::map<std::string, Type *> parameters;
+  for (auto &parameter : function->getParameters()) {
+    parameters[parameter.name] = parameter.type.get();
+  }
+  if (auto &returnType = function->getDeclaredReturnType()) {
+    context.currentFunctionReturnType = returnType->get();
+  } else {
+    context.currentFunctionReturnType = std::nullopt;
+  }
+  context.symbolTable.push_back(std::move(parameters));
+  blocks.emplace_back();
+}
+
+void TypeCheckPass::leaveFunction(FunctionNode *function) {
+  context.symbolTable.pop_back();
+  bool alwaysReturns = blocks.back().alwaysReturns;
+  blocks.pop_back();
+  if (!context.currentFunctionReturnType) {
+    error(function->getLocation(), DiagnosticId::MISSING_RETURN_VALUE,
+          {function->getName()});
+    context.currentFunctionReturnType = &errorType;
+  } else if (!alwaysReturns) {
+    error(function->getLocation(), DiagnosticId::NOT_ALL_PATHS_RETURN,
+          {function->getName()});
+  }
+  if (!function->getDeclaredReturnType()) {
+    function->type = makeFunctionType(
+        function, context.currentFunctionReturnType.value()->clone());
+  }
+  if (FunctionSymbol *symbol = findSymbol(function)) {
+    symbol->type = static_cast<FunctionTypeNode *>(function->type->get());
+  }
+}
+
+void TypeCheckPass::leaveReturnStatement(ReturnStatementNode *returnNode) {
+  blocks.back().alwaysReturns = true;
+  if (context.currentFunctionReturnType) {
+    convert(returnNode->getExpression()->type->get(),
+            *context.currentFunctionReturnType, returnNode->getLocation());
+  } else {
+    context.currentFunctionReturnType =
+        returnNode->getExpression()->type->get();
+  }
+}
+
+void TypeCheckPass::leaveBinaryExpression(
+    BinaryExpressionNode *binaryExpression) {
+  binaryExpression->type =
+      executeBinaryExpression(binaryExpression->getOperator(),
+                              binaryExpression->getLeft()->type->get(),
+                              binaryExpression->getRight()->type->get(),
+                              binaryExpression->getLocation())
+          ->clone();
+}
+
+void TypeCheckPass::leaveVariableReference(
+    VariableReferenceNode *variableReference) {
+  if (Type *type = findVariable(variableReference->getName())) {
+    variableReference->type = type->clone();
+  } else {
+    error(variableReference->getLocation(),
+          DiagnosticId::UNDEFINED_IDENTIFIER, {variableReference->getName()});
+    variableReference->type = errorType.clone();
+  }
+}
+
+// Each block gets its own scope. An if always returns if both its bodies
+// do, while a while's body might not run.
+void TypeCheckPass::enterIfStatement(IfStatementNode *) {
+  context.symbolTable.emplace_back();
+  blocks.emplace_back();
+}
+
+void TypeCheckPass::afterIfStatementChild(IfStatementNode *ifStatement,
+                                          size_t childIndex) {
+  if (childIndex == 0) {
+    checkCondition(ifStatement->getCondition());
+  }
+  if (childIndex == ifStatement->getThenBody().size()) {
+    if (ifStatement->getElseBody().size() > 0) {
+      context.symbolTable.back().clear();
+    }
+    blocks.back().thenBodyAlwaysReturns = blocks.back().alwaysReturns;
+    blocks.back().alwaysReturns = false;
+  }
+}
+
+void TypeCheckPass::leaveIfStatement(IfStatementNode *) {
+  context.symbolTable.pop_back();
+  Block block = blocks.back();
+  blocks.pop_back();
+  if (block.thenBodyAlwaysReturns && block.alwaysReturns) {
+    blocks.back().alwaysReturns = true;
+  }
+}
+
+void TypeCheckPass::enterWhileStatement(WhileStatementNode *) {
+  context.symbolTable.emplace_back();
+  blocks.emplace_back();
+}
+
+void TypeCheckPass::afterWhileStatementChild(
+    WhileStatementNode *whileStatement, size_t childIndex) {
+  if (childIndex == 0) {
+    checkCondition(whileStatement->getCondition());
+  }
+}
+
+void TypeCheckPass::leaveWhileStatement(WhileStatementNode *) {
+  context.symbolTable.pop_back();
+  blocks.pop_back();
+}
+
+void TypeCheckPass::leaveVariableDefinition(
+    VariableDefinitionNode *variableDefinition) {
+  Type *valueType = variableDefinition->getValue()->type->get();
+  if (variableDefinition->getDeclaredType()) {
+    Type *declaredType = variableDefinition->getDeclaredType()->get();
+    convert(valueType, declaredType, variableDefinition->getLocation());
+    variableDefinition->type = declaredType->clone();
+  } else {
+    variableDefinition->type = valueType->clone();
+  }
+  context.symbolTable.back()[variableDefinition->getName()] =
+      variableDefinition->type->get();
+}
+
+void TypeCheckPass::leaveAssignment(AssignmentNode *assignment) {
+  if (Type *type = findVariable(assignment->getName())) {
+    convert(assignment->getValue()->type->get(), type,
+            assignment->getLocation());
+  } else {
+    error(assignment->getLocation(), DiagnosticId::UNDEFINED_IDENTIFIER,
+          {assignment->getName()});
+  }
+}
+
+void TypeCheckPass::leaveCallExpression(CallExpressionNode *callExpression) {
+  callExpression->type = errorType.clone();
+  auto symbol = context.functions.find(callExpression->getName());
+  if (symbol == context.functions.end()) {
+    error(callExpression->getLocation(), DiagnosticId::UNDEFINED_FUNCTION,
+          {callExpression->getName()});
+    return;
+  }
+  FunctionSymbol &callee = symbol->second;
+  if (!callee.type) {
+    // A recursive call. Other callees were checked first.
+    error(callExpression->getLocation(), DiagnosticId::UNKNOWN_RETURN_TYPE,
+          {callExpression->getName()});
+    return;
+  }
+  auto &parameterTypes = callee.type->getParameterTypes();
+  auto &arguments = callExpression->getArguments();
+  if (arguments.size() != parameterTypes.size()) {
+    error(callExpression->getLocation(), DiagnosticId::WRONG_ARGUMENT_COUNT,
+          {callExpression->getName(), std::to_string(parameterTypes.size()),
+           std::to_string(arguments.size())});
+    return;
+  }
+  for (size_t i = 0; i < arguments.size(); i++) {
+    convert(arguments[i]->type->get(), parameterTypes[i].get(),
+            arguments[i]->getLocation());
+  }
+  callExpression->functionType.reset(
+      static_cast<FunctionTypeNode *>(callee.type->clone().release()));
+  callExpression->type = callee.type->getReturnType()->clone();
+}
+
+void TypeCheckPass::leaveError(ErrorNode *) {
+  // A statement which failed to parse could have been the return value, or
+  // a return.
+  blocks.back().alwaysReturns = true;
+  if (!context.currentFunctionReturnType) {
+    context.currentFunctionReturnType = &errorType;
+  }
+}
+
+namespace {
+// Collects which functions of the unit each of its functions calls.
+class CallGraphPass : public AstPass {
+  const FunctionTable &functions;
+  std::unordered_map<FunctionNode *, size_t> indices;
+
+  void enterFunction(FunctionNode *) { callees.emplace_back(); }
+
+  void leaveCallExpression(CallExpressionNode *callExpression) {
+    auto symbol = functions.find(callExpression->getName());
+    if (symbol != functions.end() && symbol->second.function) {
+      callees.back().push_back(indices.at(symbol->second.function));
+    }
+  }
+
+public:
+  // Indexed like the unit's functions.
+  std::vector<std::vector<size_t>> callees;
+
+  CallGraphPass(CompilationUnitNode *unit, const FunctionTable &functions)
+      : functions(functions) {
+    for (auto &node : unit->getNodes()) {
+      indices.emplace(static_cast<FunctionNode *>(node.get()), indices.size());
+    }
+    onEnter<&CallGraphPass::enterFunction>();
+    onLeave<&CallGraphPass::leaveCallExpression>();
+  }
+};
+} // namespace
+
+// Checks the reachable functions depth first, with a function's callees
+// without a declared return type before it. Deep call chains would overflow the stack if the
+// callees were checked from their call sites.
+void checkTypes(CompilationUnitNode *unit, Context &context) {
+  TypeCheckPass typeChecker(context);
+  typeChecker.declareFunctions(unit);
+  CallGraphPass callGraph(unit, context.functions);
+  traverse(unit, {&callGraph});
+
+  auto &nodes = unit->getNodes();
+  // Null for functions which another function of the same name hides.
+  std::vector<FunctionSymbol *> symbols;
+  for (auto &node : nodes) {
+    auto function = static_cast<FunctionNode *>(node.get());
+    auto symbol = context.functions.find(function->getName());
+    symbols.push_back(symbol->second.function == function ? &symbol->second
+                                                          : nullptr);
+  }
+  // With entry points, only the functions they call, directly or not, are
+  // reachable. Functions a same-named one hides are checked regardless.
+  std::vector<size_t> worklist;
+  for (size_t function = 0; function < nodes.size(); function++) {
+    if (!symbols[function] || symbols[function]->reachable) {
+      worklist.push_back(function);
+    }
   }
+  while (!worklist.empty()) {
+    size_t function = worklist.back();
+    worklist.pop_back();
+    for (size_t callee : callGraph.callees[function]) {
+      if (!symbols[callee]->reachable) {
+        symbols[callee]->reachable = true;
+        worklist.push_back(callee);
+      }
+    }
+  }
+
+  enum class Visit : uint8_t { NEW, VISITING, DONE };
+  std::vector<Visit> visits(nodes.size(), Visit::NEW);
+  // Functions with the index of the next callee to look at.
+  std::vector<std::pair<size_t, size_t>> stack;
+  Traversal traversal;
+  for (size_t root = 0; root < nodes.size(); root++) {
+    if (visits[root] != Visit::NEW ||
+        (symbols[root] && !symbols[root]->reachable)) {
+      continue;
+    }
+    visits[root] = Visit::VISITING;
+    stack.emplace_back(root, 0);
+    while (!stack.empty()) {
+      auto [function, nextCallee] = stack.back();
+      if (nextCallee == callGraph.callees[function].size()) {
+        stack.pop_back();
+        visits[function] = Visit::DONE;
+        traversal.run(nodes[function].get(), {&typeChecker});
+        continue;
+      }
+      stack.back().second++;
+      size_t callee = callGraph.callees[function][nextCallee];
+      // Visiting callees are recursive calls, which are reported.
+      if (visits[callee] == Visit::NEW && !symbols[callee]->type) {
+        visits[callee] = Visit::VISITING;
+        stack.emplace_back(callee, 0);
+      }
+    }
   }
 }
+
+void removeUnreachableFunctions(CompilationUnitNode *unit,
+                                const Context &context) {
+  unit->removeNodes([&](AstNode *node) {
+    auto function = static_cast<FunctionNode *>(node);
+    auto symbol = context.functions.find(function->getName());
+    return symbol != context.functions.end() &&
+           symbol->second.function == function && !symbol->second.reachable;
+  });
+}
 } // namespace zips
@@ -2,19 +2,85 @@
 #define ZIPS_TYPE_CHECK_H
 
 #include "ast.h"
+#include "moduleInterface.h"
 #include "type.h"
+#include "visitor.h"
 #include <exception>
 #include <memory>
 #include <map>
 #include <vector>
 
 namespace zips {
+// A function which can be called from the unit being checked.
+struct FunctionSymbol {
+  // Null for functions of imported modules.
+  FunctionNode *function = nullptr;
+  // Known up front for imported functions and ones with a declared return
+  // type, and otherwise once the function is checked.
+  FunctionTypeNode *type = nullptr;
+  // Whether the function is an entry point or called by one, directly or not.
+  // Worked out before checking, which skips the functions which aren't.
+  bool reachable = true;
+};
+using FunctionTable = std::map<std::string, FunctionSymbol, std::less<>>;
+
 struct Context {
   std::optional<Type *> currentFunctionReturnType;
   std::vector<std::map<std::string, Type *>> symbolTable;
+  FunctionTable functions;
+  // If not empty, only these functions of the unit and the ones they call
+  // are checked.
+  std::vector<std::string> entryPoints;
+
+  // Makes the interface's functions callable. It must outlive the checking.
+  void addImport(const ModuleInterface &interface, const Location &location);
+};
+// Checks the functions it is run on, which declareFunctions must have added
+// to the context first. A function's callees without a declared return type
+// have to be checked before it, for their return types to be known.
+class TypeCheckPass : public AstPass {
+  Context &context;
+  // The function body, if and while bodies being checked, innermost last,
+  // with whether every path through them so far ends in a return.
+  struct Block {
+    bool alwaysReturns = false;
+    // For an if, whether its then body does, once it was checked.
+    bool thenBodyAlwaysReturns = false;
+  };
+  std::vector<Block> blocks;
+
+  Type *findVariable(const std::string &name);
+  FunctionSymbol *findSymbol(FunctionNode *function);
+
+public:
+  TypeCheckPass(Context &context);
+
+  void declareFunctions(CompilationUnitNode *compilationUnit);
+  void enterFunction(FunctionNode *function);
+  void leaveFunction(FunctionNode *function);
+  void leaveReturnStatement(ReturnStatementNode *returnNode);
+  void leaveBinaryExpression(BinaryExpressionNode *binaryExpression);
+  void leaveVariableReference(VariableReferenceNode *variableReference);
+  void enterIfStatement(IfStatementNode *ifStatement);
+  void afterIfStatementChild(IfStatementNode *ifStatement, size_t childIndex);
+  void leaveIfStatement(IfStatementNode *ifStatement);
+  void enterWhileStatement(WhileStatementNode *whileStatement);
+  void afterWhileStatementChild(WhileStatementNode *whileStatement,
+                                size_t childIndex);
+  void leaveWhileStatement(WhileStatementNode *whileStatement);
+  void leaveVariableDefinition(VariableDefinitionNode *variableDefinition);
+  void leaveAssignment(AssignmentNode *assignment);
+  void leaveCallExpression(CallExpressionNode *callExpression);
+  void leaveError(ErrorNode *errorNode);
 };
-void checkTypes(AstNode *node, Context &context);
-static inline void checkTypes(AstNode *ast) {
+// Functions are checked in order, except that a function's callees without a
+// declared return type are checked before it. With entry points, functions
+// nothing reachable calls are skipped.
+void checkTypes(CompilationUnitNode *unit, Context &context);
+// Removes the functions which checking with entry points left unchecked.
+void removeUnreachableFunctions(CompilationUnitNode *unit,
+                                const Context &context);
+static inline void checkTypes(CompilationUnitNode *ast) {
   Context context;
   checkTypes(ast, context);
 }
@@ -0,0 +1,49 @@
+#include "visitor.h"
+#include "probes.h"
+#include <algorithm>
+
+namespace zips {
+void traverse(AstNode *root, std::span<AstPass *const> passes) {
+  Traversal().run(root, passes);
+}
+
+void Traversal::run(AstNode *root, std::span<AstPass *const> passes) {
+  stack.clear();
+  uint64_t visitedNodeCount = 0;
+  auto allSkipping = [&]() {
+    return std::all_of(passes.begin(), passes.end(),
+                       [](AstPass *pass) { return pass->isSkipping(); });
+  };
+  auto enter = [&](AstNode *node) {
+    visitedNodeCount++;
+    for (auto pass : passes) {
+      pass->enter(node);
+    }
+    stack.push_back(
+        Frame{node, 0, allSkipping() ? 0 : node->getChildCount()});
+  };
+  enter(root);
+  while (!stack.empty()) {
+    Frame &frame = stack.back();
+    if (frame.nextChild < frame.childCount) {
+      enter(frame.node->getChild(frame.nextChild++));
+      continue;
+    }
+    AstNode *node = frame.node;
+    stack.pop_back();
+    for (auto pass : passes) {
+      pass->leave(node);
+    }
+    if (!stack.empty()) {
+      Frame &parent = stack.back();
+      for (auto pass : passes) {
+        pass->afterChild(parent.node, parent.nextChild - 1);
+      }
+      if (allSkipping()) {
+        parent.nextChild = parent.childCount;
+      }
+    }
+  }
+  getWorkCounters().visitedNodeCount += visitedNodeCount;
+}
+} // namespace zips
@@ -0,0 +1,154 @@
+#ifndef ZIPS_VISITOR_H
+#define ZIPS_VISITOR_H
+
+#include "ast.h"
+#include <array>
+#include <initializer_list>
+#include <span>
+#include <vector>
+
+namespace zips {
+/**
+ * @brief a set of handlers which run as the AST is traversed.
+ *
+ * Handlers are registered per node type from the pass's constructor, for
+ * example onLeave<&TypeChecker::leaveReturn>(). The node type is taken from
+ * the handler's parameter, so passes don't need to switch on node types.
+ * Nodes without a handler are traversed but otherwise ignored.
+ */
+class AstPass {
+  using Handler = void (*)(AstPass *, AstNode *);
+  using ChildHandler = void (*)(AstPass *, AstNode *, size_t);
+
+  std::array<Handler, AST_NODE_TYPE_COUNT> enterHandlers{};
+  std::array<Handler, AST_NODE_TYPE_COUNT> leaveHandlers{};
+  std::array<ChildHandler, AST_NODE_TYPE_COUNT> afterChildHandlers{};
+  // The node whose remaining children this pass is skipping, if any.
+  AstNode *skippedNode = nullptr;
+  bool skipRequested = false;
+
+  void checkSkipRequest(AstNode *node) {
+    if (skipRequested) {
+      skipRequested = false;
+      skippedNode = node;
+    }
+  }
+
+  template <typename> struct HandlerTraits;
+  template <typename P, typename N> struct HandlerTraits<void (P::*)(N *)> {
+    using Pass = P;
+    using Node = N;
+  };
+  template <typename P, typename N>
+  struct HandlerTraits<void (P::*)(N *, size_t)> {
+    using Pass = P;
+    using Node = N;
+  };
+
+protected:
+  // Called before the node's children are traversed.
+  template <auto handler> void onEnter() {
+    using Traits = HandlerTraits<decltype(handler)>;
+    enterHandlers[static_cast<size_t>(Traits::Node::NODE_TYPE)] =
+        [](AstPass *pass, AstNode *node) {
+          (static_cast<typename Traits::Pass *>(pass)->*handler)(
+              static_cast<typename Traits::Node *>(node));
+        };
+  }
+  // Called after the node's children are traversed.
+  template <auto handler> void onLeave() {
+    using Traits = HandlerTraits<decltype(handler)>;
+    leaveHandlers[static_cast<size_t>(Traits::Node::NODE_TYPE)] =
+        [](AstPass *pass, AstNode *node) {
+          (static_cast<typename Traits::Pass *>(pass)->*handler)(
+              static_cast<typename Traits::Node *>(node));
+        };
+  }
+  // Called after each child of the node is traversed, with the child's index.
+  template <auto handler> void onAfterChild() {
+    using Traits = HandlerTraits<decltype(handler)>;
+    afterChildHandlers[static_cast<size_t>(Traits::Node::NODE_TYPE)] =
+        [](AstPass *pass, AstNode *node, size_t childIndex) {
+          (static_cast<typename Traits::Pass *>(pass)->*handler)(
+              static_cast<typename Traits::Node *>(node), childIndex);
+        };
+  }
+
+  // May be called from an enter or after-child handler. This pass won't see
+  // the node's remaining children, but its leave handler still runs.
+  void skipRemainingChildren() { skipRequested = true; }
+
+public:
+  virtual ~AstPass() {}
+
+  bool isSkipping() const { return skippedNode != nullptr; }
+
+  void enter(AstNode *node) {
+    if (skippedNode) {
+      return;
+    }
+    if (auto handler = enterHandlers[static_cast<size_t>(node->getNodeType())]) {
+      handler(this, node);
+      checkSkipRequest(node);
+    }
+  }
+  void leave(AstNode *node) {
+    if (skippedNode) {
+      if (skippedNode != node) {
+        return;
+      }
+      skippedNode = nullptr;
+    }
+    if (auto handler = leaveHandlers[static_cast<size_t>(node->getNodeType())]) {
+      handler(this, node);
+    }
+  }
+  void afterChild(AstNode *node, size_t childIndex) {
+    if (skippedNode) {
+      return;
+    }
+    if (auto handler =
+            afterChildHandlers[static_cast<size_t>(node->getNodeType())]) {
+      handler(this, node, childIndex);
+      checkSkipRequest(node);
+    }
+  }
+};
+
+/**
+ * @brief walk the tree under root, running the passes together.
+ *
+ * The walk uses an explicit stack rather than recursion, so the depth of the
+ * tree is only limited by memory. At each node the passes run in the order
+ * given, so a later pass can rely on an earlier one having handled the node.
+ * Children are only skipped once every pass is skipping them.
+ */
+void traverse(AstNode *root, std::span<AstPass *const> passes);
+static inline void traverse(AstNode *root,
+                            std::initializer_list<AstPass *> passes) {
+  traverse(root, std::span<AstPass *const>(passes.begin(), passes.size()));
+}
+
+/**
+ * @brief traverse with a stack that is kept between walks.
+ *
+ * Useful when walking many small trees, such as one function at a time, so
+ * that each walk doesn't reallocate the stack.
+ */
+class Traversal {
+  struct Frame {
+    AstNode *node;
+    size_t nextChild;
+    size_t childCount;
+  };
+  std::vector<Frame> stack;
+
+public:
+  void run(AstNode *root, std::span<AstPass *const> passes);
+  void run(AstNode *root, std::initializer_list<AstPass *> passes) {
+    run(root, std::span<AstPass *const>(passes.begin(), passes.size()));
+  }
+};
+} // namespace zips
+
+#endif
@@ -0,0 +1,71 @@
+// Measures code generation throughput, instruction formatting included, over
+// a large synthetic unit made of generated fuzzer programs. The unit is type
+// checked once, and each iteration generates its assembly into a buffer
+// which keeps its capacity, as the compiler does.
+#include "../fuzz/programGenerator.h"
+#include "codegen/codegen.h"
+#include "compiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+using namespace zips;
+using namespace zips::fuzz;
+
+void usage(const char *program) {
+  std::cerr << "Usage: " << program << " [options]" << std::endl;
+  std::cerr << "Options:" << std::endl;
+  std::cerr << "  --seed=number" << std::endl;
+  std::cerr << "  --functions=count" << std::endl;
+  std::cerr << "  --iterations=count" << std::endl;
+}
+
+int main(int argc, char **argv) {
+  uint64_t seed = 1;
+  size_t functionCount = 3000;
+  size_t iterationCount = 10;
+  for (int i = 1; i < argc; i++) {
+    std::string_view argument = argv[i];
+    if (argument.starts_with("--seed=")) {
+      seed = std::stoull(std::string(argument.substr(7)));
+    } else if (argument.starts_with("--functions=")) {
+      functionCount = std::stoul(std::string(argument.substr(12)));
+    } else if (argument.starts_with("--iterations=")) {
+      iterationCount = std::stoul(std::string(argument.substr(13)));
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  std::string source = ProgramGenerator(seed).generate(functionCount).source;
+  Compiler compiler([](const Diagnostic &) {});
+  if (!compiler.check(source, "bench.zps")) {
+    std::cerr << "The synthetic source failed to check" << std::endl;
+    return 1;
+  }
+
+  CodeGenerator<TargetArchitecture::X86_64, TargetAbi::X86_64> codeGenerator;
+  std::string output;
+  double bestSeconds = 0;
+  for (size_t i = 0; i < iterationCount; i++) {
+    output.clear();
+    auto start = std::chrono::steady_clock::now();
+    codeGenerator.generate(compiler.getAst(), output);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    if (i == 0 || elapsed.count() < bestSeconds) {
+      bestSeconds = elapsed.count();
+    }
+  }
+  size_t lineCount = std::count(output.begin(), output.end(), '\n');
+  std::cout << "Functions: " << functionCount << ", assembly: "
+            << output.size() << " bytes, " << lineCount << " lines"
+            << std::endl;
+  std::cout << "Code generation: best of " << iterationCount << ": "
+            << bestSeconds * 1000 << " ms, "
+            << output.size() / bestSeconds / 1e6 << " MB/s, "
+            << lineCount / bestSeconds << " lines/s" << std::endl;
+}
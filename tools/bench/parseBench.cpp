@@ -0,0 +1,87 @@
+// Measures parser throughput, lexing included, over a large synthetic source
+// made of generated fuzzer programs, and the allocations parsing makes, for
+// the Bison parser and the hand-written one side by side.
+#include "../fuzz/programGenerator.h"
+#include "compiler.h"
+#include "memoryUsage.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+using namespace zips;
+using namespace zips::fuzz;
+
+void usage(const char *program) {
+  std::cerr << "Usage: " << program << " [options]" << std::endl;
+  std::cerr << "Options:" << std::endl;
+  std::cerr << "  --seed=number" << std::endl;
+  std::cerr << "  --functions=count" << std::endl;
+  std::cerr << "  --iterations=count" << std::endl;
+}
+
+int main(int argc, char **argv) {
+  uint64_t seed = 1;
+  size_t functionCount = 20000;
+  size_t iterationCount = 10;
+  for (int i = 1; i < argc; i++) {
+    std::string_view argument = argv[i];
+    if (argument.starts_with("--seed=")) {
+      seed = std::stoull(std::string(argument.substr(7)));
+    } else if (argument.starts_with("--functions=")) {
+      functionCount = std::stoul(std::string(argument.substr(12)));
+    } else if (argument.starts_with("--iterations=")) {
+      iterationCount = std::stoul(std::string(argument.substr(13)));
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  // Functions call the ones before them, so one program of every function
+  // keeps the calls and their argument lists in the source.
+  std::string source = ProgramGenerator(seed).generate(functionCount).source;
+  size_t lineCount = std::count(source.begin(), source.end(), '\n');
+
+  std::cout << "Source: " << source.size() << " bytes, " << lineCount
+            << " lines" << std::endl;
+  for (auto [kind, name] : {std::pair{ParserKind::BISON, "Bison"},
+                            std::pair{ParserKind::HAND_WRITTEN,
+                                      "Hand-written"}}) {
+    Compiler compiler;
+    compiler.setParserKind(kind);
+    double bestSeconds = 0;
+    for (size_t i = 0; i < iterationCount; i++) {
+      auto start = std::chrono::steady_clock::now();
+      bool parsed = compiler.parse(source, "bench.zps");
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      if (!parsed) {
+        std::cerr << name << ": the synthetic source failed to parse"
+                  << std::endl;
+        return 1;
+      }
+      if (i == 0 || elapsed.count() < bestSeconds) {
+        bestSeconds = elapsed.count();
+      }
+    }
+    // Counted separately, since tracking takes a lock per allocation. The
+    // counters keep the previous parser's allocations, which are subtracted.
+    constexpr size_t parsingPhase = static_cast<size_t>(MemoryPhase::PARSING);
+    MemoryCounters before = MemoryTracker::getReport().phases[parsingPhase];
+    MemoryTracker::setEnabled(true);
+    compiler.parse(source, "bench.zps");
+    MemoryTracker::setEnabled(false);
+    MemoryCounters parsing = MemoryTracker::getReport().phases[parsingPhase];
+    parsing.allocationCount -= before.allocationCount;
+    parsing.allocatedBytes -= before.allocatedBytes;
+    std::cout << name << ": best of " << iterationCount << ": "
+              << bestSeconds * 1000 << " ms, "
+              << source.size() / bestSeconds / 1e6 << " MB/s, "
+              << lineCount / bestSeconds << " lines/s" << std::endl;
+    std::cout << name << " parsing allocations: " << parsing.allocationCount
+              << ", " << parsing.allocatedBytes << " bytes" << std::endl;
+  }
+}
@@ -0,0 +1,683 @@
+// Differential fuzzer and runtime regression check for the code generator.
+//
+// Random programs are compiled in-process, assembled and linked with a C
+// driver, and their results are compared with the AST interpreter, as are
+// the bytecode interpreter's. The driver also measures the best rdtsc cycle
+// count of calling every function, which can be recorded and compared with a
+// recorded baseline. Each program, and variants of it with tokens deleted,
+// replaced or inserted, is also parsed by both parsers, whose ASTs and syntax
+// errors must be the same. Its functions are compiled in reverse order too,
+// and each must print exactly the same assembly as before. Every function is
+// also compiled into a static executable, whose exit status must be the low
+// byte of its results. Executables use a profile in which every function is
+// equally hot, so that calls to small functions are inlined. Calls which trap in the interpreter must trap in the
+// bytecode interpreter and the executable as well. A leaf function with
+// spills must use the red zone for System V, and set up a frame pointer for
+// Microsoft x64, which has none.
+#include "bytecode.h"
+#include "compiler.h"
+#include "interpreter.h"
+#include "programGenerator.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <random>
+#include <signal.h>
+#include <spawn.h>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace zips;
+using namespace zips::fuzz;
+
+void usage(const char *program) {
+  std::cerr << "Usage: " << program << " [options]" << std::endl;
+  std::cerr << "Options:" << std::endl;
+  std::cerr << "  --seed=number" << std::endl;
+  std::cerr << "  --programs=count" << std::endl;
+  std::cerr << "  --functions=count" << std::endl;
+  std::cerr << "  --cc=command" << std::endl;
+  std::cerr << "  --work-dir=directory" << std::endl;
+  std::cerr << "  --record=file" << std::endl;
+  std::cerr << "  --baseline=file" << std::endl;
+  std::cerr << "  --max-regression=percent" << std::endl;
+  std::cerr << "  --parser-mutations=count" << std::endl;
+}
+
+// Calls per signature, and how often the driver repeats all calls to time
+// them.
+static constexpr size_t argumentSetCount = 8;
+static constexpr size_t timingRepeatCount = 200;
+static constexpr unsigned timeoutSeconds = 10;
+
+static const char *getCType(PrimitiveTypeType type) {
+  switch (type) {
+  case PrimitiveTypeType::I8:
+    return "int8_t";
+  case PrimitiveTypeType::I16:
+    return "int16_t";
+  case PrimitiveTypeType::I32:
+    return "int32_t";
+  case PrimitiveTypeType::I64:
+    return "int64_t";
+  case PrimitiveTypeType::U8:
+    return "uint8_t";
+  case PrimitiveTypeType::U16:
+    return "uint16_t";
+  case PrimitiveTypeType::U32:
+    return "uint32_t";
+  case PrimitiveTypeType::U64:
+    return "uint64_t";
+  case PrimitiveTypeType::ISIZE:
+    return "intptr_t";
+  case PrimitiveTypeType::USIZE:
+    return "uintptr_t";
+  case PrimitiveTypeType::BOOL:
+    return "_Bool";
+  }
+  return "void";
+}
+
+// Tokens which mutations insert or replace others with.
+static const char *const mutationTokens[] = {
+    "let", "import", "if", "else", "while", "i32", "bool", "=",  "(",  ")",
+    "{",   "}",      ",",  ":",    ";",     "+",   "-",    "*",  "/",  "<",
+    "==",  ">=",     "+?", "+|", "a",  "f0"};
+
+// Splits a source into tokens and the spacing between them, which mutations
+// leave alone.
+static std::vector<std::string> splitTokens(std::string_view source) {
+  std::vector<std::string> pieces;
+  size_t position = 0;
+  while (position < source.size()) {
+    size_t end = position + 1;
+    auto isName = [](char c) { return std::isalnum(c) || c == '_'; };
+    if (std::isspace(source[position])) {
+      while (end < source.size() && std::isspace(source[end])) {
+        end++;
+      }
+    } else if (isName(source[position])) {
+      while (end < source.size() && isName(source[end])) {
+        end++;
+      }
+    } else if (end < source.size() &&
+               (source[end] == '=' ||
+                (source[position] == '+' &&
+                 (source[end] == '?' || source[end] == '|')))) {
+      end++;
+    }
+    pieces.emplace_back(source.substr(position, end - position));
+    position = end;
+  }
+  return pieces;
+}
+
+static std::string mutateSource(const std::vector<std::string> &pieces,
+                                std::mt19937_64 &random) {
+  std::vector<std::string> mutated = pieces;
+  size_t editCount = 1 + random() % 3;
+  for (size_t i = 0; i < editCount && !mutated.empty(); i++) {
+    size_t index = random() % mutated.size();
+    std::string &piece = mutated[index];
+    const char *token = mutationTokens[random() % std::size(mutationTokens)];
+    switch (random() % 8) {
+    case 0:
+      // Ends the source early.
+      mutated.resize(index);
+      break;
+    case 1:
+    case 2:
+      piece = " ";
+      break;
+    case 3:
+    case 4:
+    case 5:
+      piece = std::string(" ") + token + " ";
+      break;
+    default:
+      piece = std::string(" ") + token + " " + piece;
+      break;
+    }
+  }
+  std::string source;
+  for (auto &piece : mutated) {
+    source += piece;
+  }
+  return source;
+}
+
+static void describeNode(AstNode *node, std::string &text) {
+  text += std::to_string(static_cast<int>(node->getNodeType())) + "@" +
+          std::to_string(node->getLocation().line) + ":" +
+          std::to_string(node->getLocation().column) + " ";
+  for (size_t i = 0; i < node->getChildCount(); i++) {
+    describeNode(node->getChild(i), text);
+  }
+}
+
+static DiagnosticHandler collectDiagnostics(std::string &text) {
+  return [&text](const Diagnostic &diagnostic) {
+    text += std::to_string(diagnostic.line) + ":" +
+            std::to_string(diagnostic.column) + ": " + diagnostic.message +
+            "\n";
+  };
+}
+
+// The AST, with the locations which its text leaves out, and the
+// diagnostics.
+static std::string describeParse(Compiler &compiler,
+                                 std::string &diagnosticsText,
+                                 std::string_view source) {
+  diagnosticsText.clear();
+  bool parsed = compiler.parse(source, "mutated.zps");
+  std::string text = (parsed ? "parsed\n" : "failed\n") + diagnosticsText;
+  if (CompilationUnitNode *ast = compiler.getAst()) {
+    for (auto &import : ast->getImports()) {
+      text += "import " + import.moduleName + "@" +
+              std::to_string(import.location.line) + ":" +
+              std::to_string(import.location.column) + " ";
+    }
+    describeNode(ast, text);
+    text += "\n" + ast->toString();
+  }
+  return text;
+}
+
+// Functions start on lines beginning with "let", local definitions being
+// indented.
+static std::string reverseFunctions(std::string_view source) {
+  std::vector<std::string_view> functions;
+  size_t begin = 0;
+  while (begin < source.size()) {
+    size_t end = source.find("\nlet ", begin);
+    end = end == std::string_view::npos ? source.size() : end + 1;
+    functions.push_back(source.substr(begin, end - begin));
+    begin = end;
+  }
+  std::string reversed;
+  for (auto function = functions.rbegin(); function != functions.rend();
+       function++) {
+    reversed += *function;
+  }
+  return reversed;
+}
+
+// The assembly of each function, from its .globl to the next one's, in
+// name order.
+static std::vector<std::string_view> splitFunctions(std::string_view output) {
+  std::vector<std::string_view> functions;
+  size_t begin = output.find(".globl ");
+  while (begin != std::string_view::npos) {
+    size_t next = output.find(".globl ", begin + 1);
+    size_t end = next == std::string_view::npos ? output.find(".ident ", begin)
+                                                : next;
+    functions.push_back(output.substr(begin, end - begin));
+    begin = next;
+  }
+  std::sort(functions.begin(), functions.end());
+  return functions;
+}
+
+// Calls expect no result if a checked addition traps.
+struct Call {
+  const GeneratedSignature *signature;
+  std::vector<uint64_t> arguments;
+  std::optional<uint64_t> expected;
+};
+
+// Returns no result if the call traps, which the interpreters report as an
+// arithmetic overflow.
+template <typename Interpreter>
+static std::optional<uint64_t> interpret(Interpreter &interpreter,
+                                         const Call &call) {
+  try {
+    return interpreter.call(call.signature->name, call.arguments);
+  } catch (std::runtime_error &e) {
+    if (std::string_view(e.what()) != "Arithmetic overflow") {
+      throw;
+    }
+    return std::nullopt;
+  }
+}
+
+static void appendCall(std::string &driver, const Call &call) {
+  driver += call.signature->name + "(";
+  for (size_t i = 0; i < call.arguments.size(); i++) {
+    if (i > 0) {
+      driver += ", ";
+    }
+    driver += "(";
+    driver += getCType(call.signature->parameterTypes[i]);
+    driver += ")" + std::to_string(call.arguments[i]) + "ull";
+  }
+  driver += ")";
+}
+
+// Prints the result of each call the way wrapToType represents it, then the
+// best cycle count of making all of them. Calls which trap are left out, as
+// they would end the driver.
+static std::string generateDriver(const GeneratedProgram &program,
+                                  const std::vector<Call> &calls) {
+  std::string driver = "#include <stdint.h>\n#include <stdio.h>\n"
+                       "#include <unistd.h>\n#include <x86intrin.h>\n";
+  for (auto &signature : program.functions) {
+    driver += getCType(signature.returnType);
+    driver += " " + signature.name + "(";
+    for (size_t i = 0; i < signature.parameterTypes.size(); i++) {
+      driver += i > 0 ? ", " : "";
+      driver += getCType(signature.parameterTypes[i]);
+    }
+    driver += ");\n";
+  }
+  // Code generation bugs can make a loop run forever.
+  driver += "int main(void) {\n  alarm(" + std::to_string(timeoutSeconds) +
+            ");\n";
+  for (auto &call : calls) {
+    if (!call.expected) {
+      continue;
+    }
+    driver += isSigned(call.signature->returnType)
+                  ? "  printf(\"%llu\\n\", (unsigned long long)(int64_t)"
+                  : "  printf(\"%llu\\n\", (unsigned long long)";
+    appendCall(driver, call);
+    driver += ");\n";
+  }
+  driver += "  volatile uint64_t sink = 0;\n"
+            "  uint64_t best = UINT64_MAX;\n"
+            "  for (int i = 0; i < " +
+            std::to_string(timingRepeatCount) +
+            "; i++) {\n"
+            "    uint64_t begin = __rdtsc();\n";
+  for (auto &call : calls) {
+    if (!call.expected) {
+      continue;
+    }
+    driver += "    sink += ";
+    appendCall(driver, call);
+    driver += ";\n";
+  }
+  driver += "    uint64_t cycles = __rdtsc() - begin;\n"
+            "    best = cycles < best ? cycles : best;\n"
+            "  }\n"
+            "  printf(\"cycles %llu\\n\", (unsigned long long)best);\n"
+            "}\n";
+  return driver;
+}
+
+static void printCall(const Call &call, std::optional<uint64_t> actual) {
+  std::cerr << call.signature->name << "(";
+  for (size_t i = 0; i < call.arguments.size(); i++) {
+    std::cerr << (i > 0 ? ", " : "") << call.arguments[i];
+  }
+  std::cerr << ") ";
+  if (actual) {
+    std::cerr << "returned " << *actual;
+  } else {
+    std::cerr << "trapped";
+  }
+  std::cerr << ", expected ";
+  if (call.expected) {
+    std::cerr << *call.expected;
+  } else {
+    std::cerr << "a trap";
+  }
+  std::cerr << std::endl;
+}
+
+static void writeFile(const std::filesystem::path &path,
+                      std::string_view contents) {
+  std::ofstream output(path);
+  output << contents;
+}
+
+// Runs a static executable with the call's arguments and returns its wait
+// status, killing it if it runs too long.
+static int runExecutable(const std::filesystem::path &path,
+                         const Call &call) {
+  std::vector<std::string> arguments{path.string()};
+  for (uint64_t argument : call.arguments) {
+    arguments.push_back(std::to_string(argument));
+  }
+  std::vector<char *> argv;
+  for (auto &argument : arguments) {
+    argv.push_back(argument.data());
+  }
+  argv.push_back(nullptr);
+  pid_t pid;
+  if (posix_spawn(&pid, argv[0], nullptr, nullptr, argv.data(), environ) !=
+      0) {
+    return -1;
+  }
+  int status;
+  for (unsigned waited = 0; waitpid(pid, &status, WNOHANG) == 0; waited++) {
+    if (waited == timeoutSeconds * 1000) {
+      kill(pid, SIGKILL);
+    }
+    usleep(1000);
+  }
+  return status;
+}
+
+// Leaf functions may only leave out their frame within the System V red
+// zone, which Microsoft x64 doesn't have. The leaf keeps more values live
+// than there are registers, so it spills, but few enough to fit the zone.
+static bool checkLeafFrames() {
+  std::string source = "let leaf(a: i64, b: i64) = {\n"
+                       "  let v0: i64 = a + b;\n";
+  std::string sum = "v0";
+  for (size_t i = 1; i < 16; i++) {
+    std::string name = "v" + std::to_string(i);
+    source += "  let " + name + ": i64 = v" + std::to_string(i - 1) +
+              " + a;\n";
+    sum += " + " + name;
+  }
+  source += "  " + sum + "\n}\n";
+  std::string diagnostics;
+  Compiler compiler(collectDiagnostics(diagnostics));
+  if (!compiler.check(source, "leaf.zps")) {
+    std::cerr << "leaf frames: checking failed\n" << diagnostics;
+    return false;
+  }
+  CodeGenerator<TargetArchitecture::X86_64, TargetAbi::X86_64> systemV;
+  CodeGenerator<TargetArchitecture::X86_64, TargetAbi::MS_X64> microsoft;
+  std::string systemVOutput = systemV.generate(compiler.getAst());
+  std::string microsoftOutput = microsoft.generate(compiler.getAst());
+  constexpr std::string_view framePointerSetup = "movq %rsp, %rbp";
+  bool matches = true;
+  if (systemVOutput.find("(%rsp)") == std::string::npos ||
+      systemVOutput.find(framePointerSetup) != std::string::npos) {
+    std::cerr << "leaf frames: the System V leaf doesn't spill into the red "
+                 "zone without a frame pointer"
+              << std::endl;
+    matches = false;
+  }
+  if (microsoftOutput.find(framePointerSetup) == std::string::npos ||
+      microsoftOutput.find("(%rsp)") != std::string::npos) {
+    std::cerr << "leaf frames: the Microsoft x64 leaf spills without a frame "
+                 "pointer"
+              << std::endl;
+    matches = false;
+  }
+  return matches;
+}
+
+static std::map<uint64_t, uint64_t> readCycles(const std::string &fileName) {
+  std::map<uint64_t, uint64_t> cycles;
+  std::ifstream input(fileName);
+  if (!input) {
+    perror(fileName.c_str());
+    exit(1);
+  }
+  uint64_t seed, count;
+  while (input >> seed >> count) {
+    cycles[seed] = count;
+  }
+  return cycles;
+}
+
+int main(int argc, char **argv) {
+  uint64_t seed = 1;
+  size_t programCount = 100;
+  size_t functionCount = 4;
+  std::string cc = "cc";
+  std::filesystem::path workDirectory = "zips-fuzz";
+  std::string recordName;
+  std::string baselineName;
+  double maxRegression = 5;
+  size_t parserMutationCount = 20;
+  for (int i = 1; i < argc; i++) {
+    std::string_view argument = argv[i];
+    if (argument.starts_with("--seed=")) {
+      seed = std::stoull(std::string(argument.substr(7)));
+    } else if (argument.starts_with("--programs=")) {
+      programCount = std::stoul(std::string(argument.substr(11)));
+    } else if (argument.starts_with("--functions=")) {
+      functionCount = std::stoul(std::string(argument.substr(12)));
+    } else if (argument.starts_with("--cc=")) {
+      cc = argument.substr(5);
+    } else if (argument.starts_with("--work-dir=")) {
+      workDirectory = argument.substr(11);
+    } else if (argument.starts_with("--record=")) {
+      recordName = argument.substr(9);
+    } else if (argument.starts_with("--baseline=")) {
+      baselineName = argument.substr(11);
+    } else if (argument.starts_with("--max-regression=")) {
+      maxRegression = std::stod(std::string(argument.substr(17)));
+    } else if (argument.starts_with("--parser-mutations=")) {
+      parserMutationCount = std::stoul(std::string(argument.substr(19)));
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  std::filesystem::create_directories(workDirectory);
+  std::filesystem::path assemblyPath = workDirectory / "program.s";
+  std::filesystem::path driverPath = workDirectory / "driver.c";
+  std::filesystem::path executablePath = workDirectory / "program";
+  std::filesystem::path staticExecutablePath = workDirectory / "static";
+  std::string buildCommand = cc + " -O2 -o '" + executablePath.string() +
+                             "' '" + assemblyPath.string() + "' '" +
+                             driverPath.string() + "'";
+
+  std::string diagnosticsText;
+  Compiler compiler([&](const Diagnostic &diagnostic) {
+    diagnosticsText += diagnostic.message + "\n";
+  });
+  std::string reorderedDiagnostics;
+  Compiler reorderedCompiler(collectDiagnostics(reorderedDiagnostics));
+  std::string executableDiagnostics;
+  Compiler executableCompiler(collectDiagnostics(executableDiagnostics));
+  std::string bisonDiagnostics;
+  Compiler bisonParser(collectDiagnostics(bisonDiagnostics));
+  bisonParser.setParserKind(ParserKind::BISON);
+  std::string handDiagnostics;
+  Compiler handParser(collectDiagnostics(handDiagnostics));
+  handParser.setParserKind(ParserKind::HAND_WRITTEN);
+  std::map<uint64_t, uint64_t> cycles;
+  size_t failureCount = checkLeafFrames() ? 0 : 1;
+  for (size_t programIndex = 0; programIndex < programCount; programIndex++) {
+    uint64_t programSeed = seed + programIndex;
+    ProgramGenerator generator(programSeed);
+    GeneratedProgram program = generator.generate(functionCount);
+    std::string failurePath =
+        (workDirectory / ("failure-" + std::to_string(programSeed) + ".zps"))
+            .string();
+    auto fail = [&](std::string_view reason,
+                    std::string_view source = {}) {
+      std::cerr << "seed " << programSeed << ": " << reason << ", see "
+                << failurePath << std::endl;
+      writeFile(failurePath, source.empty() ? program.source : source);
+      failureCount++;
+    };
+
+    std::vector<std::string> pieces = splitTokens(program.source);
+    std::mt19937_64 random(programSeed);
+    std::string differingSource;
+    for (size_t i = 0; i <= parserMutationCount && differingSource.empty();
+         i++) {
+      std::string source =
+          i == 0 ? program.source : mutateSource(pieces, random);
+      if (describeParse(bisonParser, bisonDiagnostics, source) !=
+          describeParse(handParser, handDiagnostics, source)) {
+        differingSource = std::move(source);
+      }
+    }
+    if (!differingSource.empty()) {
+      fail("the parsers differ", differingSource);
+      continue;
+    }
+
+    diagnosticsText.clear();
+    if (!compiler.compile(program.source, failurePath)) {
+      fail("compilation failed\n" + diagnosticsText);
+      continue;
+    }
+    std::string reversedSource = reverseFunctions(program.source);
+    reorderedDiagnostics.clear();
+    if (!reorderedCompiler.compile(reversedSource, failurePath)) {
+      fail("compilation with the functions reversed failed\n" +
+               reorderedDiagnostics,
+           reversedSource);
+      continue;
+    }
+    if (splitFunctions(compiler.getOutput()) !=
+        splitFunctions(reorderedCompiler.getOutput())) {
+      fail("reordering the functions changed their assembly", reversedSource);
+      continue;
+    }
+    std::vector<Call> calls;
+    size_t bytecodeMismatchCount = 0;
+    try {
+      AstInterpreter interpreter(compiler.getAst());
+      BytecodeInterpreter bytecodeInterpreter(compiler.getAst());
+      for (auto &signature : program.functions) {
+        for (size_t i = 0; i < argumentSetCount; i++) {
+          Call call{&signature, generator.generateArguments(signature), 0};
+          call.expected = interpret(interpreter, call);
+          std::optional<uint64_t> bytecodeResult =
+              interpret(bytecodeInterpreter, call);
+          if (bytecodeResult != call.expected) {
+            std::cerr << "bytecode: ";
+            printCall(call, bytecodeResult);
+            bytecodeMismatchCount++;
+          }
+          calls.push_back(std::move(call));
+        }
+      }
+    } catch (std::runtime_error &e) {
+      fail(std::string("interpreter failed: ") + e.what());
+      continue;
+    }
+    if (bytecodeMismatchCount > 0) {
+      fail("bytecode results differ from the interpreter");
+      continue;
+    }
+
+    writeFile(assemblyPath, std::string(compiler.getOutput()) + "\n");
+    writeFile(driverPath, generateDriver(program, calls));
+    if (std::system(buildCommand.c_str()) != 0) {
+      fail("assembling or linking failed");
+      continue;
+    }
+    FILE *results = popen(("'" + executablePath.string() + "'").c_str(), "r");
+    if (!results) {
+      perror(executablePath.c_str());
+      return 1;
+    }
+    bool matches = true;
+    for (auto &call : calls) {
+      if (!call.expected) {
+        continue;
+      }
+      unsigned long long actual;
+      if (fscanf(results, "%llu", &actual) != 1) {
+        matches = false;
+        break;
+      }
+      if (actual != call.expected) {
+        printCall(call, actual);
+        matches = false;
+      }
+    }
+    unsigned long long programCycles;
+    bool timed = matches && fscanf(results, " cycles %llu", &programCycles) == 1;
+    if (pclose(results) != 0 || !matches || !timed) {
+      fail("results differ from the interpreter");
+      continue;
+    }
+    cycles[programSeed] = programCycles;
+
+    std::string profileText;
+    for (auto &signature : program.functions) {
+      profileText += signature.name + " 1\n";
+    }
+    std::istringstream profileInput(profileText);
+    executableCompiler.setProfile(Profile::read(profileInput));
+    bool executablesMatch = true;
+    for (auto &signature : program.functions) {
+      executableCompiler.setEntryPoints({signature.name});
+      executableCompiler.setExecutableEntry(signature.name);
+      executableDiagnostics.clear();
+      if (!executableCompiler.compile(program.source, failurePath)) {
+        std::cerr << executableDiagnostics;
+        executablesMatch = false;
+        break;
+      }
+      std::filesystem::remove(staticExecutablePath);
+      {
+        std::ofstream output(staticExecutablePath, std::ios::binary);
+        output << executableCompiler.getOutput();
+      }
+      std::filesystem::permissions(staticExecutablePath,
+                                   std::filesystem::perms::owner_all);
+      for (auto &call : calls) {
+        if (call.signature != &signature) {
+          continue;
+        }
+        // Traps are ud2, which raises SIGILL.
+        int status = runExecutable(staticExecutablePath, call);
+        bool trapped = WIFSIGNALED(status) && WTERMSIG(status) == SIGILL;
+        if (call.expected ? !WIFEXITED(status) ||
+                                static_cast<uint64_t>(WEXITSTATUS(status)) !=
+                                    (*call.expected & 0xff)
+                          : !trapped) {
+          std::cerr << "executable: ";
+          printCall(call, trapped ? std::nullopt
+                                  : std::optional<uint64_t>(
+                                        WIFEXITED(status) ? WEXITSTATUS(status)
+                                                          : status));
+          executablesMatch = false;
+        }
+      }
+    }
+    if (!executablesMatch) {
+      fail("static executables differ from the interpreter");
+      continue;
+    }
+  }
+
+  if (!recordName.empty()) {
+    std::ofstream record(recordName);
+    for (auto [programSeed, count] : cycles) {
+      record << programSeed << " " << count << "\n";
+    }
+  }
+  if (!baselineName.empty()) {
+    // The geometric mean weighs every program's speedup or slowdown the same,
+    // however long it runs.
+    double logRatioSum = 0;
+    size_t comparedCount = 0;
+    for (auto [programSeed, baselineCount] : readCycles(baselineName)) {
+      auto count = cycles.find(programSeed);
+      if (count != cycles.end() && baselineCount > 0 && count->second > 0) {
+        logRatioSum += std::log(static_cast<double>(count->second) /
+                                static_cast<double>(baselineCount));
+        comparedCount++;
+      }
+    }
+    if (comparedCount > 0) {
+      double change = (std::exp(logRatioSum / comparedCount) - 1) * 100;
+      std::cerr << "runtime change over " << comparedCount
+                << " programs: " << change << "%" << std::endl;
+      if (change > maxRegression) {
+        std::cerr << "regression exceeds " << maxRegression << "%"
+                  << std::endl;
+        failureCount++;
+      }
+    }
+  }
+  std::cerr << programCount << " programs, " << failureCount << " failures"
+            << std::endl;
+  return failureCount == 0 ? 0 : 1;
+}
@@ -0,0 +1,326 @@
+#include "programGenerator.h"
+#include <algorithm>
+
+namespace zips::fuzz {
+static constexpr PrimitiveTypeType valueTypes[] = {
+    PrimitiveTypeType::I8,    PrimitiveTypeType::I16, PrimitiveTypeType::I32,
+    PrimitiveTypeType::I64,   PrimitiveTypeType::U8,  PrimitiveTypeType::U16,
+    PrimitiveTypeType::U32,   PrimitiveTypeType::U64, PrimitiveTypeType::ISIZE,
+    PrimitiveTypeType::USIZE};
+
+static constexpr const char *comparisonOperators[] = {"==", "!=", "<",
+                                                      "<=", ">",  ">="};
+
+// The statements nest at most this deep, and expressions at most this deep.
+static constexpr size_t maxDepth = 3;
+static constexpr size_t maxLoopDepth = 2;
+static constexpr size_t maxCallsPerFunction = 2;
+// All parameters are passed in registers, of which there are six, and at
+// least the loop bound, one and zero are passed.
+static constexpr size_t maxParameterCount = 6;
+static constexpr const char *valueParameterNames[] = {"a", "b", "c"};
+
+// The other parameters are the flag, the loop bound, one and zero.
+static bool isValueParameter(std::string_view name) {
+  return std::find(std::begin(valueParameterNames),
+                   std::end(valueParameterNames),
+                   name) != std::end(valueParameterNames);
+}
+
+void ProgramGenerator::indent(size_t depth) {
+  source.append(2 * (depth + 1), ' ');
+}
+
+PrimitiveTypeType ProgramGenerator::pickType() {
+  return chance(50) ? valueType : valueTypes[pick(std::size(valueTypes))];
+}
+
+PrimitiveTypeType ProgramGenerator::generateValue(size_t depth) {
+  if (depth >= maxDepth || chance(40)) {
+    Variable &variable = variables[pick(variables.size())];
+    source += variable.name;
+    return variable.type;
+  }
+  if (remainingCalls > 0 && chance(15)) {
+    std::vector<const GeneratedSignature *> callable;
+    for (auto &callee : callees) {
+      if (loopDepth + callee.loopDepth <= maxLoopDepth) {
+        callable.push_back(&callee);
+      }
+    }
+    if (!callable.empty()) {
+      remainingCalls--;
+      const GeneratedSignature &callee = *callable[pick(callable.size())];
+      functionLoopDepth =
+          std::max(functionLoopDepth, loopDepth + callee.loopDepth);
+      source += callee.name + '(';
+      for (size_t i = 0; i < callee.parameterNames.size(); i++) {
+        source += i > 0 ? ", " : "";
+        const std::string &name = callee.parameterNames[i];
+        if (isValueParameter(name)) {
+          generateValue(depth + 1);
+        } else if (name == "flag" && !hasFlag) {
+          generateCondition();
+        } else {
+          source += name;
+        }
+      }
+      source += ')';
+      return callee.returnType;
+    }
+  }
+  if (chance(5)) {
+    // Adding zero can't overflow, whichever side it's on, as long as it's
+    // parenthesized.
+    PrimitiveTypeType type;
+    if (chance(50)) {
+      source += "(zero +? ";
+      type = generateValue(depth + 1);
+      // Like other sums, 8-bit ones take the left operand's type.
+      if (getBits(type) == 8) {
+        type = PrimitiveTypeType::U8;
+      }
+    } else {
+      source += '(';
+      type = generateValue(depth + 1);
+      source += " +? zero";
+    }
+    source += ')';
+    return type;
+  }
+  bool parenthesize = chance(30);
+  if (parenthesize) {
+    source += '(';
+  }
+  PrimitiveTypeType left = generateValue(depth + 1);
+  // Checked additions of values may trap, so they are rare.
+  size_t operatorKind = pick(200);
+  source += operatorKind == 0 ? " +? " : operatorKind < 40 ? " +| " : " + ";
+  PrimitiveTypeType right = generateValue(depth + 1);
+  if (parenthesize) {
+    source += ')';
+  }
+  // Like the type checker, the wider operand's type, or the left one's.
+  return getBits(left) >= getBits(right) ? left : right;
+}
+
+void ProgramGenerator::generateReturnValue() {
+  PrimitiveTypeType type = generateValue(0);
+  if (!returnType) {
+    returnType = type;
+  }
+}
+
+void ProgramGenerator::generateCondition() {
+  size_t kind = pick(4);
+  if (kind == 0 && hasFlag) {
+    source += "flag";
+  } else if (kind == 1 && !conditions.empty()) {
+    source += conditions[pick(conditions.size())];
+  } else {
+    generateValue(1);
+    source += ' ';
+    source += comparisonOperators[pick(std::size(comparisonOperators))];
+    source += ' ';
+    generateValue(1);
+  }
+}
+
+void ProgramGenerator::generateBlock(size_t depth) {
+  size_t variablesBegin = variables.size();
+  size_t conditionsBegin = conditions.size();
+  source += "{\n";
+  generateStatements(depth + 1, 1 + pick(3));
+  // An early return may only end a block, since nothing after it would run.
+  if (chance(15)) {
+    indent(depth + 1);
+    generateReturnValue();
+    source += '\n';
+  }
+  indent(depth);
+  source += '}';
+  variables.resize(variablesBegin);
+  conditions.resize(conditionsBegin);
+}
+
+void ProgramGenerator::generateStatements(size_t depth, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    generateStatement(depth);
+  }
+}
+
+void ProgramGenerator::generateStatement(size_t depth) {
+  std::string name = "v" + std::to_string(variableCount++);
+  size_t kind = pick(depth < maxDepth ? 7 : 4);
+  indent(depth);
+  switch (kind) {
+  case 0:
+    source += "let " + name + " = ";
+    generateCondition();
+    source += ";\n";
+    conditions.push_back(std::move(name));
+    return;
+  case 1: {
+    std::vector<size_t> assignable;
+    for (size_t i = 0; i < variables.size(); i++) {
+      if (variables[i].assignable) {
+        assignable.push_back(i);
+      }
+    }
+    if (!assignable.empty()) {
+      source += variables[assignable[pick(assignable.size())]].name + " = ";
+      generateValue(0);
+      source += ";\n";
+      return;
+    }
+    break;
+  }
+  case 2:
+    generateValue(0);
+    source += ";\n";
+    return;
+  case 4:
+  case 5:
+    source += "if ";
+    generateCondition();
+    source += ' ';
+    generateBlock(depth);
+    if (chance(50)) {
+      source += " else ";
+      generateBlock(depth);
+    }
+    source += '\n';
+    return;
+  case 6:
+    if (loopDepth < maxLoopDepth) {
+      // The counter isn't a value variable, so nothing else assigns it.
+      source += "let " + name + " = zero;\n";
+      indent(depth);
+      source += "while " + name + " < n ";
+      loopDepth++;
+      functionLoopDepth = std::max(functionLoopDepth, loopDepth);
+      size_t variablesBegin = variables.size();
+      size_t conditionsBegin = conditions.size();
+      source += "{\n";
+      generateStatements(depth + 1, 1 + pick(3));
+      indent(depth + 1);
+      source += name + " = " + name + " + one;\n";
+      indent(depth);
+      source += "}\n";
+      variables.resize(variablesBegin);
+      conditions.resize(conditionsBegin);
+      loopDepth--;
+      return;
+    }
+    break;
+  }
+  // A definition, also used when the chosen statement isn't possible here.
+  source += "let " + name;
+  std::optional<PrimitiveTypeType> declaredType;
+  if (chance(50)) {
+    declaredType = pickType();
+    source += ": " + primitiveTypeTypeToString[*declaredType];
+  }
+  source += " = ";
+  PrimitiveTypeType type = generateValue(0);
+  source += ";\n";
+  variables.push_back(
+      Variable{std::move(name), declaredType.value_or(type), true});
+}
+
+void ProgramGenerator::generateFunction(GeneratedSignature &signature) {
+  valueType = signature.parameterTypes[0];
+  variables.clear();
+  hasFlag = false;
+  source += "let " + signature.name + "(";
+  for (size_t i = 0; i < signature.parameterNames.size(); i++) {
+    const std::string &name = signature.parameterNames[i];
+    PrimitiveTypeType type = signature.parameterTypes[i];
+    source += i > 0 ? ", " : "";
+    source += name + ": " + primitiveTypeTypeToString[type];
+    if (isValueParameter(name)) {
+      variables.push_back(Variable{name, type, true});
+    } else if (name == "flag") {
+      hasFlag = true;
+    }
+  }
+  source += ") = {\n";
+  returnType = std::nullopt;
+  conditions.clear();
+  variableCount = 0;
+  functionLoopDepth = 0;
+  remainingCalls = maxCallsPerFunction;
+  // Some functions only return a value, which makes them small enough to
+  // inline.
+  generateStatements(0, chance(20) ? 0 : 2 + pick(6));
+  indent(0);
+  generateReturnValue();
+  source += "\n}\n";
+  signature.returnType = *returnType;
+  signature.loopDepth = functionLoopDepth;
+}
+
+GeneratedProgram ProgramGenerator::generate(size_t functionCount) {
+  GeneratedProgram program;
+  source.clear();
+  for (size_t i = 0; i < functionCount; i++) {
+    valueType = valueTypes[pick(std::size(valueTypes))];
+    GeneratedSignature signature{"f" + std::to_string(i), {}, {}, valueType};
+    size_t valueCount = 1 + pick(std::size(valueParameterNames));
+    for (size_t j = 0; j < valueCount; j++) {
+      signature.parameterNames.push_back(valueParameterNames[j]);
+      signature.parameterTypes.push_back(j == 0 ? valueType : pickType());
+    }
+    if (valueCount + 4 <= maxParameterCount && chance(50)) {
+      signature.parameterNames.push_back("flag");
+      signature.parameterTypes.push_back(PrimitiveTypeType::BOOL);
+    }
+    for (const char *name : {"n", "one", "zero"}) {
+      signature.parameterNames.push_back(name);
+      signature.parameterTypes.push_back(PrimitiveTypeType::U8);
+    }
+    callees = program.functions;
+    generateFunction(signature);
+    program.functions.push_back(std::move(signature));
+  }
+  program.source = std::move(source);
+  return program;
+}
+
+std::vector<uint64_t>
+ProgramGenerator::generateArguments(const GeneratedSignature &signature) {
+  auto generateValueArgument = [&](PrimitiveTypeType type) -> uint64_t {
+    switch (pick(6)) {
+    case 0:
+      return 0;
+    case 1:
+      return 1;
+    case 2:
+      return UINT64_MAX;
+    case 3:
+      // The largest signed value of every width.
+      return UINT64_MAX >> (64 - getBits(type) + 1);
+    case 4:
+      return pick(64);
+    default:
+      return random();
+    }
+  };
+  std::vector<uint64_t> arguments;
+  for (size_t i = 0; i < signature.parameterNames.size(); i++) {
+    const std::string &name = signature.parameterNames[i];
+    if (name == "flag") {
+      arguments.push_back(pick(2));
+    } else if (name == "n") {
+      arguments.push_back(pick(maxLoopCount));
+    } else if (name == "one") {
+      arguments.push_back(1);
+    } else if (name == "zero") {
+      arguments.push_back(0);
+    } else {
+      arguments.push_back(generateValueArgument(signature.parameterTypes[i]));
+    }
+  }
+  return arguments;
+}
+} // namespace zips::fuzz
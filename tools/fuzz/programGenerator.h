@@ -0,0 +1,94 @@
+#ifndef ZIPS_FUZZ_PROGRAM_GENERATOR_H
+#define ZIPS_FUZZ_PROGRAM_GENERATOR_H
+
+#include "type.h"
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace zips::fuzz {
+struct GeneratedSignature {
+  std::string name;
+  std::vector<std::string> parameterNames;
+  std::vector<PrimitiveTypeType> parameterTypes;
+  PrimitiveTypeType returnType;
+  // How deep its loops nest, counting those of the functions it calls.
+  size_t loopDepth = 0;
+};
+
+struct GeneratedProgram {
+  std::string source;
+  std::vector<GeneratedSignature> functions;
+};
+
+/**
+ * @brief generates random well-typed programs.
+ *
+ * Every function computes mostly over one random primitive type, mixed with
+ * values of other widths and signedness, so all widths and the conversions
+ * between them get covered. Loops count up to a u8 parameter, which keeps
+ * every program terminating for the arguments the fuzzer passes. Functions
+ * take one to three values, and call the ones before them a few times,
+ * passing the loop bounds through. Calls may be in loops as long as loops
+ * nest no deeper than in a single function, counting those of the callee.
+ * Checked additions add zero, so they can't overflow, except for a few which
+ * trap for some arguments.
+ */
+class ProgramGenerator {
+  std::mt19937_64 random;
+  // The type the current function mostly computes over.
+  PrimitiveTypeType valueType = PrimitiveTypeType::I32;
+  // The type of the first return, which the function's return type is
+  // inferred from.
+  std::optional<PrimitiveTypeType> returnType;
+
+  struct Variable {
+    std::string name;
+    PrimitiveTypeType type;
+    bool assignable;
+  };
+  // Variables of non-bool types in scope, innermost last.
+  std::vector<Variable> variables;
+  std::vector<std::string> conditions;
+  size_t variableCount = 0;
+  size_t loopDepth = 0;
+  // The deepest loop depth reached, counting that of callees.
+  size_t functionLoopDepth = 0;
+  bool hasFlag = false;
+  // The functions the current one may call, and how many calls it has left.
+  std::span<const GeneratedSignature> callees;
+  size_t remainingCalls = 0;
+  std::string source;
+
+  size_t pick(size_t count) {
+    return std::uniform_int_distribution<size_t>(0, count - 1)(random);
+  }
+  bool chance(size_t percent) { return pick(100) < percent; }
+
+  void indent(size_t depth);
+  PrimitiveTypeType pickType();
+  // Returns the type of the generated expression.
+  PrimitiveTypeType generateValue(size_t depth);
+  void generateReturnValue();
+  void generateCondition();
+  void generateStatements(size_t depth, size_t count);
+  void generateStatement(size_t depth);
+  void generateBlock(size_t depth);
+  void generateFunction(GeneratedSignature &signature);
+
+public:
+  // The values passed to loop bounds stay below this.
+  static constexpr uint64_t maxLoopCount = 16;
+
+  explicit ProgramGenerator(uint64_t seed) : random(seed) {}
+
+  GeneratedProgram generate(size_t functionCount);
+  // Arguments for a signature, as bit patterns of any width.
+  std::vector<uint64_t> generateArguments(const GeneratedSignature &signature);
+};
+} // namespace zips::fuzz
+
+#endif